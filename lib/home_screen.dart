@@ -1,3 +1,4 @@
+import 'dart:math';
 import 'dart:typed_data';
 
 import 'package:flutter/material.dart';
@@ -22,16 +23,150 @@ class EditableDayHandler extends StatefulWidget {
   State<StatefulWidget> createState() => _EditableDayHandlerState();
 }
 
+//the single replacement (position, delete count, inserted text) that turns from into to
+(int, int, String) differenceBetween(String from, String to) {
+  int prefix = 0;
+  while(prefix < from.length && prefix < to.length && from.codeUnitAt(prefix) == to.codeUnitAt(prefix)) {
+    ++prefix;
+  }
+
+  int suffix = 0;
+  while(suffix < from.length - prefix && suffix < to.length - prefix && from.codeUnitAt(from.length - 1 - suffix) == to.codeUnitAt(to.length - 1 - suffix)) {
+    ++suffix;
+  }
+
+  return (prefix, from.length - prefix - suffix, to.substring(prefix, to.length - suffix));
+}
+
+//keystrokes are sent as edits of the version the server last confirmed, at most one edit is in flight and whatever is typed
+//meanwhile goes out as one edit once it is answered
 class _EditableDayHandlerState extends State<EditableDayHandler> with SendNetworkMessageHelper {
   var textController = TextEditingController();
+  String serverName = ''; //the name as of serverVersion
+  int serverVersion = 0;
+  String? sentName; //what the edit in flight turns serverName into, null while no edit is in flight
 
-  void requestServerHandlerName() async {
-    var message = ClientMessage(ClientMessageType.getHandler, 8);
-    message.viewData.setUint64(0, widget.handlerKey, Endian.little);
+  void showHandlerName(String newHandler) {
+    if(textController.text != newHandler){
+      setState(() {
+        textController.value = TextEditingValue(
+            text: newHandler,
+            selection: TextSelection.fromPosition(TextPosition(offset: newHandler.length))
+        );
+      });
+    }
+  }
+
+  //kept across views so revisiting a week only asks the server for what changed
+  void confirmServerName(int version, String name) {
+    serverName = name;
+    serverVersion = version;
+    ServerCommunicator.of(context).communicatorService.knownHandlers[widget.handlerKey] = (version, name);
+  }
+
+  void onServerHandlerName(int version, String name) {
+    if(sentName != null) return; //the answer to the edit in flight brings the name up to date
+
+    confirmServerName(version, name);
+    showHandlerName(name);
+  }
+
+  void requestHandlerName() {
+    var message = ClientMessage(ClientMessageType.getHandlerRange, 12);
+    message.viewData.setUint16(0, 1 << widget.handlerId.index, Endian.little);
+    message.viewData.setUint16(2, widget.date.ordinalDate, Endian.little);
+    message.viewData.setUint16(4, 1, Endian.little);
+    message.viewData.setUint32(8, widget.date.year, Endian.little);
 
     sendNetworkMessage(message);
   }
 
+  //an edit by someone else. the server answers an edit in flight only after every edit it was merged with, so those are skipped
+  void onServerEdit(ServerMessage message) {
+    if(sentName != null) return;
+
+    final data = message.viewData;
+    final int baseVersion = data.getUint32(8, Endian.little);
+    if(baseVersion != serverVersion) {
+      requestHandlerName(); //missed a change
+      return;
+    }
+
+    final int position = data.getUint16(12, Endian.little);
+    final int deleteCount = data.getUint16(14, Endian.little);
+
+    var stringBuilder = StringBuffer();
+    for(int index = 16; index < message.dataSize; index += 2) {
+      stringBuilder.writeCharCode(data.getUint16(index, Endian.little));
+    }
+    final String inserted = stringBuilder.toString();
+
+    if(position + deleteCount > serverName.length) {
+      requestHandlerName();
+      return;
+    }
+
+    confirmServerName(baseVersion + 1, serverName.replaceRange(position, position + deleteCount, inserted));
+
+    int moveOffset(int offset) {
+      if(offset <= position) return offset;
+      if(offset >= position + deleteCount) return offset - deleteCount + inserted.length;
+      return position + inserted.length;
+    }
+
+    final selection = textController.selection;
+    setState(() {
+      textController.value = TextEditingValue(
+          text: serverName,
+          selection: selection.isValid
+              ? TextSelection(baseOffset: moveOffset(selection.baseOffset), extentOffset: moveOffset(selection.extentOffset))
+              : TextSelection.collapsed(offset: serverName.length)
+      );
+    });
+  }
+
+  void onEditAcknowledged(int version) {
+    if(sentName == null) return;
+
+    confirmServerName(version, sentName!);
+    sentName = null;
+    sendEdit();
+  }
+
+  //the edit in flight was merged with edits of others, what was typed since it was sent is replayed on the merged name
+  void onEditRebased(int version, String name) {
+    final String? sent = sentName;
+    sentName = null;
+
+    if(sent == null) {
+      onServerHandlerName(version, name);
+      return;
+    }
+
+    final (int position, int deleteCount, String inserted) = differenceBetween(sent, textController.text);
+    final int start = min(position, name.length);
+
+    confirmServerName(version, name);
+    showHandlerName(name.replaceRange(start, min(start + deleteCount, name.length), inserted));
+    sendEdit();
+  }
+
+  //the answer to a resync after reconnecting. an edit still in flight either made it and is part of the answer, or was lost with
+  //the connection and is sent again
+  void onResynced(ServerMessage message) {
+    for(final (int handlerKey, int version, String name) in message.changedHandlerEntries) {
+      if(handlerKey == widget.handlerKey) {
+        sentName != null ? onEditRebased(version, name) : onServerHandlerName(version, name);
+        return;
+      }
+    }
+
+    if(sentName != null) {
+      sentName = null;
+      sendEdit();
+    }
+  }
+
   void listenForServerHandlerName() async {
     final serverCommunicator = ServerCommunicator.of(context);
     await for(final ServerMessage message in serverCommunicator.messageStream){
@@ -43,42 +178,67 @@ class _EditableDayHandlerState extends State<EditableDayHandler> with SendNetwor
           stringBuilder.writeCharCode(message.viewMessage.getUint16(index, Endian.little));
         }
 
-        final String newHandler = stringBuilder.toString();
-        if(textController.text != newHandler){
-          setState(() {
-            textController.value = TextEditingValue(
-                text: newHandler,
-                selection: TextSelection.fromPosition(TextPosition(offset: newHandler.length))
-            );
-          });
+        onServerHandlerName(serverVersion, stringBuilder.toString());
+      }
+      else if(message.type == ServerMessageType.sentHandlerRange.index || message.type == ServerMessageType.sentHandlerUpdates.index) {
+        for(final (int handlerKey, int version, String name) in message.handlerEntries) {
+          if(handlerKey == widget.handlerKey) {
+            onServerHandlerName(version, name);
+            break;
+          }
+        }
+      }
+      else if(message.type == ServerMessageType.sentHandlerChanges.index) {
+        onResynced(message);
+      }
+      else if(message.viewData.lengthInBytes >= 8 && message.viewData.getUint64(0, Endian.little) == widget.handlerKey) {
+        if(message.type == ServerMessageType.editedHandler.index) {
+          onServerEdit(message);
+        }
+        else if(message.type == ServerMessageType.editAcknowledged.index) {
+          onEditAcknowledged(message.viewData.getUint32(8, Endian.little));
+        }
+        else if(message.type == ServerMessageType.editRebased.index) {
+          final (_, int version, String name) = message.handlerEntryAt(0);
+          onEditRebased(version, name);
         }
       }
     }
   }
 
-  void onUserChangedHandlerName(String name) async {
-    var message = ClientMessage(ClientMessageType.setHandler, 8 + ((name.length + 1) * 2));
+  //sends the difference between the confirmed name and the typed one as a single edit
+  void sendEdit() {
+    final String name = textController.text;
+    final (int position, int deleteCount, String inserted) = differenceBetween(serverName, name);
+    if(deleteCount == 0 && inserted.isEmpty) return;
+
+    var message = ClientMessage(ClientMessageType.editHandler, 16 + (inserted.length * 2));
     message.viewData.setUint64(0, widget.handlerKey, Endian.little);
+    message.viewData.setUint32(8, serverVersion, Endian.little);
+    message.viewData.setUint16(12, position, Endian.little);
+    message.viewData.setUint16(14, deleteCount, Endian.little);
 
-    for(var index = 0; index < name.length; ++index){
-      message.viewData.setUint16(8 + (index * 2), name.codeUnitAt(index), Endian.little);
+    for(var index = 0; index < inserted.length; ++index){
+      message.viewData.setUint16(16 + (index * 2), inserted.codeUnitAt(index), Endian.little);
     }
 
+    sentName = name;
     sendNetworkMessage(message);
   }
 
+  void onUserChangedHandlerName(String name) {
+    if(sentName == null) sendEdit(); //otherwise sent once the edit in flight is answered
+  }
+
   @override void initState(){
     super.initState();
-    listenForServerHandlerName();
-    requestServerHandlerName();
-  }
 
-  @override void didUpdateWidget(covariant EditableDayHandler oldWidget) {
-    super.didUpdateWidget(oldWidget);
+    final (int version, String name) = ServerCommunicator.of(context).communicatorService.knownHandlers[widget.handlerKey] ?? (0, '');
+    serverName = name;
+    serverVersion = version;
+    textController.text = name;
 
-    if(oldWidget.handlerKey != widget.handlerKey){
-      requestServerHandlerName();
-    }
+    listenForServerHandlerName(); //the names are requested for the whole view by the home screen
   }
 
   @override void dispose() {
@@ -225,9 +385,10 @@ class HomeScreen extends StatefulWidget {
   State<StatefulWidget> createState() => _HomeScreenState();
 }
 
-class _HomeScreenState extends State<HomeScreen> {
+class _HomeScreenState extends State<HomeScreen> with SendNetworkMessageHelper {
   int subScreenSelected = 0;
   late DateTime viewingDate;
+  late PersistentServerCommunicator communicatorService; //kept for dispose, which can not look it up
 
   _HomeScreenState() {
     viewingDate = DateTime.now().toLocal();
@@ -245,24 +406,103 @@ class _HomeScreenState extends State<HomeScreen> {
     return (year, week);
   }
 
+  //a range covers every handler of the viewed week, a week crossing new year needs one per year
+  void sendViewedWeekRanges(ClientMessageType messageType) {
+    var date = viewingDate;
+    int remainingDays = 7;
+
+    while(remainingDays > 0) {
+      final int daysLeftInYear = DateTime(date.year, 12, 31).ordinalDate - date.ordinalDate + 1;
+      final int dayCount = min(remainingDays, daysLeftInYear);
+
+      final communicatorService = ServerCommunicator.of(context).communicatorService;
+      final bool sendVersions = messageType == ClientMessageType.getHandlerRange;
+      final int versionCount = sendVersions ? dayCount * DayHandlerID.values.length : 0;
+      final int rangeOffset = messageType == ClientMessageType.resyncHandlers ? 16 : 0; //a resync starts with the sync point
+
+      var message = ClientMessage(messageType, rangeOffset + 12 + (versionCount * 4));
+      if(rangeOffset != 0) {
+        message.viewData.setUint64(0, communicatorService.syncPoint.$1, Endian.little);
+        message.viewData.setUint64(8, communicatorService.syncPoint.$2, Endian.little);
+      }
+
+      message.viewData.setUint16(rangeOffset, (1 << DayHandlerID.values.length) - 1, Endian.little); //every handler id
+      message.viewData.setUint16(rangeOffset + 2, date.ordinalDate, Endian.little);
+      message.viewData.setUint16(rangeOffset + 4, dayCount, Endian.little);
+      message.viewData.setUint32(rangeOffset + 8, date.year, Endian.little);
+
+      //the versions already known, in the order the server sends entries in, so only the changed handlers come back
+      for(int index = 0; index < versionCount; ++index) {
+        final int day = date.ordinalDate + (index ~/ DayHandlerID.values.length);
+        final int handlerKey = (index % DayHandlerID.values.length) | (day << 16) | (date.year << 32);
+        message.viewData.setUint32(12 + (index * 4), communicatorService.knownHandlers[handlerKey]?.$1 ?? 0, Endian.little);
+      }
+
+      sendNetworkMessage(message);
+
+      date = date.add(Duration(days: dayCount));
+      remainingDays -= dayCount;
+    }
+  }
+
+  //subscribing first means no change made between the range request and the subscription is missed
+  void requestViewedWeek() {
+    sendViewedWeekRanges(ClientMessageType.subscribeHandlers);
+    sendViewedWeekRanges(ClientMessageType.getHandlerRange);
+  }
+
+  //the day widgets of the new view only start listening once they are built
+  void requestViewedWeekAfterBuild() {
+    WidgetsBinding.instance.addPostFrameCallback((_) {
+      if(mounted) requestViewedWeek();
+    });
+  }
+
+  //a new connection has no subscriptions, and only what changed while the old one was down is fetched again
+  void resyncViewedWeek() {
+    sendViewedWeekRanges(ClientMessageType.subscribeHandlers);
+    sendViewedWeekRanges(ClientMessageType.resyncHandlers);
+  }
+
+  void changeViewingDate(DateTime newViewingDate) {
+    sendViewedWeekRanges(ClientMessageType.unsubscribeHandlers);
+    setState(() {
+      viewingDate = newViewingDate;
+    });
+    requestViewedWeekAfterBuild();
+  }
+
+  @override void initState() {
+    super.initState();
+    communicatorService = ServerCommunicator.of(context).communicatorService;
+    communicatorService.onReconnected = resyncViewedWeek;
+    requestViewedWeekAfterBuild();
+  }
+
+  @override void dispose() {
+    if(communicatorService.onReconnected == resyncViewedWeek) {
+      communicatorService.onReconnected = null;
+    }
+    super.dispose();
+  }
+
   void changeSubScreenSelected(Set<int> newSelection) {
     if(newSelection.first != subScreenSelected){
       setState(() {
         subScreenSelected = newSelection.first;
       });
+      WidgetsBinding.instance.addPostFrameCallback((_) { //still subscribed to the week, only the new widgets need the names
+        if(mounted) sendViewedWeekRanges(ClientMessageType.getHandlerRange);
+      });
     }
   }
 
   void nextWeekNumber() {
-    setState(() {
-      viewingDate = viewingDate.add(const Duration(days: 7));
-    });
+    changeViewingDate(viewingDate.add(const Duration(days: 7)));
   }
 
   void prevWeekNumber() {
-    setState(() {
-      viewingDate = viewingDate.subtract(const Duration(days: 7));
-    });
+    changeViewingDate(viewingDate.subtract(const Duration(days: 7)));
   }
 
   @override
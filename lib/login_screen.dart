@@ -29,6 +29,7 @@ class _LoginHandlerState extends State<LoginHandler> with SendNetworkMessageHelp
       message.viewData.setUint8(index, enteredPassword.codeUnitAt(index));
     }
 
+    ServerCommunicator.of(context).communicatorService.loginMessage = message.messageBuffer;
     sendNetworkMessage(message);
   }
 
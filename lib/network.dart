@@ -1,3 +1,4 @@
+import 'dart:async';
 import 'dart:io';
 import 'dart:typed_data';
 import 'package:flutter/material.dart';
@@ -6,11 +7,25 @@ enum ClientMessageType {
   login,
   getHandler,
   setHandler,
+  getHandlerRange,
+  subscribeHandlers,
+  unsubscribeHandlers,
+  editHandler,
+  resyncHandlers,
+  negotiateProtocol,
 }
 
 enum ServerMessageType {
   loginResponse,
   sentHandlerName,
+  sentHandlerRange,
+  sentHandlerUpdates,
+  editedHandler,
+  editAcknowledged,
+  editRebased,
+  handlersNotModified,
+  sentHandlerChanges,
+  protocolAccepted,
 }
 
 class ClientMessage {
@@ -37,6 +52,278 @@ class ServerMessage {
   int get headerSize => 8;
   ByteData get viewMessage => ByteData.view(holder.buffer);
   ByteData get viewData => ByteData.sublistView(holder, headerSize);
+
+  //(handler key, version, name) of the entry at offset, an entry takes 16 bytes plus the name
+  (int, int, String) handlerEntryAt(int offset) {
+    final data = viewData;
+    final int handlerKey = data.getUint64(offset, Endian.little);
+    final int version = data.getUint32(offset + 8, Endian.little);
+    final int nameSize = data.getUint32(offset + 12, Endian.little);
+
+    var stringBuilder = StringBuffer();
+    for(int index = offset + 16; index < offset + 16 + nameSize; index += 2) {
+      stringBuilder.writeCharCode(data.getUint16(index, Endian.little));
+    }
+
+    return (handlerKey, version, stringBuilder.toString());
+  }
+
+  //(handler key, version, name) for every entry of a sentHandlerRange or sentHandlerUpdates message
+  Iterable<(int, int, String)> get handlerEntries => handlerEntriesAt(0);
+
+  //a sentHandlerChanges message starts with the sync point, the entry count follows it
+  Iterable<(int, int, String)> get changedHandlerEntries => handlerEntriesAt(16);
+
+  Iterable<(int, int, String)> handlerEntriesAt(int countOffset) sync* {
+    final int entryCount = viewData.getUint32(countOffset, Endian.little);
+
+    int offset = countOffset + 4;
+    for(int entry = 0; entry < entryCount; ++entry) {
+      final (int handlerKey, int version, String name) = handlerEntryAt(offset);
+      offset += 16 + (name.length * 2);
+
+      yield (handlerKey, version, name);
+    }
+  }
+}
+
+const int newestProtocolVersion = 2;
+
+//the screens build and read version 1 frames. a connection that negotiated version 2 translates them here, the layout of every
+//frame is described in protocol.h of the server: varint type and size headers, varint fields and utf-8 names
+class WireWriter {
+  final BytesBuilder bytes = BytesBuilder();
+
+  void varint(int value) {
+    while((value & ~0x7F) != 0) {
+      bytes.addByte((value & 0x7F) | 0x80);
+      value = value >>> 7;
+    }
+    bytes.addByte(value);
+  }
+
+  //a version 1 key is the id, day and year little endian in one uint64
+  void key(int handlerKey) => varint(((handlerKey >>> 32) << 11) | (((handlerKey >> 16) & 0xFFFF) << 2) | (handlerKey & 0xFFFF));
+
+  void range(ByteData data, int offset) {
+    varint(data.getUint16(offset, Endian.little));
+    varint(data.getUint16(offset + 2, Endian.little));
+    varint(data.getUint16(offset + 4, Endian.little));
+    varint(data.getUint32(offset + 8, Endian.little));
+  }
+
+  //the utf-16 text between offset and end as utf-8, lone surrogates are encoded like any other character so they survive
+  void utf8(ByteData data, int offset, int end) {
+    for(int index = offset; index + 1 < end; index += 2) {
+      int codePoint = data.getUint16(index, Endian.little);
+      if(codePoint >= 0xD800 && codePoint < 0xDC00 && index + 3 < end) {
+        final int low = data.getUint16(index + 2, Endian.little);
+        if(low >= 0xDC00 && low < 0xE000) {
+          codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+          index += 2;
+        }
+      }
+
+      if(codePoint < 0x80) {
+        bytes.addByte(codePoint);
+      }
+      else if(codePoint < 0x800) {
+        bytes.add([0xC0 | (codePoint >> 6), 0x80 | (codePoint & 0x3F)]);
+      }
+      else if(codePoint < 0x10000) {
+        bytes.add([0xE0 | (codePoint >> 12), 0x80 | ((codePoint >> 6) & 0x3F), 0x80 | (codePoint & 0x3F)]);
+      }
+      else {
+        bytes.add([0xF0 | (codePoint >> 18), 0x80 | ((codePoint >> 12) & 0x3F), 0x80 | ((codePoint >> 6) & 0x3F), 0x80 | (codePoint & 0x3F)]);
+      }
+    }
+  }
+
+  //little endian fields of a version 1 frame
+  void uint(int value, int size) {
+    for(int index = 0; index < size; ++index) {
+      bytes.addByte((value >>> (index * 8)) & 0xFF);
+    }
+  }
+
+  void codeUnits(List<int> text) {
+    for(final int codeUnit in text) {
+      uint(codeUnit, 2);
+    }
+  }
+}
+
+//throws a RangeError when the payload ends early or a FormatException when it is malformed, both drop the connection
+class WireReader {
+  final Uint8List bytes;
+  int offset;
+
+  WireReader(this.bytes, [this.offset = 0]);
+
+  bool get atEnd => offset >= bytes.length;
+
+  int varint() {
+    int value = 0;
+    for(int shift = 0; shift < 70; shift += 7) {
+      final int byte = bytes[offset++];
+      value |= (byte & 0x7F) << shift;
+      if((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+
+    throw const FormatException('varint too long');
+  }
+
+  int key() {
+    final int packed = varint();
+    return ((packed >>> 11) << 32) | (((packed >> 2) & 0x1FF) << 16) | (packed & 0x3);
+  }
+
+  //the utf-8 text up to end as utf-16 code units
+  List<int> codeUnits(int end) {
+    final List<int> text = [];
+    while(offset < end) {
+      final int lead = bytes[offset++];
+      final int size = lead < 0x80 ? 1 : (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 0;
+      if(size == 0 || offset + size - 1 > end) {
+        throw const FormatException('invalid utf-8');
+      }
+
+      int codePoint = size == 1 ? lead : lead & (0x7F >> size);
+      for(int continuation = 1; continuation < size; ++continuation) {
+        codePoint = (codePoint << 6) | (bytes[offset++] & 0x3F);
+      }
+
+      if(codePoint >= 0x10000) {
+        text.add(0xD800 + ((codePoint - 0x10000) >> 10));
+        text.add(0xDC00 + ((codePoint - 0x10000) & 0x3FF));
+      }
+      else {
+        text.add(codePoint);
+      }
+    }
+
+    return text;
+  }
+}
+
+//a version 1 client frame as the version 2 frame the server expects
+Uint8List encodeVersion2Frame(Uint8List frame) {
+  final int type = ByteData.sublistView(frame).getUint32(0, Endian.little);
+  final data = ByteData.sublistView(frame, 8);
+  final payload = WireWriter();
+
+  switch(type < ClientMessageType.values.length ? ClientMessageType.values[type] : null) {
+    case ClientMessageType.login:
+      final int terminator = frame.indexOf(0, 8);
+      payload.bytes.add(frame.sublist(8, terminator == -1 ? frame.length : terminator));
+    case ClientMessageType.getHandler:
+      payload.key(data.getUint64(0, Endian.little));
+      if(data.lengthInBytes > 8) {
+        payload.varint(data.getUint32(8, Endian.little));
+      }
+    case ClientMessageType.setHandler:
+      payload.key(data.getUint64(0, Endian.little));
+      payload.utf8(data, 8, data.lengthInBytes - 2); //without the null terminator
+    case ClientMessageType.getHandlerRange:
+      payload.range(data, 0);
+      for(int offset = 12; offset < data.lengthInBytes; offset += 4) {
+        payload.varint(data.getUint32(offset, Endian.little));
+      }
+    case ClientMessageType.subscribeHandlers:
+    case ClientMessageType.unsubscribeHandlers:
+      payload.range(data, 0);
+    case ClientMessageType.editHandler:
+      payload.key(data.getUint64(0, Endian.little));
+      payload.varint(data.getUint32(8, Endian.little));
+      payload.varint(data.getUint16(12, Endian.little));
+      payload.varint(data.getUint16(14, Endian.little));
+      payload.utf8(data, 16, data.lengthInBytes);
+    case ClientMessageType.resyncHandlers:
+      payload.varint(data.getUint64(0, Endian.little));
+      payload.varint(data.getUint64(8, Endian.little));
+      payload.range(data, 16);
+    default:
+      payload.bytes.add(frame.sublist(8));
+  }
+
+  final payloadBytes = payload.bytes.takeBytes();
+  final encoded = WireWriter();
+  encoded.varint(type);
+  encoded.varint(payloadBytes.length);
+  encoded.bytes.add(payloadBytes);
+  return encoded.bytes.takeBytes();
+}
+
+//the payload of a version 2 server frame as the version 1 frame the screens read
+ServerMessage decodeVersion2Frame(int type, Uint8List payload) {
+  final reader = WireReader(payload);
+  final data = WireWriter();
+
+  void entries(int entryCount) {
+    for(int entry = 0; entry < entryCount; ++entry) {
+      data.uint(reader.key(), 8);
+      data.uint(reader.varint(), 4);
+      final int nameSize = reader.varint();
+      final List<int> name = reader.codeUnits(reader.offset + nameSize);
+      data.uint(name.length * 2, 4);
+      data.codeUnits(name);
+    }
+  }
+
+  void range() {
+    data.uint(reader.varint(), 2);
+    data.uint(reader.varint(), 2);
+    data.uint(reader.varint(), 2);
+    data.uint(0, 2);
+    data.uint(reader.varint(), 4);
+  }
+
+  switch(type < ServerMessageType.values.length ? ServerMessageType.values[type] : null) {
+    case ServerMessageType.loginResponse:
+      data.uint(payload[0], 1);
+      reader.offset = 1;
+      data.uint(reader.varint(), 8);
+      data.uint(reader.varint(), 8);
+    case ServerMessageType.sentHandlerName:
+      data.uint(reader.key(), 8);
+      data.codeUnits(reader.codeUnits(payload.length));
+      data.uint(0, 2);
+    case ServerMessageType.sentHandlerRange:
+    case ServerMessageType.sentHandlerUpdates:
+      final int entryCount = reader.varint();
+      data.uint(entryCount, 4);
+      entries(entryCount);
+    case ServerMessageType.sentHandlerChanges:
+      data.uint(reader.varint(), 8);
+      data.uint(reader.varint(), 8);
+      final int changeCount = reader.varint();
+      data.uint(changeCount, 4);
+      entries(changeCount);
+    case ServerMessageType.editedHandler:
+      data.uint(reader.key(), 8);
+      data.uint(reader.varint(), 4);
+      data.uint(reader.varint(), 2);
+      data.uint(reader.varint(), 2);
+      data.codeUnits(reader.codeUnits(payload.length));
+    case ServerMessageType.editAcknowledged:
+      data.uint(reader.key(), 8);
+      data.uint(reader.varint(), 4);
+    case ServerMessageType.editRebased:
+      entries(1);
+    case ServerMessageType.handlersNotModified:
+      range();
+    default:
+      data.bytes.add(payload);
+  }
+
+  final dataBytes = data.bytes.takeBytes();
+  final frame = WireWriter();
+  frame.uint(type, 4);
+  frame.uint(dataBytes.length, 4);
+  frame.bytes.add(dataBytes);
+  return ServerMessage(frame.bytes.takeBytes());
 }
 
 class ServerCommunicator extends InheritedWidget {
@@ -52,31 +339,132 @@ class ServerCommunicator extends InheritedWidget {
 }
 
 class PersistentServerCommunicator {
-  late Future<Socket> server;
+  final String host;
+  late Future<Socket> connection; //only read by the stream
+  late Future<(Socket, int)> server; //the socket and the protocol version agreed on, everything is sent through it
   late Stream<ServerMessage> stream;
+  Completer<int> negotiation = Completer();
+  Map<int, (int, String)> knownHandlers = {}; //(version, name) of every handler seen, by handler key
+  Uint8List? loginMessage; //sent again after reconnecting
+  (int, int) syncPoint = (0, 0); //(epoch, sequence) of the server change log the known handlers are consistent with
+  void Function()? onReconnected; //called once logged in again, to resubscribe and resync what is viewed
+
+  static const reconnectDelay = Duration(seconds: 2);
+  static const negotiationTimeout = Duration(seconds: 2); //servers from before version 2 never answer, the connection stays on version 1
 
-  PersistentServerCommunicator(String host) {
-    server = Socket.connect(host, 4040);
+  PersistentServerCommunicator(this.host) {
+    connect();
     stream = startStream().asBroadcastStream();
+    stream.listen((_) {}); //keeps reading, so the negotiation finishes before any screen listens
+  }
+
+  //asks for the newest version before anything else is sent, both sides switch after the answer
+  void connect() {
+    final accepted = negotiation = Completer<int>();
+
+    connection = Socket.connect(host, 4040);
+    server = connection.then((socket) async {
+      final request = ClientMessage(ClientMessageType.negotiateProtocol, 4);
+      request.viewData.setUint32(0, newestProtocolVersion, Endian.little);
+      socket.add(request.messageBuffer);
+
+      final int version = await accepted.future.timeout(negotiationTimeout, onTimeout: () {
+        accepted.complete(1);
+        return 1;
+      });
+      return (socket, version);
+    });
+    server.ignore(); //a failed connection is reported to whoever sends next, the stream retries it
+  }
+
+  //frames are built in version 1 and encoded again if the connection speaks version 2
+  Future<void> send(Uint8List frame) async {
+    final (Socket socket, int version) = await server;
+    socket.add(version == 1 ? frame : encodeVersion2Frame(frame));
+  }
+
+  //the sync point of the first login, later ones come from resync answers so nothing missed while disconnected is skipped
+  void updateSyncPoint(ServerMessage message) {
+    if(message.type == ServerMessageType.loginResponse.index && message.dataSize >= 17 && syncPoint == (0, 0)) {
+      syncPoint = (message.viewData.getUint64(1, Endian.little), message.viewData.getUint64(9, Endian.little));
+    }
+    else if(message.type == ServerMessageType.sentHandlerChanges.index) {
+      syncPoint = (message.viewData.getUint64(0, Endian.little), message.viewData.getUint64(8, Endian.little));
+    }
+  }
+
+  //the frame at the start of received in the version read so far, null if it has not arrived whole yet
+  (ServerMessage, int)? takeMessage(Uint8List received, int readVersion) {
+    if(readVersion == 1) {
+      if(received.length < 8) {
+        return null;
+      }
+
+      final int frameSize = 8 + ByteData.sublistView(received).getUint32(4, Endian.little);
+      return received.length < frameSize ? null : (ServerMessage(received.sublist(0, frameSize)), frameSize);
+    }
+
+    final reader = WireReader(received);
+    final int type;
+    final int payloadSize;
+    try {
+      type = reader.varint();
+      payloadSize = reader.varint();
+    }
+    on RangeError {
+      return null; //the header itself is not complete
+    }
+
+    if(received.length < reader.offset + payloadSize) {
+      return null;
+    }
+
+    return (decodeVersion2Frame(type, received.sublist(reader.offset, reader.offset + payloadSize)), reader.offset + payloadSize);
   }
 
   Stream<ServerMessage> startStream() async* {
-    final socket = await server;
-    var messageBuffer = BytesBuilder();
+    while(true) {
+      try {
+        final socket = await connection;
+        final accepted = negotiation;
+        int readVersion = 1; //switches right after the answer, which is the last version 1 frame
+        var received = Uint8List(0);
+
+        await for(final Uint8List event in socket) {
+          received = Uint8List.fromList(received + event);
 
-    await for(final Uint8List event in socket) {
-      for(final int byte in event) {
-        messageBuffer.addByte(byte);
+          for(var taken = takeMessage(received, readVersion); taken != null; taken = takeMessage(received, readVersion)) {
+            final (ServerMessage message, int frameSize) = taken;
+            received = received.sublist(frameSize);
 
-        if(messageBuffer.length >= 8) {
-          final messageView = ByteData.view(messageBuffer.toBytes().buffer);
-          int messageDataSize = messageView.getUint32(4, Endian.little);
+            if(message.type == ServerMessageType.protocolAccepted.index && readVersion == 1) {
+              readVersion = message.viewData.getUint32(0, Endian.little);
+              if(!accepted.isCompleted) {
+                accepted.complete(readVersion);
+              }
+              else if(readVersion != 1) {
+                socket.destroy(); //answered after the client gave up and went on in version 1, so both sides disagree
+                break;
+              }
+              continue;
+            }
 
-          if(messageDataSize == messageBuffer.length - 8) {
-            yield ServerMessage(messageBuffer.takeBytes());
+            updateSyncPoint(message);
+            yield message;
           }
         }
       }
+      catch(_) {} //connecting failed or the connection broke, both are retried
+
+      await Future.delayed(reconnectDelay);
+
+      connect();
+      server.then((_) {
+        if(loginMessage != null) {
+          send(loginMessage!);
+          onReconnected?.call();
+        }
+      }, onError: (_) {});
     }
   }
 }
@@ -84,8 +472,7 @@ class PersistentServerCommunicator {
 mixin SendNetworkMessageHelper<T extends StatefulWidget> on State<T> {
   void sendNetworkMessage(ClientMessage message) async {
     try {
-      final socket = await ServerCommunicator.of(context).communicatorService.server;
-      socket.add(message.messageBuffer);
+      await ServerCommunicator.of(context).communicatorService.send(message.messageBuffer);
     }
     catch(err) {
       if(mounted) {
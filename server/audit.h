@@ -0,0 +1,508 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <fmt/format.h>
+
+#include "background.h"
+#include "wal.h"
+
+//who changed which handler and when. changes are appended to the log file of the open segment, and once a segment is full an index
+//file is written next to it that lists its records once in time order and once in key order, so a lookup binary searches every
+//segment instead of reading the records. a segment whose index is missing, because the server crashed, is indexed again on startup
+
+//one record per applied change, followed by the previous and the new name. the checksum covers everything after itself
+struct __attribute__((packed)) audit_record_header_t
+{
+    uint32_t checksum;
+    uint32_t previous_name_size; //in char16_t
+    uint32_t name_size; //in char16_t
+    uint32_t version; //of the handler after the change
+    int64_t time; //nanoseconds since the epoch
+    uint64_t key;
+    uint32_t address; //ipv4 address of the client, network byte order
+    uint16_t port; //network byte order
+    uint16_t reserved;
+};
+
+struct audit_index_entry_t
+{
+    uint64_t key;
+    int64_t time;
+    uint64_t offset; //of the record in the log file
+};
+
+//the index file is the header, the entries in time order, then the same entries in key order with the time order kept within a key
+struct audit_index_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entry_count;
+    int64_t first_time;
+    int64_t last_time;
+    uint64_t log_size; //bytes of the log file the index covers
+};
+
+constexpr char audit_index_magic[8] = {'S', 'T', 'A', 'L', 'L', 'A', 'U', 'D'};
+constexpr uint32_t audit_index_version = 1;
+constexpr uint64_t audit_segment_records = 64 << 10;
+
+inline std::string audit_log_path(const char* directory, uint64_t segment)
+{
+    return fmt::format("{}/audit.{}.log", directory, segment);
+}
+
+inline std::string audit_index_path(const char* directory, uint64_t segment)
+{
+    return fmt::format("{}/audit.{}.idx", directory, segment);
+}
+
+inline bool list_audit_segments(const char* directory_path, std::vector<uint64_t>* segments)
+{
+    DIR* directory = opendir(directory_path);
+    if(directory == nullptr)
+    {
+        perror("opendir");
+        return false;
+    }
+
+    while(dirent* entry = readdir(directory))
+    {
+        uint64_t segment;
+        int name_length = 0;
+        if(std::sscanf(entry->d_name, "audit.%lu.log%n", &segment, &name_length) == 1 && entry->d_name[name_length] == '\0')
+        {
+            segments->push_back(segment);
+        }
+    }
+
+    closedir(directory);
+
+    std::sort(segments->begin(), segments->end());
+    return true;
+}
+
+//read only mapping of a file, empty files map to nothing
+struct audit_file_view_t
+{
+    const uint8_t* contents = nullptr;
+    uint64_t size = 0;
+
+    bool map(const char* path)
+    {
+        int file = ::open(path, O_RDONLY | O_CLOEXEC);
+        if(file == -1)
+        {
+            return false;
+        }
+
+        struct stat file_stat{};
+        if(fstat(file, &file_stat) == -1)
+        {
+            ::close(file);
+            return false;
+        }
+
+        size = file_stat.st_size;
+        if(size != 0)
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if(mapping == MAP_FAILED)
+            {
+                ::close(file);
+                return false;
+            }
+            contents = static_cast<const uint8_t*>(mapping);
+        }
+
+        ::close(file);
+        return true;
+    }
+
+    void unmap()
+    {
+        if(contents != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(contents), size);
+        }
+
+        *this = audit_file_view_t{};
+    }
+};
+
+struct audit_record_t
+{
+    audit_record_header_t header;
+    std::u16string_view previous_name;
+    std::u16string_view name;
+};
+
+//reads the record at offset of a mapped log file, false if it is torn or corrupt
+inline bool read_audit_record(const audit_file_view_t& log, uint64_t offset, audit_record_t* record)
+{
+    if(offset > log.size || log.size - offset < sizeof(audit_record_header_t))
+    {
+        return false;
+    }
+
+    std::memcpy(&record->header, log.contents + offset, sizeof(audit_record_header_t));
+
+    const uint64_t names_size = (uint64_t{record->header.previous_name_size} + record->header.name_size) * 2;
+    if(log.size - offset - sizeof(audit_record_header_t) < names_size)
+    {
+        return false;
+    }
+
+    const uint8_t* checked = log.contents + offset + sizeof(record->header.checksum);
+    if(crc32c(0, checked, sizeof(audit_record_header_t) - sizeof(record->header.checksum) + names_size) != record->header.checksum)
+    {
+        return false;
+    }
+
+    auto names = reinterpret_cast<const char16_t*>(log.contents + offset + sizeof(audit_record_header_t));
+    record->previous_name = std::u16string_view{names, record->header.previous_name_size};
+    record->name = std::u16string_view{names + record->header.previous_name_size, record->header.name_size};
+    return true;
+}
+
+inline uint64_t audit_record_size(const audit_record_header_t& header)
+{
+    return sizeof(audit_record_header_t) + (uint64_t{header.previous_name_size} + header.name_size) * 2;
+}
+
+//calls on_record(offset, record) for every intact record up to the first torn or corrupt one and returns where that one starts
+template<typename F>
+uint64_t for_each_audit_record(const audit_file_view_t& log, F on_record)
+{
+    uint64_t offset = 0;
+
+    audit_record_t record;
+    while(read_audit_record(log, offset, &record))
+    {
+        on_record(offset, record);
+        offset += audit_record_size(record.header);
+    }
+
+    return offset;
+}
+
+//read only mapping of an index file
+struct audit_index_view_t
+{
+    audit_file_view_t file{};
+    const audit_index_header_t* header = nullptr;
+    const audit_index_entry_t* by_time = nullptr;
+    const audit_index_entry_t* by_key = nullptr;
+
+    //returns false with errno set to EBADMSG if the file is not a valid index
+    bool map(const char* path)
+    {
+        if(!file.map(path))
+        {
+            return false;
+        }
+
+        header = reinterpret_cast<const audit_index_header_t*>(file.contents);
+        if(file.size < sizeof(audit_index_header_t) || std::memcmp(header->magic, audit_index_magic, sizeof(audit_index_magic)) != 0
+            || header->version != audit_index_version || file.size != sizeof(audit_index_header_t) + (header->entry_count * 2 * sizeof(audit_index_entry_t)))
+        {
+            unmap();
+            errno = EBADMSG;
+            return false;
+        }
+
+        by_time = reinterpret_cast<const audit_index_entry_t*>(file.contents + sizeof(audit_index_header_t));
+        by_key = by_time + header->entry_count;
+        return true;
+    }
+
+    void unmap()
+    {
+        file.unmap();
+        *this = audit_index_view_t{};
+    }
+};
+
+//writes the index of a segment whose entries are in append order to a temporary file and renames it into place. the wall clock can be
+//set back while a segment is written, so the time order is sorted as well. both sorts are stable and keep records in append order
+inline bool write_audit_index(const char* path, const std::vector<audit_index_entry_t>& entries, uint64_t log_size)
+{
+    std::vector<audit_index_entry_t> by_time = entries;
+    std::stable_sort(by_time.begin(), by_time.end(), [](const audit_index_entry_t& lhs, const audit_index_entry_t& rhs){ return lhs.time < rhs.time; });
+
+    std::vector<audit_index_entry_t> by_key = entries;
+    std::stable_sort(by_key.begin(), by_key.end(), [](const audit_index_entry_t& lhs, const audit_index_entry_t& rhs){ return lhs.key < rhs.key; });
+
+    audit_index_header_t header{};
+    std::memcpy(header.magic, audit_index_magic, sizeof(header.magic));
+    header.version = audit_index_version;
+    header.entry_count = entries.size();
+    header.first_time = by_time.empty() ? 0 : by_time.front().time;
+    header.last_time = by_time.empty() ? 0 : by_time.back().time;
+    header.log_size = log_size;
+
+    const std::string temporary_path = std::string{path} + ".tmp";
+
+    int file = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(file == -1)
+    {
+        perror("open");
+        return false;
+    }
+
+    const iovec parts[] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = by_time.data(), .iov_len = by_time.size() * sizeof(audit_index_entry_t)},
+        {.iov_base = by_key.data(), .iov_len = by_key.size() * sizeof(audit_index_entry_t)}
+    };
+
+    const ssize_t expected_size = sizeof(header) + (entries.size() * 2 * sizeof(audit_index_entry_t));
+    if(writev(file, parts, std::size(parts)) != expected_size || fdatasync(file) == -1)
+    {
+        perror("write audit index");
+        ::close(file);
+        unlink(temporary_path.c_str());
+        return false;
+    }
+
+    ::close(file);
+
+    if(rename(temporary_path.c_str(), path) == -1)
+    {
+        perror("rename");
+        return false;
+    }
+
+    return true;
+}
+
+//indexes a segment left without one, cutting off a torn tail
+inline bool index_audit_segment(const char* directory, uint64_t segment)
+{
+    const std::string log_path = audit_log_path(directory, segment);
+
+    audit_file_view_t log{};
+    if(!log.map(log_path.c_str()))
+    {
+        perror("open");
+        return false;
+    }
+
+    std::vector<audit_index_entry_t> entries{};
+    const uint64_t valid_size = for_each_audit_record(log, [&entries](uint64_t offset, const audit_record_t& record)
+    {
+        entries.push_back(audit_index_entry_t{.key = record.header.key, .time = record.header.time, .offset = offset});
+    });
+
+    const uint64_t log_size = log.size;
+    log.unmap();
+
+    if(valid_size != log_size && truncate(log_path.c_str(), valid_size) == -1)
+    {
+        perror("truncate");
+        return false;
+    }
+
+    return write_audit_index(audit_index_path(directory, segment).c_str(), entries, valid_size);
+}
+
+//appends are buffered and written by a background thread, which also seals full segments. the log is not synced,
+//the handlers themselves are durable through the write ahead log and a crash can at most lose the newest audit records
+//the records appended since the writer last ran
+struct audit_batch_t
+{
+    std::vector<uint8_t> records{};
+    std::vector<audit_index_entry_t> entries{}; //offsets are in records
+
+    bool empty() const
+    {
+        return records.empty();
+    }
+
+    void clear()
+    {
+        records.clear();
+        entries.clear();
+    }
+};
+
+struct audit_log_t
+{
+    std::string directory{};
+    uint64_t segment = 0; //only touched by the writer once it runs
+    int file = -1;
+    uint64_t file_size = 0;
+    std::vector<audit_index_entry_t> entries{}; //of the open segment, offsets are in the file
+    background_writer_t<audit_log_t, audit_batch_t> writer{};
+
+    //indexes segments a crash left unsealed and starts a new segment after the newest one
+    bool open(const char* directory_path)
+    {
+        directory = directory_path;
+
+        std::vector<uint64_t> segments{};
+        if(!list_audit_segments(directory_path, &segments))
+        {
+            return false;
+        }
+
+        for(uint64_t existing_segment : segments)
+        {
+            if(access(audit_index_path(directory_path, existing_segment).c_str(), F_OK) == -1 && !index_audit_segment(directory_path, existing_segment))
+            {
+                return false;
+            }
+        }
+
+        segment = segments.empty() ? 0 : segments.back() + 1;
+        if(!open_segment())
+        {
+            return false;
+        }
+
+        return writer.start(this);
+    }
+
+    bool open_segment()
+    {
+        file = ::open(audit_log_path(directory.c_str(), segment).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if(file == -1)
+        {
+            perror("open");
+            return false;
+        }
+
+        file_size = 0;
+        entries.clear();
+        return true;
+    }
+
+    void append(int64_t time, const sockaddr_in& address, uint64_t key, uint32_t version, std::u16string_view previous_name, std::u16string_view name)
+    {
+        audit_record_header_t header{
+            .checksum = 0,
+            .previous_name_size = static_cast<uint32_t>(previous_name.size()),
+            .name_size = static_cast<uint32_t>(name.size()),
+            .version = version,
+            .time = time,
+            .key = key,
+            .address = address.sin_addr.s_addr,
+            .port = address.sin_port,
+            .reserved = 0
+        };
+
+        writer.append([&](audit_batch_t& pending)
+        {
+            const uint64_t record_offset = pending.records.size();
+            pending.records.resize(record_offset + audit_record_size(header));
+
+            uint8_t* record = &pending.records[record_offset];
+            std::memcpy(record, &header, sizeof(header));
+            //a first set has no previous name, and memcpy must not be handed its null data()
+            if(!previous_name.empty())
+            {
+                std::memcpy(record + sizeof(header), previous_name.data(), previous_name.size() * 2);
+            }
+            if(!name.empty())
+            {
+                std::memcpy(record + sizeof(header) + (previous_name.size() * 2), name.data(), name.size() * 2);
+            }
+
+            header.checksum = crc32c(0, record + sizeof(header.checksum), audit_record_size(header) - sizeof(header.checksum));
+            std::memcpy(record, &header.checksum, sizeof(header.checksum));
+
+            pending.entries.push_back(audit_index_entry_t{.key = key, .time = time, .offset = record_offset});
+        });
+    }
+
+    //writes out whatever is still pending, seals the open segment and stops the writer
+    void close()
+    {
+        if(!writer.running())
+        {
+            return;
+        }
+
+        writer.stop();
+
+        if(file != -1 && entries.empty()) //nothing changed since the segment was opened
+        {
+            ::close(file);
+            file = -1;
+            unlink(audit_log_path(directory.c_str(), segment).c_str());
+        }
+        else if(file != -1)
+        {
+            seal_segment();
+        }
+    }
+
+    void seal_segment()
+    {
+        ::close(file);
+        file = -1;
+
+        if(!write_audit_index(audit_index_path(directory.c_str(), segment).c_str(), entries, file_size))
+        {
+            fmt::print(stderr, "could not index audit segment {}, it is indexed again on the next start\n", segment);
+        }
+
+        entries.clear();
+    }
+
+    //runs on the writer
+    void write_batch(audit_batch_t& batch)
+    {
+        if(file == -1) //a new segment could not be opened, the changes are only lost from the audit
+        {
+            return;
+        }
+
+        for(uint64_t offset = 0; offset < batch.records.size();)
+        {
+            ssize_t nwritten = write(file, batch.records.data() + offset, batch.records.size() - offset);
+            if(nwritten == -1)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                perror("write");
+                (void)ftruncate(file, file_size); //the records of the batch are dropped whole
+                return;
+            }
+            offset += nwritten;
+        }
+
+        for(audit_index_entry_t& entry : batch.entries)
+        {
+            entry.offset += file_size;
+        }
+
+        entries.insert(entries.end(), batch.entries.begin(), batch.entries.end());
+        file_size += batch.records.size();
+
+        if(entries.size() >= audit_segment_records)
+        {
+            seal_segment();
+            ++segment;
+            (void)open_segment();
+        }
+    }
+};
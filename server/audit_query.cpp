@@ -0,0 +1,246 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "audit.h"
+#include "protocol.h"
+
+//prints the audited changes of a data directory, optionally only those of one handler or of a time span:
+//stall_audit [--data-dir path] [--year year] [--day day_of_year] [--id pasture|stable_in|stable_out] [--since time] [--until time]
+//times are seconds since the epoch or local dates like "2024-01-09" or "2024-01-09 08:00"
+
+constexpr std::string_view handler_id_names[] = {"pasture", "stable_in", "stable_out"};
+
+struct query_t
+{
+    const char* data_directory = ".";
+    int64_t year = -1; //-1 matches every value
+    int64_t day_of_year = -1;
+    int64_t id = -1;
+    int64_t since = INT64_MIN; //nanoseconds since the epoch
+    int64_t until = INT64_MAX;
+
+    bool whole_key() const
+    {
+        return year != -1 && day_of_year != -1 && id != -1;
+    }
+
+    uint64_t key() const
+    {
+        return uint64_t(id) | (uint64_t(day_of_year) << 16) | (uint64_t(year) << 32);
+    }
+
+    bool matches(uint64_t key, int64_t time) const
+    {
+        return (id == -1 || int64_t(key & 0xFFFF) == id) && (day_of_year == -1 || int64_t((key >> 16) & 0xFFFF) == day_of_year)
+            && (year == -1 || int64_t(key >> 32) == year) && time >= since && time <= until;
+    }
+};
+
+//returns false if text is neither a number of seconds nor a date
+bool parse_time(const char* text, int64_t* nanoseconds)
+{
+    char* end = nullptr;
+    errno = 0;
+    const long long seconds = std::strtoll(text, &end, 10);
+    if(errno == 0 && end != text && *end == '\0')
+    {
+        *nanoseconds = seconds * 1'000'000'000ll;
+        return true;
+    }
+
+    for(const char* format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"})
+    {
+        tm local_time{};
+        const char* parsed_end = strptime(text, format, &local_time);
+        if(parsed_end != nullptr && *parsed_end == '\0')
+        {
+            local_time.tm_isdst = -1;
+            *nanoseconds = mktime(&local_time) * 1'000'000'000ll;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void print_record(const audit_record_t& record)
+{
+    const time_t seconds = record.header.time / 1'000'000'000;
+    tm local_time{};
+    char timestamp[100];
+    strftime(timestamp, sizeof(timestamp), "%a %Y-%m-%d %H:%M:%S", localtime_r(&seconds, &local_time));
+
+    in_addr address{.s_addr = record.header.address};
+    const uint16_t id = record.header.key & 0xFFFF;
+
+    //the port is printed the way the server logs print it, so a change can be matched with the connection that made it
+    fmt::print("{}.{:03} {}:{} {} day {} of {}, version {}: \"{}\" -> \"{}\"\n", timestamp, (record.header.time / 1'000'000) % 1000,
+        inet_ntoa(address), record.header.port, id < std::size(handler_id_names) ? handler_id_names[id] : "unknown",
+        (record.header.key >> 16) & 0xFFFF, record.header.key >> 32, record.header.version,
+        utf16_to_utf8(record.previous_name), utf16_to_utf8(record.name));
+}
+
+//prints the records of one entry range of an index, they are already in time order
+uint64_t print_entries(const audit_file_view_t& log, const audit_index_entry_t* first, const audit_index_entry_t* last, const query_t& query)
+{
+    uint64_t printed = 0;
+    for(const audit_index_entry_t* entry = first; entry != last; ++entry)
+    {
+        audit_record_t record;
+        if(query.matches(entry->key, entry->time) && read_audit_record(log, entry->offset, &record))
+        {
+            print_record(record);
+            ++printed;
+        }
+    }
+
+    return printed;
+}
+
+uint64_t query_indexed_segment(const audit_file_view_t& log, const audit_index_view_t& index, const query_t& query)
+{
+    const audit_index_header_t& header = *index.header;
+    if(header.entry_count == 0 || header.last_time < query.since || header.first_time > query.until)
+    {
+        return 0;
+    }
+
+    if(query.whole_key())
+    {
+        auto [first, last] = std::equal_range(index.by_key, index.by_key + header.entry_count, audit_index_entry_t{.key = query.key(), .time = 0, .offset = 0},
+            [](const audit_index_entry_t& lhs, const audit_index_entry_t& rhs){ return lhs.key < rhs.key; });
+
+        return print_entries(log, first, last, query);
+    }
+
+    auto first = std::lower_bound(index.by_time, index.by_time + header.entry_count, query.since, [](const audit_index_entry_t& entry, int64_t time){ return entry.time < time; });
+    auto last = std::upper_bound(first, index.by_time + header.entry_count, query.until, [](int64_t time, const audit_index_entry_t& entry){ return time < entry.time; });
+
+    return print_entries(log, first, last, query);
+}
+
+bool parse_query(int argc, char** argv, query_t* query)
+{
+    constexpr option long_options[] = {
+        {"data-dir", required_argument, nullptr, 'd'},
+        {"year", required_argument, nullptr, 'y'},
+        {"day", required_argument, nullptr, 'a'},
+        {"id", required_argument, nullptr, 'i'},
+        {"since", required_argument, nullptr, 's'},
+        {"until", required_argument, nullptr, 'u'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int option_char;
+    while((option_char = getopt_long(argc, argv, "d:y:a:i:s:u:", long_options, nullptr)) != -1)
+    {
+        switch(option_char)
+        {
+            case 'd':
+                query->data_directory = optarg;
+                break;
+            case 'y':
+                query->year = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'a':
+                query->day_of_year = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'i':
+            {
+                auto id = std::find(std::begin(handler_id_names), std::end(handler_id_names), optarg);
+                if(id == std::end(handler_id_names))
+                {
+                    fmt::print(stderr, "unknown handler id {}\n", optarg);
+                    return false;
+                }
+
+                query->id = std::distance(std::begin(handler_id_names), id);
+                break;
+            }
+            case 's':
+                if(!parse_time(optarg, &query->since))
+                {
+                    fmt::print(stderr, "could not parse time {}\n", optarg);
+                    return false;
+                }
+                break;
+            case 'u':
+                if(!parse_time(optarg, &query->until))
+                {
+                    fmt::print(stderr, "could not parse time {}\n", optarg);
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return optind == argc;
+}
+
+int main(int argc, char** argv)
+{
+    query_t query{};
+    if(!parse_query(argc, argv, &query))
+    {
+        fmt::print(stderr, "usage: {} [--data-dir path] [--year year] [--day day_of_year] [--id pasture|stable_in|stable_out] [--since time] [--until time]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint64_t> segments{};
+    if(!list_audit_segments(query.data_directory, &segments))
+    {
+        return EXIT_FAILURE;
+    }
+
+    timespec start_time{};
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    uint64_t printed = 0;
+    for(uint64_t segment : segments)
+    {
+        audit_file_view_t log{};
+        if(!log.map(audit_log_path(query.data_directory, segment).c_str()))
+        {
+            perror("open");
+            continue;
+        }
+
+        audit_index_view_t index{};
+        if(index.map(audit_index_path(query.data_directory, segment).c_str()) && index.header->log_size <= log.size)
+        {
+            printed += query_indexed_segment(log, index, query);
+            index.unmap();
+        }
+        else //the segment the server is appending to
+        {
+            for_each_audit_record(log, [&query, &printed](uint64_t, const audit_record_t& record)
+            {
+                if(query.matches(record.header.key, record.header.time))
+                {
+                    print_record(record);
+                    ++printed;
+                }
+            });
+        }
+
+        log.unmap();
+    }
+
+    timespec end_time{};
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    const double milliseconds = (end_time.tv_sec - start_time.tv_sec) * 1e3 + (end_time.tv_nsec - start_time.tv_nsec) / 1e6;
+
+    fmt::print(stderr, "{} changes in {} segments, {:.2f} ms\n", printed, segments.size(), milliseconds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <csignal>
+#include <utility>
+#include <pthread.h>
+
+//the thread blocks every signal, so they keep going to the threads that wait for them. prints why and leaves thread 0 if it could not
+//be created
+inline bool spawn_signal_blocked_thread(pthread_t* thread, void* (*start)(void*), void* argument)
+{
+    sigset_t all_signals{};
+    sigset_t previous_signals{};
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signals);
+
+    const int error = pthread_create(thread, nullptr, start, argument);
+    pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+
+    if(error != 0)
+    {
+        errno = error;
+        perror("pthread_create");
+        *thread = 0;
+        return false;
+    }
+
+    return true;
+}
+
+//batches are filled by any thread under a short lock and handed to owner->write_batch on a background thread, with the lock released so
+//the next batch fills meanwhile. batch_t needs empty() and clear(), the writer clears a batch once it was written
+template<typename owner_t, typename batch_t>
+struct background_writer_t
+{
+    owner_t* owner = nullptr;
+    pthread_t thread = 0;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+    batch_t pending{}; //before start only touched by the thread that starts the writer
+    batch_t writing{}; //only touched by the writer
+    bool stopping = false;
+
+    bool running() const
+    {
+        return thread != 0;
+    }
+
+    bool start(owner_t* batch_owner)
+    {
+        owner = batch_owner;
+        return spawn_signal_blocked_thread(&thread, &writer_loop, this);
+    }
+
+    //fill is called with the pending batch under the lock and may leave it unchanged
+    template<typename F>
+    void append(F&& fill)
+    {
+        pthread_mutex_lock(&lock);
+
+        const bool was_idle = pending.empty();
+        fill(pending);
+        const bool wake = was_idle && !pending.empty();
+
+        pthread_mutex_unlock(&lock);
+
+        if(wake)
+        {
+            pthread_cond_signal(&pending_cond);
+        }
+    }
+
+    //writes out whatever is still pending and stops the writer
+    void stop()
+    {
+        if(thread == 0)
+        {
+            return;
+        }
+
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_mutex_unlock(&lock);
+        pthread_cond_signal(&pending_cond);
+
+        pthread_join(thread, nullptr);
+        thread = 0;
+    }
+
+    static void* writer_loop(void* writer_ptr)
+    {
+        background_writer_t& writer = *static_cast<background_writer_t*>(writer_ptr);
+
+        while(true)
+        {
+            pthread_mutex_lock(&writer.lock);
+            while(writer.pending.empty() && !writer.stopping)
+            {
+                pthread_cond_wait(&writer.pending_cond, &writer.lock);
+            }
+
+            const bool stop = writer.stopping && writer.pending.empty();
+            std::swap(writer.writing, writer.pending);
+            pthread_mutex_unlock(&writer.lock);
+
+            if(stop)
+            {
+                return nullptr;
+            }
+
+            writer.owner->write_batch(writer.writing);
+            writer.writing.clear();
+        }
+    }
+};
@@ -0,0 +1,555 @@
+//times the hot paths of the server in isolation. the whole server is compiled in, so the code measured is the code that runs:
+//stall_benchmark [--filter text] [--time-ms milliseconds] [--json path] [--baseline path] [--threshold percent]
+//--json writes the results, --baseline compares them against results written earlier and fails if any benchmark got slower by more
+//than the threshold or no longer ran. baselines only mean something on the machine and build they were taken with
+#define STALL_BENCHMARK
+#include "main.cpp"
+
+#include <functional>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+
+constexpr uint32_t benchmark_repetitions = 5; //the fastest repetition is kept, the others ran into noise
+constexpr uint32_t client_counts[] = {10, 100, 1000, 10000};
+
+struct benchmark_options_t
+{
+    const char* filter = nullptr;
+    uint32_t time_ms = 100; //per repetition
+    const char* json_path = nullptr;
+    const char* baseline_path = nullptr;
+    double threshold = 10; //percent
+};
+
+struct benchmark_result_t
+{
+    std::string name;
+    double nanoseconds; //per operation
+};
+
+template<typename T>
+void keep(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+//runs operation(iterations) until it takes long enough to time and returns the fastest repetition per iteration
+double time_operation(const benchmark_options_t& options, const std::function<void(uint64_t)>& operation)
+{
+    const uint64_t target = options.time_ms * 1'000'000ull;
+
+    uint64_t iterations = 1;
+    while(true)
+    {
+        const uint64_t start = monotonic_nanoseconds();
+        operation(iterations);
+        const uint64_t elapsed = monotonic_nanoseconds() - start;
+
+        if(elapsed >= target / 10)
+        {
+            iterations = std::max<uint64_t>(1, iterations * target / std::max<uint64_t>(elapsed, 1));
+            break;
+        }
+
+        iterations *= 2;
+    }
+
+    double fastest = 0;
+    for(uint32_t repetition = 0; repetition < benchmark_repetitions; ++repetition)
+    {
+        const uint64_t start = monotonic_nanoseconds();
+        operation(iterations);
+        const double nanoseconds = static_cast<double>(monotonic_nanoseconds() - start) / iterations;
+
+        fastest = repetition == 0 ? nanoseconds : std::min(fastest, nanoseconds);
+    }
+
+    return fastest;
+}
+
+struct benchmark_runner_t
+{
+    const benchmark_options_t& options;
+    std::vector<benchmark_result_t> results{};
+
+    void run(std::string name, const std::function<void(uint64_t)>& operation)
+    {
+        if(options.filter != nullptr && name.find(options.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        const double nanoseconds = time_operation(options, operation);
+        fmt::print("{:<40} {:>12.1f} ns\n", name, nanoseconds);
+        results.push_back(benchmark_result_t{.name = std::move(name), .nanoseconds = nanoseconds});
+    }
+};
+
+std::vector<std::u16string> benchmark_names()
+{
+    constexpr std::u16string_view first_names[] = {u"Annika", u"Lars", u"Karin", u"Per", u"Sofia", u"Erik", u"Maja", u"Nils"};
+    constexpr std::u16string_view last_names[] = {u"Svensson", u"Öberg", u"Åkesson", u"Lindqvist", u"Nyström", u"Holm"};
+
+    std::vector<std::u16string> names{};
+    for(std::u16string_view first_name : first_names)
+    {
+        for(std::u16string_view last_name : last_names)
+        {
+            names.push_back(std::u16string{first_name} + u" " + std::u16string{last_name});
+        }
+    }
+
+    return names;
+}
+
+std::vector<handler_key_t> random_keys(uint32_t first_year, uint32_t year_count, uint32_t count)
+{
+    std::minstd_rand random{1};
+
+    std::vector<handler_key_t> keys{};
+    for(uint32_t index = 0; index < count; ++index)
+    {
+        keys.push_back(handler_key_t{.id = static_cast<handler_id_t>(random() % handler_id_count),
+            .day_of_year = static_cast<uint16_t>(random() % (max_day_of_year + 1)), .year = first_year + static_cast<uint32_t>(random() % year_count)});
+    }
+
+    return keys;
+}
+
+//the table is filled for three years like a server that has run for a while. released names are freed right away, there are no
+//readers to wait for
+void run_table_benchmarks(benchmark_runner_t* runner)
+{
+    const std::vector<std::u16string> names = benchmark_names();
+    const std::vector<handler_key_t> keys = random_keys(2024, 3, 4096);
+
+    for(uint32_t year = 2024; year < 2027; ++year)
+    {
+        for(uint16_t day = 0; day <= max_day_of_year; ++day)
+        {
+            for(uint16_t id = 0; id < handler_id_count; ++id)
+            {
+                handlers.set(handler_key_t{.id = static_cast<handler_id_t>(id), .day_of_year = day, .year = year}, names[(day + id) % names.size()]);
+            }
+        }
+    }
+
+    runner->run("table/find_locked", [&keys](uint64_t iterations)
+    {
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            timed_rdlock(&handlers_lock, lock_metric_e::handlers_read);
+            keep(handlers.find(keys[iteration % keys.size()]).size());
+            pthread_rwlock_unlock(&handlers_lock);
+        }
+    });
+
+    runner->run("table/find_published", [&keys](uint64_t iterations) //how gets read without handlers_lock
+    {
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            const handler_key_t key = keys[iteration % keys.size()];
+
+            handler_readers.enter(0);
+            const handler_year_t* year = handlers.find_published_year(key.year);
+            keep(year != nullptr ? year->read(key.day_of_year, key.id).second.size() : 0);
+            handler_readers.leave(0);
+        }
+    });
+
+    runner->run("table/set_locked", [&keys, &names](uint64_t iterations)
+    {
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            timed_wrlock(&handlers_lock, lock_metric_e::handlers_write);
+            handlers.set(keys[iteration % keys.size()], names[iteration % names.size()]);
+            pthread_rwlock_unlock(&handlers_lock);
+        }
+    });
+}
+
+void run_encoding_benchmarks(benchmark_runner_t* runner)
+{
+    const std::vector<std::u16string> names = benchmark_names();
+    const std::vector<handler_key_t> keys = random_keys(2024, 3, 4096);
+    const std::u16string long_name = names[0] + u", " + names[1] + u", " + names[2] + u" och " + names[3];
+
+    runner->run("encode/handler_name", [&keys, &names](uint64_t iterations)
+    {
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            keep(encode_handler_name(keys[iteration % keys.size()], names[iteration % names.size()]));
+        }
+    });
+
+    runner->run("encode/update", [&keys](uint64_t iterations)
+    {
+        timed_rdlock(&handlers_lock, lock_metric_e::handlers_read);
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            keep(encode_update(keys[iteration % keys.size()], -1));
+        }
+        pthread_rwlock_unlock(&handlers_lock);
+    });
+
+    runner->run("encode/week_of_entries", [&keys, &names](uint64_t iterations)
+    {
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            server_message_t message{server_message_type_e::sent_handler_range, sizeof(uint32_t)};
+            for(uint32_t entry = 0; entry < 7 * handler_id_count; ++entry)
+            {
+                append_handler_entry(&message.message_buffer, keys[entry], 1, names[entry % names.size()]);
+            }
+            finish_handler_entries(&message, 7 * handler_id_count);
+            keep(share_frame(std::move(message)));
+        }
+    });
+
+    runner->run("convert/str16_to_str8", [&long_name](uint64_t iterations)
+    {
+        for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            keep(cvt_str16_to_str8(long_name));
+        }
+    });
+}
+
+void remove_benchmark_clients(const std::vector<client_t*>& added)
+{
+    for(client_t* client : added)
+    {
+        handler_subscriptions.remove_client(client->socket);
+        close(client->socket);
+        delete client->outbound;
+        delete client;
+    }
+
+    clients.clear();
+}
+
+//a loopback udp socket connected to one that is never read. a send to it always has room and never fails, datagrams past the receive
+//buffer are dropped by the kernel, so every frame sent to a benchmark client goes through the outbound queue and a real sendmsg
+struct benchmark_sink_t
+{
+    int receiver = -1;
+    int sender = -1;
+
+    bool open()
+    {
+        receiver = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sender = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+        sockaddr_in address{.sin_family = AF_INET, .sin_port = 0, .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)}, .sin_zero = {}};
+        socklen_t address_size = sizeof(address);
+
+        if(receiver == -1 || sender == -1 || bind(receiver, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+            || getsockname(receiver, reinterpret_cast<sockaddr*>(&address), &address_size) == -1
+            || connect(sender, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            perror("benchmark sink");
+            return false;
+        }
+
+        return true;
+    }
+};
+
+benchmark_sink_t benchmark_sink{};
+
+//registers count clients whose sockets are copies of the sink, so broadcasts to them pay for the queue and the syscall of every client.
+//returns no clients if there are not enough file descriptors for them
+std::vector<client_t*> add_benchmark_clients(uint32_t count, bool subscribe)
+{
+    const handler_range_t week{.id_mask = (1 << handler_id_count) - 1, .first_day_of_year = 1, .day_count = 7, .reserved = 0, .year = 2024};
+
+    std::vector<client_t*> added{};
+    for(uint32_t index = 0; index < count; ++index)
+    {
+        const int socket = dup(benchmark_sink.sender);
+        if(socket == -1)
+        {
+            fmt::print(stderr, "skipping {} clients: {}\n", count, strerror(errno));
+            remove_benchmark_clients(added);
+            return {};
+        }
+
+        client_t* client = add_client(socket, sockaddr_in{}, 0);
+        client->logged_in = true;
+
+        if(subscribe)
+        {
+            client->subscribed = true;
+            handler_subscriptions.subscribe(client, week);
+        }
+
+        added.push_back(client);
+    }
+
+    return added;
+}
+
+
+//the scans that visit every client: old clients that never subscribed get every change, subscribed ones are found through the index
+void run_client_benchmarks(benchmark_runner_t* runner)
+{
+    const handler_key_t key{.id = handler_id_t::pasture, .day_of_year = 3, .year = 2024};
+
+    for(uint32_t count : client_counts)
+    {
+        std::vector<client_t*> added = add_benchmark_clients(count, false);
+        if(added.empty())
+        {
+            continue;
+        }
+
+        runner->run(fmt::format("clients/recipient_scan/{}", count), [&key](uint64_t iterations)
+        {
+            timed_rdlock(&clients_lock, lock_metric_e::clients_read);
+            for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+            {
+                uint64_t recipients = 0;
+                for_each_recipient(key, -1, [&recipients](const client_t&){ ++recipients; });
+                keep(recipients);
+            }
+            pthread_rwlock_unlock(&clients_lock);
+        });
+
+        remove_benchmark_clients(added);
+        added = add_benchmark_clients(count, true);
+        if(added.empty())
+        {
+            continue;
+        }
+
+        runner->run(fmt::format("clients/subscriber_lookup/{}", count), [&key](uint64_t iterations)
+        {
+            timed_rdlock(&clients_lock, lock_metric_e::clients_read);
+            for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+            {
+                uint64_t recipients = 0;
+                handler_subscriptions.for_each_subscriber(key, [&recipients](const client_t&){ ++recipients; });
+                keep(recipients);
+            }
+            pthread_rwlock_unlock(&clients_lock);
+        });
+
+        remove_benchmark_clients(added);
+    }
+}
+
+//one change broadcast to every client viewing its week, batched per client and written to its socket like the server does it
+void run_broadcast_benchmarks(benchmark_runner_t* runner)
+{
+    const handler_key_t key{.id = handler_id_t::pasture, .day_of_year = 3, .year = 2024};
+
+    for(uint32_t count : client_counts)
+    {
+        std::vector<client_t*> added = add_benchmark_clients(count, true);
+        if(added.empty())
+        {
+            continue;
+        }
+
+        runner->run(fmt::format("broadcast/subscribed/{}", count), [&key](uint64_t iterations)
+        {
+            timed_rdlock(&handlers_lock, lock_metric_e::handlers_read);
+            const encoded_update_t update = encode_update(key, -1);
+            for(uint64_t iteration = 0; iteration < iterations; ++iteration)
+            {
+                begin_broadcast();
+                broadcast_handler_changes(std::span{&update, 1});
+                finish_broadcast();
+            }
+            pthread_rwlock_unlock(&handlers_lock);
+        });
+
+        remove_benchmark_clients(added);
+    }
+}
+
+//reads back what write_results wrote, a flat list of name and nanoseconds pairs
+bool read_baseline(const char* path, std::vector<benchmark_result_t>* baseline)
+{
+    std::ifstream file{path};
+    if(!file)
+    {
+        fmt::print(stderr, "could not open baseline {}\n", path);
+        return false;
+    }
+
+    std::stringstream contents{};
+    contents << file.rdbuf();
+    const std::string text = contents.str();
+
+    constexpr std::string_view name_field = "\"name\": \"";
+    constexpr std::string_view time_field = "\"ns_per_op\": ";
+
+    for(uint64_t position = text.find(name_field); position != std::string::npos; position = text.find(name_field, position))
+    {
+        position += name_field.size();
+        const uint64_t name_end = text.find('"', position);
+        const uint64_t time_position = text.find(time_field, name_end);
+        if(name_end == std::string::npos || time_position == std::string::npos)
+        {
+            fmt::print(stderr, "baseline {} is malformed\n", path);
+            return false;
+        }
+
+        baseline->push_back(benchmark_result_t{.name = text.substr(position, name_end - position),
+            .nanoseconds = std::strtod(text.c_str() + time_position + time_field.size(), nullptr)});
+        position = time_position;
+    }
+
+    return true;
+}
+
+bool write_results(const char* path, const std::vector<benchmark_result_t>& results)
+{
+    std::string text = "{\n  \"benchmarks\": [\n";
+    for(uint64_t index = 0; index < results.size(); ++index)
+    {
+        fmt::format_to(std::back_inserter(text), "    {{\"name\": \"{}\", \"ns_per_op\": {:.2f}}}{}\n", results[index].name, results[index].nanoseconds,
+            index + 1 != results.size() ? "," : "");
+    }
+    text += "  ]\n}\n";
+
+    std::ofstream file{path};
+    file << text;
+    if(!file)
+    {
+        fmt::print(stderr, "could not write {}\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+//returns false if any benchmark of the baseline got slower by more than the threshold, or did not run although the filter selects it
+bool compare_results(const std::vector<benchmark_result_t>& baseline, const std::vector<benchmark_result_t>& results, const benchmark_options_t& options)
+{
+    const double threshold = options.threshold;
+    bool passed = true;
+
+    fmt::print("\n{:<40} {:>12} {:>12} {:>8}\n", "compared to baseline", "baseline ns", "ns", "change");
+    for(const benchmark_result_t& result : results)
+    {
+        auto previous = std::find_if(baseline.begin(), baseline.end(), [&result](const benchmark_result_t& entry){ return entry.name == result.name; });
+        if(previous == baseline.end() || previous->nanoseconds <= 0)
+        {
+            fmt::print("{:<40} {:>12} {:>12.1f}      new\n", result.name, "-", result.nanoseconds);
+            continue;
+        }
+
+        const double change = ((result.nanoseconds / previous->nanoseconds) - 1) * 100;
+        const bool regressed = change > threshold;
+        passed = passed && !regressed;
+
+        fmt::print("{:<40} {:>12.1f} {:>12.1f} {:>+7.1f}%{}\n", result.name, previous->nanoseconds, result.nanoseconds, change, regressed ? "  REGRESSED" : "");
+    }
+
+    for(const benchmark_result_t& entry : baseline)
+    {
+        const bool selected = options.filter == nullptr || entry.name.find(options.filter) != std::string::npos;
+        const bool ran = std::any_of(results.begin(), results.end(), [&entry](const benchmark_result_t& result){ return result.name == entry.name; });
+        if(selected && !ran)
+        {
+            fmt::print("{:<40} {:>12.1f} {:>12}           MISSING\n", entry.name, entry.nanoseconds, "-");
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+bool parse_options(int argc, char** argv, benchmark_options_t* options)
+{
+    constexpr option long_options[] = {
+        {"filter", required_argument, nullptr, 'f'},
+        {"time-ms", required_argument, nullptr, 't'},
+        {"json", required_argument, nullptr, 'j'},
+        {"baseline", required_argument, nullptr, 'b'},
+        {"threshold", required_argument, nullptr, 'r'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int option_char;
+    while((option_char = getopt_long(argc, argv, "f:t:j:b:r:", long_options, nullptr)) != -1)
+    {
+        switch(option_char)
+        {
+            case 'f':
+                options->filter = optarg;
+                break;
+            case 't':
+                options->time_ms = std::max<uint32_t>(1, std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'j':
+                options->json_path = optarg;
+                break;
+            case 'b':
+                options->baseline_path = optarg;
+                break;
+            case 'r':
+                options->threshold = std::strtod(optarg, nullptr);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return optind == argc;
+}
+
+int main(int argc, char** argv)
+{
+    benchmark_options_t options{};
+    if(!parse_options(argc, argv, &options))
+    {
+        fmt::print(stderr, "usage: {} [--filter text] [--time-ms milliseconds] [--json path] [--baseline path] [--threshold percent]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<benchmark_result_t> baseline{};
+    if(options.baseline_path != nullptr && !read_baseline(options.baseline_path, &baseline))
+    {
+        return EXIT_FAILURE;
+    }
+
+    logger.level = log_level_e::error; //nothing drains the log rings, the lines would only be dropped
+    io_backend = io_backend_e::epoll;
+    handler_readers.init(1);
+
+    rlimit file_limit{};
+    if(getrlimit(RLIMIT_NOFILE, &file_limit) == 0) //every benchmark client holds a socket
+    {
+        file_limit.rlim_cur = file_limit.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &file_limit);
+    }
+
+    if(!benchmark_sink.open())
+    {
+        return EXIT_FAILURE;
+    }
+
+    benchmark_runner_t runner{.options = options};
+    run_table_benchmarks(&runner);
+    run_encoding_benchmarks(&runner);
+    run_client_benchmarks(&runner);
+    run_broadcast_benchmarks(&runner);
+
+    if(options.json_path != nullptr && !write_results(options.json_path, runner.results))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if(options.baseline_path != nullptr && !compare_results(baseline, runner.results, options))
+    {
+        fmt::print("slower than the baseline by more than {}% or missing benchmarks of it\n", options.threshold);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <span>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fmt/format.h>
+
+#include "background.h"
+#include "protocol.h"
+
+//a capture is a capture_header_t followed by one record per inbound frame or connection event, in the order the server saw them:
+//varint microseconds since the previous record, varint connection id, varint event and for frames the frame itself, as received in
+//whichever protocol version the connection spoke. the event of a frame is its size, frames are at least 2 bytes so the values below
+//that mark connection events
+constexpr char capture_magic[8] = {'S', 'T', 'A', 'L', 'L', 'C', 'A', 'P'};
+constexpr uint32_t capture_format_version = 1;
+
+enum capture_event_e : uint64_t
+{
+    capture_connected = 0,
+    capture_disconnected = 1
+};
+
+struct __attribute__((packed)) capture_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t start_time; //nanoseconds since the epoch
+};
+
+//login frames are recorded with the password taken out, as a login with an empty one in the version the connection spoke, so a capture
+//can be handed around. stall_replay --password puts a password back in
+constexpr uint8_t redacted_login_v1[] = {0, 0, 0, 0, 1, 0, 0, 0, 0}; //type 0, size 1, the terminator
+constexpr uint8_t redacted_login_v2[] = {0, 0}; //type 0, size 0
+
+//frames are dropped rather than buffered past this while the disk falls behind, connection events are always kept
+constexpr uint64_t max_capture_pending = 64ull << 20;
+
+//records are appended by every reactor under a short lock and written out by a background thread, like the audit log
+struct capture_writer_t
+{
+    int file = -1;
+    background_writer_t<capture_writer_t, std::vector<uint8_t>> writer{};
+    uint64_t file_size = 0; //only touched by the writer
+    uint64_t last_time = 0; //microseconds, of the last record appended, guarded by the writer lock
+    uint64_t dropped_frames = 0; //guarded by the writer lock
+    bool failed = false; //only touched by the writer
+
+    bool enabled() const
+    {
+        return writer.running();
+    }
+
+    bool open(const char* path)
+    {
+        file = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(file == -1)
+        {
+            perror("open capture");
+            return false;
+        }
+
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        capture_header_t header{.magic = {}, .version = capture_format_version, .reserved = 0, .start_time = now.tv_sec * 1'000'000'000ll + now.tv_nsec};
+        std::memcpy(header.magic, capture_magic, sizeof(capture_magic));
+        writer.pending.insert(writer.pending.end(), reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header) + sizeof(header));
+        last_time = monotonic_microseconds();
+
+        return writer.start(this);
+    }
+
+    static uint64_t monotonic_microseconds()
+    {
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1'000'000ull + (now.tv_nsec / 1000);
+    }
+
+    //frame is empty for connection events
+    void append(uint32_t connection, uint64_t event, std::span<const uint8_t> frame = {})
+    {
+        writer.append([&](std::vector<uint8_t>& pending)
+        {
+            if(!frame.empty() && pending.size() + frame.size() > max_capture_pending)
+            {
+                ++dropped_frames;
+                return;
+            }
+
+            uint8_t record_header[max_varint_size * 3];
+
+            const uint64_t now = monotonic_microseconds(); //read under the lock so the deltas never go backwards
+            uint32_t header_size = encode_varint(now - last_time, record_header);
+            header_size += encode_varint(connection, record_header + header_size);
+            header_size += encode_varint(event, record_header + header_size);
+            last_time = now;
+
+            pending.insert(pending.end(), record_header, record_header + header_size);
+            pending.insert(pending.end(), frame.begin(), frame.end());
+        });
+    }
+
+    //type is the message type the frame header named
+    void append_frame(uint32_t connection, uint32_t protocol_version, uint32_t type, std::span<const uint8_t> frame)
+    {
+        if(type == static_cast<uint32_t>(client_message_type_e::login))
+        {
+            frame = protocol_version == 1 ? std::span<const uint8_t>(redacted_login_v1) : std::span<const uint8_t>(redacted_login_v2);
+        }
+
+        append(connection, frame.size(), frame);
+    }
+
+    //writes out whatever is still pending and stops the writer
+    void close()
+    {
+        if(!writer.running())
+        {
+            return;
+        }
+
+        writer.stop();
+
+        ::close(file);
+        file = -1;
+
+        if(dropped_frames != 0)
+        {
+            fmt::print(stderr, "the capture fell behind and dropped {} frames, it replays without them\n", dropped_frames);
+        }
+    }
+
+    //runs on the writer
+    void write_batch(std::vector<uint8_t>& batch)
+    {
+        for(uint64_t offset = 0; !failed && offset < batch.size();)
+        {
+            ssize_t nwritten = write(file, batch.data() + offset, batch.size() - offset);
+            if(nwritten == -1)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                perror("write capture");
+                (void)ftruncate(file, file_size); //the capture ends with the last whole batch, records after a gap would replay wrong
+                failed = true;
+                break;
+            }
+            offset += nwritten;
+        }
+
+        if(!failed)
+        {
+            file_size += batch.size();
+        }
+    }
+};
+
+struct capture_record_t
+{
+    uint64_t time; //microseconds since the capture started
+    uint32_t connection;
+    uint64_t event;
+    std::span<const uint8_t> frame; //empty for connection events
+};
+
+//reads a capture mapped into memory, record by record
+struct capture_reader_t
+{
+    const uint8_t* contents = nullptr;
+    uint64_t size = 0;
+    uint64_t offset = 0;
+    uint64_t time = 0;
+    capture_header_t header{};
+
+    bool open(const char* path)
+    {
+        int file = ::open(path, O_RDONLY | O_CLOEXEC);
+        if(file == -1)
+        {
+            perror("open");
+            return false;
+        }
+
+        struct stat file_stat{};
+        if(fstat(file, &file_stat) == -1 || static_cast<uint64_t>(file_stat.st_size) < sizeof(capture_header_t))
+        {
+            fmt::print(stderr, "{} is not a capture\n", path);
+            ::close(file);
+            return false;
+        }
+
+        size = file_stat.st_size;
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+
+        if(mapping == MAP_FAILED)
+        {
+            perror("mmap");
+            return false;
+        }
+        contents = static_cast<const uint8_t*>(mapping);
+
+        std::memcpy(&header, contents, sizeof(header));
+        if(std::memcmp(header.magic, capture_magic, sizeof(capture_magic)) != 0 || header.version != capture_format_version)
+        {
+            fmt::print(stderr, "{} is not a capture of this version\n", path);
+            close();
+            return false;
+        }
+
+        offset = sizeof(header);
+        return true;
+    }
+
+    //returns false at the end, a record cut off by a crash ends the capture
+    bool next(capture_record_t* record)
+    {
+        uint64_t delta = 0;
+        uint64_t connection = 0;
+        uint64_t event = 0;
+
+        uint64_t position = offset;
+        for(uint64_t* field : {&delta, &connection, &event})
+        {
+            const int32_t field_size = decode_varint(contents + position, size - position, field);
+            if(field_size <= 0)
+            {
+                return false;
+            }
+            position += field_size;
+        }
+
+        const uint64_t frame_size = event > capture_disconnected ? event : 0;
+        if(size - position < frame_size)
+        {
+            return false;
+        }
+
+        time += delta;
+        *record = capture_record_t{.time = time, .connection = static_cast<uint32_t>(connection), .event = event, .frame = {contents + position, frame_size}};
+        offset = position + frame_size;
+        return true;
+    }
+
+    void close()
+    {
+        if(contents != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(contents), size);
+        }
+
+        *this = capture_reader_t{};
+    }
+};
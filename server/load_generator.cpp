@@ -0,0 +1,671 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <span>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "protocol.h"
+#include "metrics.h"
+
+//simulates display and office clients against a running server and prints throughput and latency percentiles:
+//stall_load [--host address] [--clients count] [--threads count] [--duration seconds] [--typists count] [--weeks count]
+//           [--browse-ms milliseconds] [--keystroke-ms milliseconds] [--year year] port
+//every client logs in and views one of a few weeks, and now and then browses to another one with a burst of gets for its handlers.
+//typists type names into handlers of their week, one set per keystroke. each name ends with the time its set was sent, so the
+//clients viewing the week measure how long the broadcast took to reach them. the server holds sets back for its coalescing window,
+//start it with --coalesce-ms 0 to measure delivery alone
+
+constexpr char login_password[] = "washington";
+constexpr uint32_t week_count_in_year = 52;
+constexpr uint32_t week_key_count = 7 * handler_id_count;
+constexpr uint64_t drain_nanoseconds = 1'000'000'000; //replies and broadcasts still arriving after the run are waited for this long
+constexpr uint32_t stamp_size = 22; //" #", the run tag and the send time, all in hex
+
+constexpr std::u16string_view typed_names[] = {u"Annika Svensson", u"Lars Öberg", u"Karin Åkesson", u"Per Lindqvist", u"Sofia Nyström",
+    u"Erik Johansson", u"Maja Holm", u"Nils Bergström"};
+
+struct load_options_t
+{
+    const char* host = "127.0.0.1";
+    uint16_t port = 0;
+    uint32_t client_count = 100;
+    uint32_t thread_count = 2;
+    uint32_t duration = 10; //seconds
+    int64_t typist_count = -1; //-1 makes every tenth client a typist
+    uint32_t week_count = 4; //clients spread over this many weeks, fewer weeks means more viewers per broadcast
+    uint32_t browse_interval = 2000; //milliseconds on average between week changes
+    uint32_t keystroke_interval = 150; //milliseconds
+    uint32_t year = 2099; //far from any real schedule
+};
+
+enum class load_metric_e : uint32_t
+{
+    login = 0, //login sent until the response arrived
+    get, //get_handler sent until its sent_handler_name arrived
+    broadcast, //set sent until a viewer of the key received the change
+    max
+};
+
+constexpr std::string_view load_metric_names[] = {"login", "get", "broadcast"};
+
+struct pending_get_t
+{
+    handler_key_t key;
+    uint64_t sent_time;
+};
+
+struct simulated_client_t
+{
+    int socket = -1;
+    uint32_t week = 0;
+    bool typist = false;
+    bool logged_in = false;
+    bool closed = false;
+    uint64_t login_sent_time = 0;
+    uint64_t next_browse_time = UINT64_MAX; //set once logged in
+    uint64_t next_keystroke_time = UINT64_MAX;
+    handler_key_t typed_key{};
+    uint32_t typed_name = 0;
+    uint32_t typed_length = 0; //characters of the name typed so far, 0 between names
+    std::deque<pending_get_t> pending_gets{}; //gets are answered in the order they were sent
+    std::vector<uint8_t> input{};
+    std::vector<uint8_t> output{};
+};
+
+struct load_thread_t
+{
+    pthread_t thread = 0;
+    const load_options_t* options = nullptr;
+    uint32_t first_client = 0; //index of the first client over all threads, typists are the lowest indices
+    uint32_t client_count = 0;
+    uint16_t run_tag = 0; //names stamped by another run are not measured
+    uint64_t start_time = 0;
+
+    histogram_t latency[static_cast<uint32_t>(load_metric_e::max)]{};
+    uint64_t sets_sent = 0;
+    uint64_t gets_sent = 0;
+    uint64_t frames_received = 0;
+    uint64_t bytes_received = 0;
+    uint64_t failed_clients = 0; //could not connect or were disconnected
+};
+
+handler_range_t week_range(uint32_t year, uint32_t week)
+{
+    return handler_range_t{.id_mask = (1 << handler_id_count) - 1, .first_day_of_year = static_cast<uint16_t>(1 + (week * 7)), .day_count = 7, .reserved = 0, .year = year};
+}
+
+void append_frame(simulated_client_t* client, client_message_type_e type, const void* data, uint32_t size)
+{
+    const frame_header_t header{.type = static_cast<uint32_t>(type), .size = size};
+    auto header_bytes = reinterpret_cast<const uint8_t*>(&header);
+    auto data_bytes = static_cast<const uint8_t*>(data);
+
+    client->output.insert(client->output.end(), header_bytes, header_bytes + sizeof(header));
+    client->output.insert(client->output.end(), data_bytes, data_bytes + size);
+}
+
+//sends as much of the queued output as the socket takes, the rest goes out on the next writable event
+void flush_output(simulated_client_t* client)
+{
+    uint64_t sent = 0;
+    while(sent < client->output.size())
+    {
+        ssize_t result = send(client->socket, client->output.data() + sent, client->output.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(result == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                client->closed = true;
+            }
+            break;
+        }
+        sent += result;
+    }
+
+    client->output.erase(client->output.begin(), client->output.begin() + sent);
+}
+
+//moves the client to another week: the old week is unsubscribed and every handler of the new one is requested
+void browse(load_thread_t* thread, simulated_client_t* client, uint32_t week, uint64_t now)
+{
+    const load_options_t& options = *thread->options;
+
+    if(client->logged_in)
+    {
+        const handler_range_t previous_range = week_range(options.year, client->week);
+        append_frame(client, client_message_type_e::unsubscribe_handlers, &previous_range, sizeof(previous_range));
+    }
+
+    client->week = week;
+    const handler_range_t range = week_range(options.year, week);
+    append_frame(client, client_message_type_e::subscribe_handlers, &range, sizeof(range));
+
+    for(uint16_t day = range.first_day_of_year; day < range.first_day_of_year + range.day_count; ++day)
+    {
+        for(uint16_t id = 0; id < handler_id_count; ++id)
+        {
+            const handler_key_t key{.id = static_cast<handler_id_t>(id), .day_of_year = day, .year = options.year};
+            append_frame(client, client_message_type_e::get_handler, &key, sizeof(key));
+            client->pending_gets.push_back(pending_get_t{.key = key, .sent_time = now});
+        }
+    }
+
+    thread->gets_sent += week_key_count;
+}
+
+//sets the handler being typed into to the name typed so far, followed by the stamp the viewers measure the delivery with
+void type_keystroke(load_thread_t* thread, simulated_client_t* client, std::minstd_rand* random, uint64_t now)
+{
+    const load_options_t& options = *thread->options;
+
+    if(client->typed_length == 0)
+    {
+        client->typed_key = handler_key_t{.id = static_cast<handler_id_t>((*random)() % handler_id_count),
+            .day_of_year = static_cast<uint16_t>(1 + (client->week * 7) + ((*random)() % 7)), .year = options.year};
+        client->typed_name = (*random)() % std::size(typed_names);
+    }
+
+    const std::u16string_view name = typed_names[client->typed_name];
+    ++client->typed_length;
+
+    std::u16string stamped_name{name.substr(0, client->typed_length)};
+    for(char digit : fmt::format(" #{:04x}{:016x}", thread->run_tag, now))
+    {
+        stamped_name.push_back(digit);
+    }
+    stamped_name.push_back(u'\0');
+
+    std::vector<uint8_t> message(sizeof(handler_key_t) + (stamped_name.size() * 2));
+    std::memcpy(message.data(), &client->typed_key, sizeof(handler_key_t));
+    std::memcpy(message.data() + sizeof(handler_key_t), stamped_name.data(), stamped_name.size() * 2);
+    append_frame(client, client_message_type_e::set_handler, message.data(), message.size());
+    ++thread->sets_sent;
+
+    const uint64_t keystroke_nanoseconds = options.keystroke_interval * 1'000'000ull;
+    if(client->typed_length == name.size())
+    {
+        client->typed_length = 0;
+        client->next_keystroke_time = now + (keystroke_nanoseconds * 10); //a pause before the next name
+    }
+    else
+    {
+        client->next_keystroke_time = now + keystroke_nanoseconds;
+    }
+}
+
+//returns the send time carried by a name stamped in this run, or 0
+uint64_t parse_stamp(const uint8_t* name_bytes, uint64_t name_size, uint16_t run_tag)
+{
+    const uint64_t length = name_size / 2;
+    if(length < stamp_size)
+    {
+        return 0;
+    }
+
+    char stamp[stamp_size];
+    for(uint32_t index = 0; index < stamp_size; ++index)
+    {
+        char16_t character;
+        std::memcpy(&character, name_bytes + ((length - stamp_size + index) * 2), sizeof(character));
+        if(character > 0x7F)
+        {
+            return 0;
+        }
+        stamp[index] = static_cast<char>(character);
+    }
+
+    if(stamp[0] != ' ' || stamp[1] != '#')
+    {
+        return 0;
+    }
+
+    char* end = nullptr;
+    const std::string tag{stamp + 2, 4};
+    if(std::strtoul(tag.c_str(), &end, 16) != run_tag || *end != '\0')
+    {
+        return 0;
+    }
+
+    const std::string time{stamp + 6, 16};
+    const uint64_t sent_time = std::strtoull(time.c_str(), &end, 16);
+    return *end == '\0' ? sent_time : 0;
+}
+
+void record_delivery(load_thread_t* thread, const uint8_t* name_bytes, uint64_t name_size, uint64_t now)
+{
+    const uint64_t sent_time = parse_stamp(name_bytes, name_size, thread->run_tag);
+    if(sent_time != 0 && sent_time <= now)
+    {
+        thread->latency[static_cast<uint32_t>(load_metric_e::broadcast)].record(now - sent_time);
+    }
+}
+
+void on_frame(load_thread_t* thread, simulated_client_t* client, server_message_type_e type, std::span<const uint8_t> data, uint64_t now)
+{
+    ++thread->frames_received;
+
+    switch(type)
+    {
+        case server_message_type_e::login_response:
+        {
+            if(data.empty() || data[0] == 0)
+            {
+                fmt::print(stderr, "login refused\n");
+                client->closed = true;
+                return;
+            }
+
+            thread->latency[static_cast<uint32_t>(load_metric_e::login)].record(now - client->login_sent_time);
+            client->logged_in = true;
+
+            const uint64_t browse_nanoseconds = thread->options->browse_interval * 1'000'000ull;
+            client->next_browse_time = now + (browse_nanoseconds / 2) + (now % std::max<uint64_t>(browse_nanoseconds, 1)); //spread out so weeks do not change in lockstep
+            if(client->typist)
+            {
+                client->next_keystroke_time = now;
+            }
+            break;
+        }
+        case server_message_type_e::sent_handler_name:
+        {
+            if(data.size() < sizeof(handler_key_t) + 2) //the name is null terminated
+            {
+                return;
+            }
+
+            handler_key_t key;
+            std::memcpy(&key, data.data(), sizeof(key));
+
+            if(!client->pending_gets.empty() && client->pending_gets.front().key == key)
+            {
+                thread->latency[static_cast<uint32_t>(load_metric_e::get)].record(now - client->pending_gets.front().sent_time);
+                client->pending_gets.pop_front();
+            }
+            else //a change sent before the subscription took effect
+            {
+                record_delivery(thread, data.data() + sizeof(handler_key_t), data.size() - sizeof(handler_key_t) - 2, now);
+            }
+            break;
+        }
+        case server_message_type_e::sent_handler_updates:
+        {
+            uint32_t entry_count;
+            if(data.size() < sizeof(entry_count))
+            {
+                return;
+            }
+            std::memcpy(&entry_count, data.data(), sizeof(entry_count));
+
+            uint64_t offset = sizeof(entry_count);
+            for(uint32_t entry_index = 0; entry_index < entry_count && offset + sizeof(handler_entry_t) <= data.size(); ++entry_index)
+            {
+                handler_entry_t entry;
+                std::memcpy(&entry, data.data() + offset, sizeof(entry));
+                offset += sizeof(entry);
+
+                if(offset + entry.name_size > data.size())
+                {
+                    return;
+                }
+
+                record_delivery(thread, data.data() + offset, entry.name_size, now);
+                offset += entry.name_size;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+//reads until the socket would block and handles every complete frame
+void on_readable(load_thread_t* thread, simulated_client_t* client)
+{
+    uint8_t buffer[64 << 10];
+    while(true)
+    {
+        ssize_t result = recv(client->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            break;
+        }
+        else if(result <= 0)
+        {
+            client->closed = true;
+            return;
+        }
+
+        thread->bytes_received += result;
+        client->input.insert(client->input.end(), buffer, buffer + result);
+    }
+
+    const uint64_t now = monotonic_nanoseconds();
+
+    uint64_t consumed = 0;
+    while(client->input.size() - consumed >= frame_header_size)
+    {
+        frame_header_t header;
+        std::memcpy(&header, client->input.data() + consumed, sizeof(header));
+        if(client->input.size() - consumed - frame_header_size < header.size)
+        {
+            break;
+        }
+
+        on_frame(thread, client, static_cast<server_message_type_e>(header.type), std::span<const uint8_t>{client->input.data() + consumed + frame_header_size, header.size}, now);
+        consumed += frame_header_size + header.size;
+    }
+
+    client->input.erase(client->input.begin(), client->input.begin() + consumed);
+}
+
+bool connect_client(const load_options_t& options, simulated_client_t* client)
+{
+    client->socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(client->socket == -1)
+    {
+        perror("socket");
+        return false;
+    }
+
+    sockaddr_in address{.sin_family = AF_INET, .sin_port = htons(options.port), .sin_addr = {}, .sin_zero = {}};
+    inet_pton(AF_INET, options.host, &address.sin_addr);
+
+    if(connect(client->socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        perror("connect");
+        close(client->socket);
+        client->socket = -1;
+        return false;
+    }
+
+    int enable = 1;
+    (void)setsockopt(client->socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)); //every keystroke goes out on its own like in the app
+    fcntl(client->socket, F_SETFL, fcntl(client->socket, F_GETFL) | O_NONBLOCK);
+
+    return true;
+}
+
+void* load_thread_loop(void* thread_ptr)
+{
+    load_thread_t& thread = *static_cast<load_thread_t*>(thread_ptr);
+    const load_options_t& options = *thread.options;
+
+    std::minstd_rand random{thread.first_client + 1};
+    std::vector<simulated_client_t> clients(thread.client_count);
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll == -1)
+    {
+        perror("epoll_create1");
+        return nullptr;
+    }
+
+    //all clients connect at once, like every display opening the app in the morning
+    for(uint32_t index = 0; index < clients.size(); ++index)
+    {
+        simulated_client_t& client = clients[index];
+        client.typist = thread.first_client + index < options.typist_count;
+
+        if(!connect_client(options, &client))
+        {
+            client.closed = true;
+            ++thread.failed_clients;
+            continue;
+        }
+
+        epoll_event event{.events = EPOLLIN | EPOLLOUT | EPOLLET, .data = {.u32 = index}};
+        epoll_ctl(epoll, EPOLL_CTL_ADD, client.socket, &event);
+
+        client.login_sent_time = monotonic_nanoseconds();
+        append_frame(&client, client_message_type_e::login, login_password, sizeof(login_password));
+        browse(&thread, &client, (thread.first_client + index) % options.week_count, client.login_sent_time);
+        flush_output(&client);
+    }
+
+    const uint64_t stop_time = thread.start_time + (options.duration * 1'000'000'000ull);
+    const uint64_t browse_nanoseconds = options.browse_interval * 1'000'000ull;
+
+    epoll_event events[256];
+    while(true)
+    {
+        const int event_count = epoll_wait(epoll, events, std::size(events), 1);
+        for(int event_index = 0; event_index < event_count; ++event_index)
+        {
+            simulated_client_t& client = clients[events[event_index].data.u32];
+            if(client.closed)
+            {
+                continue;
+            }
+
+            if(events[event_index].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                on_readable(&thread, &client);
+            }
+
+            if(!client.output.empty())
+            {
+                flush_output(&client);
+            }
+        }
+
+        const uint64_t now = monotonic_nanoseconds();
+        if(now >= stop_time + drain_nanoseconds)
+        {
+            break;
+        }
+
+        for(simulated_client_t& client : clients)
+        {
+            if(client.closed)
+            {
+                if(client.socket != -1)
+                {
+                    close(client.socket);
+                    client.socket = -1;
+                    ++thread.failed_clients;
+                }
+                continue;
+            }
+
+            if(now >= stop_time) //only replies and broadcasts in flight are still received
+            {
+                continue;
+            }
+
+            if(now >= client.next_browse_time)
+            {
+                browse(&thread, &client, random() % options.week_count, now);
+                client.next_browse_time = now + (browse_nanoseconds / 2) + (random() % std::max<uint64_t>(browse_nanoseconds, 1));
+            }
+
+            if(now >= client.next_keystroke_time)
+            {
+                type_keystroke(&thread, &client, &random, now);
+            }
+
+            if(!client.output.empty())
+            {
+                flush_output(&client);
+            }
+        }
+    }
+
+    for(simulated_client_t& client : clients)
+    {
+        if(client.socket != -1)
+        {
+            close(client.socket);
+        }
+    }
+
+    close(epoll);
+    return nullptr;
+}
+
+bool parse_options(int argc, char** argv, load_options_t* options)
+{
+    constexpr option long_options[] = {
+        {"host", required_argument, nullptr, 'h'},
+        {"clients", required_argument, nullptr, 'c'},
+        {"threads", required_argument, nullptr, 't'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"typists", required_argument, nullptr, 'y'},
+        {"weeks", required_argument, nullptr, 'w'},
+        {"browse-ms", required_argument, nullptr, 'b'},
+        {"keystroke-ms", required_argument, nullptr, 'k'},
+        {"year", required_argument, nullptr, 'r'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int option_char;
+    while((option_char = getopt_long(argc, argv, "h:c:t:d:y:w:b:k:r:", long_options, nullptr)) != -1)
+    {
+        switch(option_char)
+        {
+            case 'h':
+                options->host = optarg;
+                break;
+            case 'c':
+                options->client_count = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                options->thread_count = std::max<uint32_t>(1, std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'd':
+                options->duration = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'y':
+                options->typist_count = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'w':
+                options->week_count = std::clamp<uint32_t>(std::strtoul(optarg, nullptr, 10), 1, week_count_in_year);
+                break;
+            case 'b':
+                options->browse_interval = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'k':
+                options->keystroke_interval = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'r':
+                options->year = std::strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if(optind + 1 != argc)
+    {
+        return false;
+    }
+
+    options->port = std::strtoul(argv[optind], nullptr, 10);
+
+    in_addr address{};
+    if(inet_pton(AF_INET, options->host, &address) != 1)
+    {
+        fmt::print(stderr, "{} is not an ipv4 address\n", options->host);
+        return false;
+    }
+
+    if(options->typist_count == -1)
+    {
+        options->typist_count = std::max<uint32_t>(1, options->client_count / 10);
+    }
+
+    options->thread_count = std::min(options->thread_count, std::max<uint32_t>(1, options->client_count));
+    return options->client_count != 0;
+}
+
+int main(int argc, char** argv)
+{
+    load_options_t options{};
+    if(!parse_options(argc, argv, &options))
+    {
+        fmt::print(stderr, "usage: {} [--host address] [--clients count] [--threads count] [--duration seconds] [--typists count] [--weeks count] "
+            "[--browse-ms milliseconds] [--keystroke-ms milliseconds] [--year year] port\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto threads = std::make_unique<load_thread_t[]>(options.thread_count);
+    const uint64_t start_time = monotonic_nanoseconds();
+    const uint16_t run_tag = static_cast<uint16_t>(getpid() ^ start_time);
+
+    uint32_t first_client = 0;
+    for(uint32_t index = 0; index < options.thread_count; ++index)
+    {
+        load_thread_t& thread = threads[index];
+        thread.options = &options;
+        thread.first_client = first_client;
+        thread.client_count = (options.client_count / options.thread_count) + (index < options.client_count % options.thread_count);
+        thread.run_tag = run_tag;
+        thread.start_time = start_time;
+        first_client += thread.client_count;
+
+        if(int error = pthread_create(&thread.thread, nullptr, &load_thread_loop, &thread); error != 0)
+        {
+            fmt::print(stderr, "error creating load thread {}\n", strerror(error));
+            return EXIT_FAILURE;
+        }
+    }
+
+    histogram_totals_t totals[static_cast<uint32_t>(load_metric_e::max)]{};
+    uint64_t sets_sent = 0;
+    uint64_t gets_sent = 0;
+    uint64_t frames_received = 0;
+    uint64_t bytes_received = 0;
+    uint64_t failed_clients = 0;
+
+    for(uint32_t index = 0; index < options.thread_count; ++index)
+    {
+        load_thread_t& thread = threads[index];
+        pthread_join(thread.thread, nullptr);
+
+        for(uint32_t metric = 0; metric < static_cast<uint32_t>(load_metric_e::max); ++metric)
+        {
+            totals[metric].add(thread.latency[metric]);
+        }
+
+        sets_sent += thread.sets_sent;
+        gets_sent += thread.gets_sent;
+        frames_received += thread.frames_received;
+        bytes_received += thread.bytes_received;
+        failed_clients += thread.failed_clients;
+    }
+
+    const double seconds = std::max<uint32_t>(options.duration, 1);
+
+    fmt::print("{} clients ({} typing) on {} threads for {} s, {} clients failed\n", options.client_count, options.typist_count, options.thread_count, options.duration, failed_clients);
+    fmt::print("sent {} sets ({:.0f}/s) and {} gets ({:.0f}/s), received {} frames ({:.0f}/s, {:.1f} MB/s)\n", sets_sent, sets_sent / seconds,
+        gets_sent, gets_sent / seconds, frames_received, frames_received / seconds, bytes_received / seconds / 1e6);
+
+    fmt::print("{:<10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n", "latency", "count", "per s", "p50 us", "p99 us", "p999 us", "mean us");
+    for(uint32_t metric = 0; metric < static_cast<uint32_t>(load_metric_e::max); ++metric)
+    {
+        const histogram_totals_t& total = totals[metric];
+        const uint64_t count = total.count();
+
+        fmt::print("{:<10} {:>10} {:>10.0f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n", load_metric_names[metric], count, count / seconds,
+            total.percentile(0.5) / 1e3, total.percentile(0.99) / 1e3, total.percentile(0.999) / 1e3, count != 0 ? total.sum / 1e3 / count : 0.0);
+    }
+
+    return failed_clients == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
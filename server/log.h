@@ -0,0 +1,283 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <pthread.h>
+#include <unistd.h>
+#include <fmt/format.h>
+
+#include "background.h"
+
+enum class log_level_e : uint32_t
+{
+    debug = 0, //a line per request
+    info,
+    warning,
+    error
+};
+
+constexpr std::string_view log_level_names[] = {"debug", "info", "warning", "error"};
+
+constexpr uint32_t log_record_size = 512; //longer lines are cut off
+constexpr uint32_t log_ring_capacity = 1024; //records per thread, must be a power of 2
+
+struct log_record_t
+{
+    int64_t time; //seconds since the epoch
+    log_level_e level;
+    uint32_t size;
+    char text[log_record_size - 16];
+};
+
+//records of one thread, written only by that thread and read only by the log writer
+struct log_ring_t
+{
+    alignas(64) std::atomic<uint64_t> head{0}; //next record the thread writes
+    alignas(64) std::atomic<uint64_t> tail{0}; //next record the writer reads
+    std::atomic<uint64_t> dropped{0}; //records lost because the ring was full
+    std::atomic<bool> owned{true}; //false once the thread exited, the next new thread takes the ring over
+    log_ring_t* next = nullptr;
+    log_record_t records[log_ring_capacity];
+};
+
+//lines are formatted into a ring of the calling thread and a background thread adds the timestamp and level and writes them out, so logging never
+//takes a lock, makes a syscall or waits for the terminal. the timestamp is only formatted again when the second changes.
+//lines of different threads are written in batches per thread, so they can be slightly out of order with each other
+struct logger_t
+{
+    log_level_e level = log_level_e::info;
+    std::atomic<log_ring_t*> rings{nullptr};
+    pthread_t writer = 0;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+    std::atomic<bool> sleeping{false};
+    std::atomic<bool> stopping{false};
+
+    bool enabled(log_level_e line_level) const
+    {
+        return line_level >= level;
+    }
+
+    bool start()
+    {
+        return spawn_signal_blocked_thread(&writer, &writer_loop, this);
+    }
+
+    //writes out everything logged so far and stops the writer
+    void stop()
+    {
+        if(writer == 0)
+        {
+            return;
+        }
+
+        stopping.store(true);
+        wake();
+
+        pthread_join(writer, nullptr);
+        writer = 0;
+    }
+
+    log_ring_t* thread_ring()
+    {
+        struct ring_owner_t
+        {
+            log_ring_t* ring = nullptr;
+
+            ~ring_owner_t()
+            {
+                if(ring != nullptr)
+                {
+                    ring->owned.store(false, std::memory_order_release);
+                }
+            }
+        };
+
+        thread_local ring_owner_t owner{};
+        if(owner.ring != nullptr)
+        {
+            return owner.ring;
+        }
+
+        for(log_ring_t* ring = rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+        {
+            bool owned = false;
+            if(ring->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+            {
+                owner.ring = ring;
+                return ring;
+            }
+        }
+
+        owner.ring = new log_ring_t{};
+        owner.ring->next = rings.load(std::memory_order_relaxed);
+        while(!rings.compare_exchange_weak(owner.ring->next, owner.ring, std::memory_order_release, std::memory_order_relaxed));
+
+        return owner.ring;
+    }
+
+    template<typename... T>
+    void write(log_level_e line_level, fmt::format_string<T...> format, T&&... args)
+    {
+        log_ring_t* ring = thread_ring();
+
+        const uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if(head - ring->tail.load(std::memory_order_acquire) == log_ring_capacity)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+        log_record_t& record = ring->records[head & (log_ring_capacity - 1)];
+        record.time = now.tv_sec;
+        record.level = line_level;
+
+        const auto result = fmt::format_to_n(record.text, sizeof(record.text), format, std::forward<T>(args)...);
+        record.size = std::min<uint64_t>(result.size, sizeof(record.text));
+        if(result.size > sizeof(record.text))
+        {
+            std::memcpy(record.text + sizeof(record.text) - 3, "...", 3);
+        }
+
+        ring->head.store(head + 1, std::memory_order_release);
+
+        if(sleeping.load(std::memory_order_relaxed)) //a missed wake up only delays the line until the writer times out
+        {
+            wake();
+        }
+    }
+
+    void wake()
+    {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&lock);
+    }
+
+    static void* writer_loop(void* logger_ptr)
+    {
+        logger_t& logger = *static_cast<logger_t*>(logger_ptr);
+
+        std::string output{};
+        int64_t formatted_second = -1;
+        char timestamp[100];
+        uint64_t timestamp_size = 0;
+
+        auto flush = [&output]()
+        {
+            for(uint64_t offset = 0; offset < output.size();)
+            {
+                ssize_t nwritten = ::write(STDOUT_FILENO, output.data() + offset, output.size() - offset);
+                if(nwritten == -1)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+
+                    break; //nowhere left to report it
+                }
+                offset += nwritten;
+            }
+
+            output.clear();
+        };
+
+        while(true)
+        {
+            const bool stop = logger.stopping.load(); //anything logged before stop() was called is written in this pass
+            uint64_t written = 0;
+
+            for(log_ring_t* ring = logger.rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+            {
+                const uint64_t head = ring->head.load(std::memory_order_acquire);
+                const uint64_t first = ring->tail.load(std::memory_order_relaxed);
+
+                for(uint64_t tail = first; tail != head; ++tail)
+                {
+                    const log_record_t& record = ring->records[tail & (log_ring_capacity - 1)];
+                    if(record.time != formatted_second)
+                    {
+                        const time_t record_time = record.time;
+                        tm local_time{};
+                        timestamp_size = strftime(timestamp, sizeof(timestamp), "%a %Y-%m-%d %H:%M:%S %Z", localtime_r(&record_time, &local_time));
+                        formatted_second = record.time;
+                    }
+
+                    output.append(timestamp, timestamp_size);
+                    output.append(": ");
+                    output.append(log_level_names[static_cast<uint32_t>(record.level)]);
+                    output.append(": ");
+                    output.append(record.text, record.size);
+                    output.push_back('\n');
+                }
+
+                written += head - first;
+                ring->tail.store(head, std::memory_order_release); //the thread may reuse the records from here on
+
+                if(uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed); dropped != 0)
+                {
+                    fmt::format_to(std::back_inserter(output), "{}: warning: dropped {} log lines, the writer fell behind\n", std::string_view{timestamp, timestamp_size}, dropped);
+                }
+
+                if(output.size() >= 64 << 10)
+                {
+                    flush();
+                }
+            }
+
+            flush();
+
+            if(written != 0)
+            {
+                continue;
+            }
+
+            if(stop)
+            {
+                return nullptr;
+            }
+
+            pthread_mutex_lock(&logger.lock);
+            logger.sleeping.store(true);
+
+            timespec deadline{};
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100'000'000;
+            if(deadline.tv_nsec >= 1'000'000'000)
+            {
+                ++deadline.tv_sec;
+                deadline.tv_nsec -= 1'000'000'000;
+            }
+
+            if(!logger.stopping.load())
+            {
+                (void)pthread_cond_timedwait(&logger.wake_cond, &logger.lock, &deadline);
+            }
+
+            logger.sleeping.store(false);
+            pthread_mutex_unlock(&logger.lock);
+        }
+    }
+};
+
+inline logger_t logger{};
+
+//the arguments are only evaluated if the line is logged
+#define LOG_AT(line_level, message, ...) do { if(logger.enabled(line_level)) { logger.write(line_level, message __VA_OPT__(,) __VA_ARGS__); } } while(false)
+
+#define LOG_DEBUG(message, ...) LOG_AT(log_level_e::debug, message __VA_OPT__(,) __VA_ARGS__)
+#define LOG(message, ...) LOG_AT(log_level_e::info, message __VA_OPT__(,) __VA_ARGS__)
+#define LOG_WARNING(message, ...) LOG_AT(log_level_e::warning, message __VA_OPT__(,) __VA_ARGS__)
+#define LOG_ERROR(message, ...) LOG_AT(log_level_e::error, message __VA_OPT__(,) __VA_ARGS__)
@@ -1,9 +1,18 @@
 #include <cstdlib>
 #include <cstdint>
+#include <climits>
 #include <cerrno>
 #include <csignal>
 #include <pthread.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sched.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <vector>
@@ -11,499 +20,4004 @@
 #include <string>
 #include <array>
 #include <fmt/format.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <map>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
 #include <span>
+#include <bit>
+#include <tuple>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#include "uring.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "log.h"
+#include "audit.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "capture.h"
+
+//an encoded frame, shared by every connection it is queued on so a broadcast is only encoded once
+using shared_frame_t = std::shared_ptr<const std::vector<uint8_t>>;
+
+constexpr uint64_t max_outbound_queue_size = 8 << 20; //a client that falls this far behind is disconnected
+
+//frames waiting to be written to a client of the epoll backend. any thread may append and write, the owning reactor
+//finishes the write once the socket becomes writable again
+struct outbound_queue_t
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    std::deque<shared_frame_t> frames{};
+    uint64_t front_offset = 0; //bytes of the first frame already written
+    uint64_t queued_size = 0;
+    bool closed = false;
+};
+
+constexpr uint32_t initial_receive_buffer_size = 4 << 10;
+
+//set from the options before any client connects. max_frame_size is never larger than receive_budget
+uint32_t max_frame_size = 64 << 10; //a client announcing a larger frame is disconnected instead of buffered
+uint32_t receive_budget = 256 << 10; //most bytes a connection may hold while frames arrive
+
+//bytes received from a client that do not form a whole frame yet. frames are parsed where they were received and only an incomplete
+//one is moved to the front to make room. the buffer grows to fit a large frame, or while reads keep filling it, up to receive_budget
+//and shrinks back once it has drained, so a client that sends small frames never allocates past its first read
+struct receive_buffer_t
+{
+    uint8_t* data = nullptr;
+    uint32_t capacity = 0;
+    uint32_t begin = 0; //first byte not parsed yet
+    uint32_t end = 0;
+    bool filled = false; //the last read used all the free space, so more is probably waiting
+
+    receive_buffer_t() = default;
+    receive_buffer_t(const receive_buffer_t&) = delete;
+    receive_buffer_t& operator=(const receive_buffer_t&) = delete;
+
+    ~receive_buffer_t()
+    {
+        delete[] data;
+    }
+
+    bool empty() const
+    {
+        return begin == end;
+    }
+
+    std::span<uint8_t> pending()
+    {
+        return std::span<uint8_t>{data + begin, end - begin};
+    }
+
+    void commit(uint32_t size)
+    {
+        filled = size == capacity - end;
+        end += size;
+    }
+
+    void consume(uint64_t size)
+    {
+        begin += size;
+    }
+
+    //room for the next read. the frame at begin was checked against max_frame_size when it was parsed, so there always is some
+    std::span<uint8_t> free_space(uint32_t protocol_version)
+    {
+        uint32_t wanted = initial_receive_buffer_size;
+
+        uint32_t type = 0;
+        uint64_t payload_size = 0;
+        const int32_t header_size = decode_frame_header(data + begin, end - begin, protocol_version, &type, &payload_size);
+        if(header_size > 0) //an incomplete frame has to fit as a whole
+        {
+            wanted = std::max<uint64_t>(wanted, std::min<uint64_t>(header_size + payload_size, receive_budget));
+        }
+
+        if(filled)
+        {
+            wanted = std::max(wanted, capacity * 2);
+        }
+
+        wanted = std::min(wanted, receive_budget);
+
+        if(wanted > capacity || (empty() && wanted < capacity))
+        {
+            auto resized = new uint8_t[wanted];
+            if(!empty()) //data is still null before the first read
+            {
+                std::memcpy(resized, data + begin, end - begin);
+            }
+            delete[] data;
+
+            data = resized;
+            capacity = wanted;
+            end -= begin;
+            begin = 0;
+        }
+        else if(end == capacity || empty())
+        {
+            std::memmove(data, data + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
 
-#define LOG(message, ...) fmt::print("{}: " message "\n", timestamp_formatted() __VA_OPT__(,) __VA_ARGS__)
+        return std::span<uint8_t>{data + end, capacity - end};
+    }
+};
 
+//one per connection, allocated on accept and owned by the reactor serving it, which reaches it straight from its readiness or completion
+//events. other threads only see it through the registry and the subscription index while holding clients_lock
 struct client_t
 {
-    pthread_t listener = 0;
     int socket = 0;
+    uint32_t reactor = 0;
+    uint64_t registry_index = 0; //position in clients, so it can be removed without a search
+    uint32_t connection_id = 0; //numbered in the order clients were added, names the connection in a capture
     sockaddr_in address = {};
-    bool logged_in = false;
+    uint32_t protocol_version = 1; //written by the owning reactor with clients_lock held for writing
+    bool logged_in = false; //only touched by the owning reactor
+    bool subscribed = false; //clients that never subscribed are sent every change. written with clients_lock held for writing
+    outbound_queue_t* outbound = nullptr; //epoll backend only, freed when the client is removed
+    receive_buffer_t input{}; //epoll backend only, io_uring connections keep theirs on the connection
+};
+
+//memory a writer unlinked while readers without handlers_lock may still use it. a reader publishes the epoch it started in and
+//unlinked memory is freed once every reader that started before it was unlinked has finished
+struct read_reclaimer_t
+{
+    struct alignas(64) reader_t //one cache line each, readers never write to a line another reader uses
+    {
+        std::atomic<uint64_t> epoch{0}; //0 while not reading
+    };
+
+    struct retired_t
+    {
+        uint64_t epoch;
+        void* memory;
+        void (*destroy)(void*);
+    };
+
+    std::unique_ptr<reader_t[]> readers{};
+    uint32_t reader_count = 0;
+    std::atomic<uint64_t> epoch{1};
+    std::deque<retired_t> retired{}; //in epoch order, only touched by writers
+
+    void init(uint32_t count)
+    {
+        readers = std::make_unique<reader_t[]>(count);
+        reader_count = count;
+    }
+
+    void enter(uint32_t reader)
+    {
+        readers[reader].epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst); //pairs with the fence in retire, a writer either sees the reader or the reader sees the unlink
+    }
+
+    void leave(uint32_t reader)
+    {
+        readers[reader].epoch.store(0, std::memory_order_release);
+    }
+
+    //the memory must already be unlinked from everything readers can reach
+    void retire(void* memory, void (*destroy)(void*))
+    {
+        retired.push_back(retired_t{.epoch = epoch.fetch_add(1, std::memory_order_acq_rel), .memory = memory, .destroy = destroy});
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        uint64_t oldest_reader = UINT64_MAX;
+        for(uint32_t reader = 0; reader < reader_count; ++reader)
+        {
+            const uint64_t reader_epoch = readers[reader].epoch.load(std::memory_order_acquire);
+            if(reader_epoch != 0)
+            {
+                oldest_reader = std::min(oldest_reader, reader_epoch);
+            }
+        }
+
+        while(!retired.empty() && retired.front().epoch < oldest_reader)
+        {
+            retired.front().destroy(retired.front().memory);
+            retired.pop_front();
+        }
+    }
+};
+
+//an interned name, immutable once created so a reader that loaded a pointer to it can use it until it is reclaimed.
+//the characters follow the record
+struct interned_name_t
+{
+    uint32_t references; //only touched by writers
+    uint32_t size; //in char16_t
+    size_t hash;
+
+    std::u16string_view view() const
+    {
+        return std::u16string_view{reinterpret_cast<const char16_t*>(this + 1), size};
+    }
+};
+
+//names are interned so the same person assigned to many days is stored once and a slot is just a pointer to the shared record.
+//sets of an already known name allocate nothing. a record is freed once no slot refers to it and no reader can still see it
+struct handler_name_pool_t
+{
+    struct name_hash_t
+    {
+        using is_transparent = void;
+
+        size_t operator()(const interned_name_t* name) const { return name->hash; }
+        size_t operator()(std::u16string_view name) const { return std::hash<std::u16string_view>{}(name); }
+    };
+
+    struct name_equal_t
+    {
+        using is_transparent = void;
+
+        bool operator()(const interned_name_t* lhs, const interned_name_t* rhs) const { return lhs == rhs; }
+        bool operator()(std::u16string_view lhs, const interned_name_t* rhs) const { return lhs == rhs->view(); }
+        bool operator()(const interned_name_t* lhs, std::u16string_view rhs) const { return lhs->view() == rhs; }
+    };
+
+    std::unordered_set<interned_name_t*, name_hash_t, name_equal_t> index{}; //every live name
+    read_reclaimer_t* reclaimer = nullptr; //frees released names once readers are done, null frees them right away
+
+    handler_name_pool_t() = default;
+    handler_name_pool_t(const handler_name_pool_t&) = delete;
+
+    ~handler_name_pool_t()
+    {
+        for(interned_name_t* name : index)
+        {
+            destroy(name);
+        }
+    }
+
+    static void destroy(void* name)
+    {
+        ::operator delete(name);
+    }
+
+    //returns the name with one more reference to it, the empty name is null and never counted
+    const interned_name_t* intern(std::u16string_view name)
+    {
+        if(name.empty())
+        {
+            return nullptr;
+        }
+
+        if(auto found = index.find(name); found != index.end())
+        {
+            ++(*found)->references;
+            return *found;
+        }
+
+        auto interned = static_cast<interned_name_t*>(::operator new(sizeof(interned_name_t) + (name.size() * sizeof(char16_t))));
+        *interned = interned_name_t{.references = 1, .size = static_cast<uint32_t>(name.size()), .hash = std::hash<std::u16string_view>{}(name)};
+        std::memcpy(interned + 1, name.data(), name.size() * sizeof(char16_t));
+
+        index.insert(interned);
+        return interned;
+    }
+
+    //the name must no longer be reachable from any slot
+    void release(const interned_name_t* name)
+    {
+        if(name == nullptr || --const_cast<interned_name_t*>(name)->references != 0)
+        {
+            return;
+        }
+
+        auto released = const_cast<interned_name_t*>(name);
+        index.erase(released);
+
+        if(reclaimer != nullptr)
+        {
+            reclaimer->retire(released, &destroy);
+        }
+        else
+        {
+            destroy(released);
+        }
+    }
+};
+
+inline std::u16string_view name_view(const interned_name_t* name)
+{
+    return name != nullptr ? name->view() : std::u16string_view{};
+}
+
+//every handler of one year indexed by [day_of_year][id], a null name means nobody is assigned.
+//writers hold handlers_lock, readers may load the slots without it
+struct handler_year_t
+{
+    uint32_t year = 0;
+    std::array<std::array<std::atomic<const interned_name_t*>, handler_id_count>, max_day_of_year + 1> names{};
+    std::array<std::array<std::atomic<uint32_t>, handler_id_count>, max_day_of_year + 1> versions{}; //bumped by one on every change
+
+    //the version is loaded before the name, so the name is never older than the version it is returned with
+    std::pair<uint32_t, std::u16string_view> read(uint16_t day, uint16_t id) const
+    {
+        const uint32_t version = versions[day][id].load(std::memory_order_acquire);
+        return {version, name_view(names[day][id].load(std::memory_order_acquire))};
+    }
+};
+
+//the keys are a small dense space per year, so each year is one contiguous block allocated when the first handler of it is set.
+//blocks are never freed while serving. readers find them through an immutable sorted copy of the year list that is replaced
+//when a year is added
+struct handler_table_t
+{
+    std::vector<std::unique_ptr<handler_year_t>> years{}; //sorted by year, only used by writers
+    std::atomic<const std::vector<const handler_year_t*>*> published_years{nullptr};
+    handler_name_pool_t names{};
+    std::atomic<uint64_t> named_count{0}; //handlers with a name, kept up to date by set so a scrape does not have to count them
+
+    handler_table_t() = default;
+    handler_table_t(const handler_table_t&) = delete;
+
+    ~handler_table_t()
+    {
+        delete published_years.load(std::memory_order_relaxed);
+    }
+
+    static bool valid_key(handler_key_t key)
+    {
+        return key.id < handler_id_count && key.day_of_year <= max_day_of_year;
+    }
+
+    static void destroy_year_list(void* year_list)
+    {
+        delete static_cast<const std::vector<const handler_year_t*>*>(year_list);
+    }
+
+    void publish_years()
+    {
+        auto year_list = new std::vector<const handler_year_t*>{};
+        year_list->reserve(years.size());
+        for(const std::unique_ptr<handler_year_t>& year : years)
+        {
+            year_list->push_back(year.get());
+        }
+
+        const std::vector<const handler_year_t*>* previous = published_years.exchange(year_list, std::memory_order_acq_rel);
+        if(previous != nullptr && names.reclaimer != nullptr)
+        {
+            names.reclaimer->retire(const_cast<std::vector<const handler_year_t*>*>(previous), &destroy_year_list);
+        }
+        else
+        {
+            delete previous;
+        }
+    }
+
+    handler_year_t* find_year(uint32_t year) const
+    {
+        auto found = std::lower_bound(years.begin(), years.end(), year, [](const std::unique_ptr<handler_year_t>& entry, uint32_t year)
+        {
+            return entry->year < year;
+        });
+
+        return found != years.end() && (*found)->year == year ? found->get() : nullptr;
+    }
+
+    //usable without handlers_lock between read_reclaimer_t::enter and leave
+    const handler_year_t* find_published_year(uint32_t year) const
+    {
+        const std::vector<const handler_year_t*>* year_list = published_years.load(std::memory_order_acquire);
+        if(year_list == nullptr)
+        {
+            return nullptr;
+        }
+
+        auto found = std::lower_bound(year_list->begin(), year_list->end(), year, [](const handler_year_t* entry, uint32_t year)
+        {
+            return entry->year < year;
+        });
+
+        return found != year_list->end() && (*found)->year == year ? *found : nullptr;
+    }
+
+    handler_year_t& get_year(uint32_t year)
+    {
+        auto found = std::lower_bound(years.begin(), years.end(), year, [](const std::unique_ptr<handler_year_t>& entry, uint32_t year)
+        {
+            return entry->year < year;
+        });
+
+        if(found == years.end() || (*found)->year != year)
+        {
+            found = years.insert(found, std::make_unique<handler_year_t>());
+            (*found)->year = year;
+            handler_year_t& inserted = **found;
+            publish_years();
+            return inserted;
+        }
+
+        return **found;
+    }
+
+    //the key must be valid. returns an empty name for keys that were never set
+    std::u16string_view find(handler_key_t key) const
+    {
+        const handler_year_t* year = find_year(key.year);
+        return year != nullptr ? name_view(year->names[key.day_of_year][key.id].load(std::memory_order_relaxed)) : std::u16string_view{};
+    }
+
+    //the key must be valid
+    uint32_t version(handler_key_t key) const
+    {
+        const handler_year_t* year = find_year(key.year);
+        return year != nullptr ? year->versions[key.day_of_year][key.id].load(std::memory_order_relaxed) : 0;
+    }
+
+    //the key must be valid. version 0 bumps the current version, anything else restores a logged one
+    void set(handler_key_t key, std::u16string_view name, uint32_t version = 0)
+    {
+        handler_year_t& year = get_year(key.year);
+        std::atomic<uint32_t>& current_version = year.versions[key.day_of_year][key.id];
+        std::atomic<const interned_name_t*>& slot = year.names[key.day_of_year][key.id];
+
+        const interned_name_t* previous_name = slot.load(std::memory_order_relaxed);
+        const interned_name_t* interned = names.intern(name);
+        slot.store(interned, std::memory_order_release); //interned before the release so setting the same name again never frees it
+        current_version.store(version != 0 ? version : current_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+        if(previous_name == nullptr && interned != nullptr)
+        {
+            named_count.store(named_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        else if(previous_name != nullptr && interned == nullptr)
+        {
+            named_count.store(named_count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+
+        names.release(previous_name);
+    }
+
+    //takes over the years of other, which must not overlap with the years already in the table
+    void merge(handler_table_t& other)
+    {
+        for(std::unique_ptr<handler_year_t>& year : other.years)
+        {
+            for(auto& day : year->names)
+            {
+                for(std::atomic<const interned_name_t*>& slot : day)
+                {
+                    slot.store(names.intern(name_view(slot.load(std::memory_order_relaxed))), std::memory_order_relaxed);
+                }
+            }
+
+            auto position = std::lower_bound(years.begin(), years.end(), year->year, [](const std::unique_ptr<handler_year_t>& entry, uint32_t year)
+            {
+                return entry->year < year;
+            });
+            years.insert(position, std::move(year));
+        }
+
+        other.years.clear();
+        named_count.store(named_count.load(std::memory_order_relaxed) + other.named_count.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        publish_years();
+    }
+
+    //calls on_handler(key, version, name) in key order for every handler that was ever set, cleared ones included so their version is kept
+    template<typename F>
+    void for_each(F on_handler) const
+    {
+        for(const std::unique_ptr<handler_year_t>& year : years)
+        {
+            for(uint16_t day = 0; day <= max_day_of_year; ++day)
+            {
+                for(uint16_t id = 0; id < handler_id_count; ++id)
+                {
+                    const uint32_t version = year->versions[day][id].load(std::memory_order_relaxed);
+                    if(version != 0)
+                    {
+                        const handler_key_t key{.id = static_cast<handler_id_t>(id), .day_of_year = day, .year = year->year};
+                        on_handler(key, version, name_view(year->names[day][id].load(std::memory_order_relaxed)));
+                    }
+                }
+            }
+        }
+    }
 };
 
-enum handler_id_t : uint16_t
+constexpr uint64_t change_log_capacity = 16384; //must be a power of 2
+
+//the keys of the most recent changes in the order they were made. a reconnecting client is sent the current value of every key it
+//views that changed since its sync point, or its whole view if the point is older than the log reaches back
+struct change_log_t
 {
-    pasture = 0b00,
-    stable_in = 0b01,
-    stable_out = 0b10
+    uint64_t epoch = 0;
+    uint64_t next_sequence = 0;
+    std::vector<uint64_t> keys = std::vector<uint64_t>(change_log_capacity);
+
+    void record(handler_key_t key)
+    {
+        keys[next_sequence & (change_log_capacity - 1)] = std::bit_cast<uint64_t>(key);
+        ++next_sequence;
+    }
+
+    sync_point_t sync_point() const
+    {
+        return sync_point_t{.epoch = epoch, .sequence = next_sequence};
+    }
+
+    bool reaches_back_to(const sync_point_t& point) const
+    {
+        return point.epoch == epoch && point.sequence <= next_sequence && next_sequence - point.sequence <= change_log_capacity;
+    }
+
+    //calls on_change(key) for every change made since the point, which the log must reach back to
+    template<typename F>
+    void for_each_since(const sync_point_t& point, F on_change) const
+    {
+        for(uint64_t sequence = point.sequence; sequence < next_sequence; ++sequence)
+        {
+            on_change(std::bit_cast<handler_key_t>(keys[sequence & (change_log_capacity - 1)]));
+        }
+    }
 };
 
-std::string handler_id2string(handler_id_t handler_id)
+constexpr uint32_t max_client_subscriptions = 64;
+
+//the days every client is viewing, so a set is only broadcast to the clients that display it. a year has so few days that the
+//interval index simply buckets a range on every day it covers, subscribing costs one entry per day and a set looks up one bucket
+struct subscription_index_t
 {
-    switch(handler_id)
+    struct subscriber_t
+    {
+        const client_t* client;
+        std::array<uint16_t, handler_id_count> range_counts; //how many of the clients ranges cover the day for each id
+    };
+
+    struct year_subscribers_t
+    {
+        std::array<std::vector<subscriber_t>, max_day_of_year + 1> days{};
+        uint64_t subscriber_count = 0; //entries over all days, the year is dropped once nobody views it
+    };
+
+    std::unordered_map<uint32_t, std::unique_ptr<year_subscribers_t>> years{};
+    std::unordered_map<int, std::vector<handler_range_t>> client_ranges{}; //everything a client subscribed to, dropped when it goes away
+
+    //returns false if the client already has as many ranges as it may subscribe to
+    bool subscribe(const client_t* client, const handler_range_t& range)
+    {
+        std::vector<handler_range_t>& ranges = client_ranges[client->socket];
+        if(ranges.size() >= max_client_subscriptions)
+        {
+            return false;
+        }
+
+        std::unique_ptr<year_subscribers_t>& year = years[range.year];
+        if(year == nullptr)
+        {
+            year = std::make_unique<year_subscribers_t>();
+        }
+
+        for(uint32_t day = range.first_day_of_year; day < range.end_day_of_year(); ++day)
+        {
+            std::vector<subscriber_t>& subscribers = year->days[day];
+
+            auto subscriber = std::find_if(subscribers.begin(), subscribers.end(), [client](const subscriber_t& subscriber){ return subscriber.client == client; });
+            if(subscriber == subscribers.end()) //overlapping ranges share one entry, a client is never sent the same frame twice
+            {
+                subscriber = subscribers.insert(subscribers.end(), subscriber_t{.client = client, .range_counts = {}});
+                ++year->subscriber_count;
+            }
+
+            for(uint16_t id = 0; id < handler_id_count; ++id)
+            {
+                subscriber->range_counts[id] += (range.id_mask >> id) & 1;
+            }
+        }
+
+        ranges.push_back(range);
+        return true;
+    }
+
+    //only a range the client subscribed to can be unsubscribed
+    void unsubscribe(int socket, const handler_range_t& range)
     {
-        case handler_id_t::pasture: return "pasture";
-        case handler_id_t::stable_in: return "stable_in";
-        case handler_id_t::stable_out: return "stable_out";
-        default: return "invalid value";
+        auto ranges = client_ranges.find(socket);
+        if(ranges == client_ranges.end())
+        {
+            return;
+        }
+
+        auto subscribed_range = std::find(ranges->second.begin(), ranges->second.end(), range);
+        if(subscribed_range == ranges->second.end())
+        {
+            return;
+        }
+
+        ranges->second.erase(subscribed_range);
+        if(ranges->second.empty())
+        {
+            client_ranges.erase(ranges);
+        }
+
+        auto year = years.find(range.year);
+        for(uint32_t day = range.first_day_of_year; day < range.end_day_of_year(); ++day)
+        {
+            std::vector<subscriber_t>& subscribers = year->second->days[day];
+
+            auto subscriber = std::find_if(subscribers.begin(), subscribers.end(), [socket](const subscriber_t& subscriber){ return subscriber.client->socket == socket; });
+            for(uint16_t id = 0; id < handler_id_count; ++id)
+            {
+                subscriber->range_counts[id] -= (range.id_mask >> id) & 1;
+            }
+
+            if(subscriber->range_counts == decltype(subscriber->range_counts){})
+            {
+                *subscriber = subscribers.back();
+                subscribers.pop_back();
+                --year->second->subscriber_count;
+            }
+        }
+
+        erase_if_unviewed(year);
+    }
+
+    void remove_client(int socket)
+    {
+        auto ranges = client_ranges.find(socket);
+        if(ranges == client_ranges.end())
+        {
+            return;
+        }
+
+        for(const handler_range_t& range : ranges->second)
+        {
+            auto year = years.find(range.year);
+            if(year == years.end()) //an earlier range of the same year already emptied it
+            {
+                continue;
+            }
+
+            for(uint32_t day = range.first_day_of_year; day < range.end_day_of_year(); ++day)
+            {
+                year->second->subscriber_count -= std::erase_if(year->second->days[day], [socket](const subscriber_t& subscriber){ return subscriber.client->socket == socket; });
+            }
+
+            erase_if_unviewed(year);
+        }
+
+        client_ranges.erase(ranges);
+    }
+
+    void erase_if_unviewed(decltype(years)::iterator year)
+    {
+        if(year->second->subscriber_count == 0)
+        {
+            years.erase(year);
+        }
+    }
+
+    //calls on_subscriber(client) for every client viewing the key
+    template<typename F>
+    void for_each_subscriber(handler_key_t key, F on_subscriber) const
+    {
+        auto year = years.find(key.year);
+        if(year == years.end())
+        {
+            return;
+        }
+
+        for(const subscriber_t& subscriber : year->second->days[key.day_of_year])
+        {
+            if(subscriber.range_counts[key.id] != 0)
+            {
+                on_subscriber(*subscriber.client);
+            }
+        }
+    }
+};
+
+enum class io_backend_e : uint32_t
+{
+    epoll = 0,
+    uring
+};
+
+constexpr uint32_t uring_queue_depth = 1024;
+constexpr uint32_t uring_recv_buffer_count = 256; //must be a power of 2
+constexpr uint32_t uring_recv_buffer_size = 2048;
+constexpr uint32_t uring_send_slot_count = 256;
+constexpr uint32_t uring_send_slot_size = 4096;
+
+enum class uring_operation_e : uint64_t
+{
+    accept = 0,
+    recv,
+    write,
+    wake
+};
+
+struct uring_connection_t
+{
+    int socket = -1;
+    client_t* client = nullptr; //null once the connection is closing
+    receive_buffer_t input{}; //start of a message that has not fully arrived yet
+    std::vector<uint8_t> queued_output{}; //frames waiting for the write in flight to complete, from queued_offset on
+    uint64_t queued_offset = 0; //bytes at the front already copied into a send slot
+    std::vector<uint8_t> unregistered_output{}; //bytes in flight when no registered send slot was free
+    int32_t send_slot = -1;
+    uint32_t write_offset = 0;
+    uint32_t write_size = 0;
+    bool writing = false;
+    bool closed = false;
+    bool shut_down = false; //sent a frame over max_frame_size or stopped reading, nothing is received or queued until it closes
+
+    uint64_t queued_size() const
+    {
+        return queued_output.size() - queued_offset;
+    }
+
+    //the rest is only moved to the front once at least half the buffer was sent, so a long queue drains in linear time
+    void consume_queued(uint64_t size)
+    {
+        queued_offset += size;
+        if(queued_offset == queued_output.size())
+        {
+            queued_output.clear();
+            queued_offset = 0;
+        }
+        else if(queued_offset >= queued_output.size() / 2)
+        {
+            queued_output.erase(queued_output.begin(), queued_output.begin() + queued_offset);
+            queued_offset = 0;
+        }
+    }
+
+    void discard_queued()
+    {
+        queued_output.clear();
+        queued_offset = 0;
+    }
+};
+
+struct uring_outbox_record_t
+{
+    int socket;
+    shared_frame_t frame;
+};
+
+//state owned by one reactor thread, except for the outbox which other reactors append to
+struct uring_reactor_t
+{
+    uring_t ring{};
+    io_uring_buf_ring* recv_buffer_ring = nullptr;
+    uint8_t* recv_buffer_memory = nullptr;
+    uint8_t* send_slot_memory = nullptr;
+    std::vector<uint32_t> free_send_slots{};
+    std::unordered_map<int, uring_connection_t*> connections{};
+
+    int wake_event = -1;
+    uint64_t wake_value = 0;
+
+    pthread_mutex_t outbox_lock = PTHREAD_MUTEX_INITIALIZER;
+    std::vector<uring_outbox_record_t> outbox{};
+    std::vector<uring_outbox_record_t> draining_outbox{};
+};
+
+struct reactor_t
+{
+    pthread_t thread = 0;
+    uint32_t index = 0;
+    int server_socket = -1; //shared by every reactor unless accepts are sharded
+    int epoll = -1;
+    uring_reactor_t* uring = nullptr;
+};
+
+struct server_options_t
+{
+    uint16_t port = 0;
+    uint32_t reactor_count = 0;
+    io_backend_e io_backend = io_backend_e::epoll;
+    const char* data_directory = ".";
+    uint32_t snapshot_interval = 600; //seconds, 0 disables snapshots
+    uint32_t coalesce_window = 250; //milliseconds, 0 broadcasts every set immediately. sets are always logged immediately
+    uint32_t max_frame_size = 64 << 10; //bytes
+    uint32_t receive_budget = 256 << 10; //bytes per connection
+    log_level_e log_level = log_level_e::info;
+    uint16_t metrics_port = 0; //0 disables the metrics endpoint
+    const char* capture_path = nullptr; //records every inbound frame for stall_replay when set
+    int backlog = SOMAXCONN;
+    bool shard_accept = false;
+    bool pin_cpus = false;
+};
+
+volatile sig_atomic_t shutdown_server = 0;
+std::vector<int> server_sockets{};
+
+io_backend_e io_backend = io_backend_e::epoll;
+std::vector<reactor_t> reactors{};
+thread_local reactor_t* current_reactor = nullptr;
+
+std::vector<client_t*> clients{}; //every connected client, only for the senders that have to visit all of them
+pthread_rwlock_t clients_lock{};
+subscription_index_t handler_subscriptions{}; //guarded by clients_lock
+
+handler_table_t handlers{};
+pthread_rwlock_t handlers_lock{}; //taken by writers and by readers that need several keys to be consistent with each other
+read_reclaimer_t handler_readers{}; //lets the reactors read handlers without handlers_lock, one reader per reactor
+change_log_t handler_change_log{}; //guarded by handlers_lock
+wal_t handlers_wal{};
+audit_log_t handler_audit{}; //who made every change, appended under handlers_lock
+capture_writer_t traffic_capture{}; //every inbound frame, only written with --capture
+uint32_t next_connection_id = 0; //guarded by clients_lock
+uint64_t handlers_wal_generation = 0; //the log file currently appended to, only changed by the snapshot thread after startup
+const char* current_data_directory = ".";
+
+int64_t realtime_nanoseconds()
+{
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1'000'000'000ll + now.tv_nsec;
+}
+
+constexpr std::string_view client_message_type_names[] = {"login", "get_handler", "set_handler", "get_handler_range", "subscribe_handlers",
+    "unsubscribe_handlers", "edit_handler", "resync_handlers", "negotiate_protocol", "invalid"};
+
+enum class message_stage_e : uint32_t
+{
+    queued = 0, //from the recv that completed the frame until it is dispatched
+    handler, //the handler itself, sends included
+    send, //the part of the handler spent queueing and writing frames
+    max
+};
+
+enum class lock_metric_e : uint32_t
+{
+    handlers_read = 0,
+    handlers_write,
+    clients_read,
+    clients_write,
+    max
+};
+
+bool metrics_enabled = false;
+
+//every thread records into its own block, so the hot path never writes a cache line another thread writes. a scrape adds them up
+struct alignas(64) thread_metrics_t
+{
+    histogram_t message_latency[static_cast<uint32_t>(client_message_type_e::max) + 1][static_cast<uint32_t>(message_stage_e::max)]{}; //the last row counts invalid types
+    histogram_t broadcast_fan_out{};
+    histogram_t lock_wait[static_cast<uint32_t>(lock_metric_e::max)]{};
+    uint64_t send_nanoseconds = 0; //spent in send_frame since the current message was dispatched
+    thread_metrics_t* next = nullptr;
+};
+
+std::atomic<thread_metrics_t*> all_thread_metrics{nullptr}; //never freed, a thread that exits leaves its totals behind
+
+thread_metrics_t& local_metrics()
+{
+    thread_local thread_metrics_t* metrics = nullptr;
+    if(metrics == nullptr)
+    {
+        metrics = new thread_metrics_t{};
+        metrics->next = all_thread_metrics.load(std::memory_order_relaxed);
+        while(!all_thread_metrics.compare_exchange_weak(metrics->next, metrics, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    return *metrics;
+}
+
+//an uncontended lock is taken without reading the clock and counts as no wait at all
+void timed_rdlock(pthread_rwlock_t* lock, lock_metric_e metric)
+{
+    if(!metrics_enabled)
+    {
+        pthread_rwlock_rdlock(lock);
+        return;
+    }
+
+    if(pthread_rwlock_tryrdlock(lock) == 0)
+    {
+        local_metrics().lock_wait[static_cast<uint32_t>(metric)].record(0);
+        return;
+    }
+
+    const uint64_t start = monotonic_nanoseconds();
+    pthread_rwlock_rdlock(lock);
+    local_metrics().lock_wait[static_cast<uint32_t>(metric)].record(monotonic_nanoseconds() - start);
+}
+
+void timed_wrlock(pthread_rwlock_t* lock, lock_metric_e metric)
+{
+    if(!metrics_enabled)
+    {
+        pthread_rwlock_wrlock(lock);
+        return;
+    }
+
+    if(pthread_rwlock_trywrlock(lock) == 0)
+    {
+        local_metrics().lock_wait[static_cast<uint32_t>(metric)].record(0);
+        return;
+    }
+
+    const uint64_t start = monotonic_nanoseconds();
+    pthread_rwlock_wrlock(lock);
+    local_metrics().lock_wait[static_cast<uint32_t>(metric)].record(monotonic_nanoseconds() - start);
+}
+
+struct server_message_t
+{
+    std::vector<uint8_t> message_buffer{};
+
+    server_message_t(server_message_type_e message_type, uint32_t data_size)
+    {
+        message_buffer.resize(8 + data_size);
+        reinterpret_cast<uint32_t&>(message_buffer[0]) = static_cast<uint32_t>(message_type);
+        reinterpret_cast<uint32_t&>(message_buffer[4]) = data_size;
+    }
+
+    uint8_t* message_data()
+    {
+        return message_buffer.data() + 8;
+    }
+};
+
+std::string address2string(sockaddr_in address)
+{
+    return fmt::format("{}:{}", inet_ntoa(address.sin_addr), address.sin_port);
+}
+
+std::string cvt_str16_to_str8(std::u16string_view str)
+{
+    std::string converted{};
+    converted.resize(str.size());
+
+    for(uint64_t index = 0; index < str.size(); ++index)
+    {
+        converted[index] = str[index] > 128 ? '?' : static_cast<char>(str[index]);
+    }
+
+    return converted;
+}
+
+void sigterm_handler(int, siginfo_t*, void*)
+{
+    shutdown_server = 1;
+}
+
+void close_server_sockets()
+{
+    for(int server_socket : server_sockets)
+    {
+        if(shutdown(server_socket, SHUT_RDWR) == -1)
+        {
+            perror("shutdown");
+        }
+
+        if(close(server_socket) == -1)
+        {
+            perror("close");
+        }
+    }
+}
+
+void close_handlers_wal()
+{
+    handlers_wal.close();
+}
+
+void close_handler_audit()
+{
+    handler_audit.close();
+}
+
+void close_traffic_capture()
+{
+    traffic_capture.close();
+}
+
+void disconnect_clients()
+{
+    timed_wrlock(&clients_lock, lock_metric_e::clients_write);
+    for(const client_t* client : clients)
+    {
+        if(shutdown(client->socket, SHUT_RDWR) == -1)
+        {
+            perror("shutdown");
+        }
+    }
+    pthread_rwlock_unlock(&clients_lock);
+
+    while(true)
+    {
+        timed_rdlock(&clients_lock, lock_metric_e::clients_read);
+        const uint64_t remaining = clients.size();
+        pthread_rwlock_unlock(&clients_lock);
+
+        if(remaining == 0)
+        {
+            break;
+        }
+
+        sched_yield();
+    }
+}
+
+//frames carrying several handlers start with an entry count, then a handler_entry_t and the name for every handler
+void append_handler_entry(std::vector<uint8_t>* buffer, handler_key_t key, uint32_t version, std::u16string_view handler_name)
+{
+    const handler_entry_t entry{.key = key, .version = version, .name_size = static_cast<uint32_t>(handler_name.size() * 2)};
+    auto entry_bytes = reinterpret_cast<const uint8_t*>(&entry);
+    auto name_bytes = reinterpret_cast<const uint8_t*>(handler_name.data());
+
+    buffer->insert(buffer->end(), entry_bytes, entry_bytes + sizeof(entry));
+    buffer->insert(buffer->end(), name_bytes, name_bytes + entry.name_size);
+}
+
+//the message must have been created with room for the entry count only
+void finish_handler_entries(server_message_t* message, uint32_t entry_count)
+{
+    reinterpret_cast<uint32_t&>(message->message_buffer[4]) = message->message_buffer.size() - 8;
+    std::memcpy(message->message_data(), &entry_count, sizeof(entry_count));
+}
+
+shared_frame_t share_frame(server_message_t&& message)
+{
+    return std::make_shared<const std::vector<uint8_t>>(std::move(message.message_buffer));
+}
+
+//writes as much of the queue as the socket takes without blocking, called with the queue locked.
+//a write that would block is finished by the owning reactor on the next EPOLLOUT edge
+void flush_outbound_queue(int socket, outbound_queue_t* queue)
+{
+    while(!queue->frames.empty())
+    {
+        iovec parts[64];
+        uint32_t part_count = 0;
+
+        for(auto frame = queue->frames.begin(); frame != queue->frames.end() && part_count < std::size(parts); ++frame, ++part_count)
+        {
+            const uint64_t offset = part_count == 0 ? queue->front_offset : 0;
+            parts[part_count] = iovec{.iov_base = const_cast<uint8_t*>((*frame)->data()) + offset, .iov_len = (*frame)->size() - offset};
+        }
+
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = part_count;
+
+        ssize_t nsent = sendmsg(socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT); //writev that does not raise SIGPIPE
+        if(nsent == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            if(errno != EAGAIN && errno != EWOULDBLOCK) //the receive side notices the broken connection and removes the client
+            {
+                queue->frames.clear();
+                queue->front_offset = 0;
+                queue->queued_size = 0;
+            }
+
+            return;
+        }
+
+        queue->queued_size -= nsent;
+
+        for(uint64_t remaining = nsent; remaining > 0;)
+        {
+            const uint64_t front_remaining = queue->frames.front()->size() - queue->front_offset;
+            if(remaining < front_remaining)
+            {
+                queue->front_offset += remaining;
+                break;
+            }
+
+            remaining -= front_remaining;
+            queue->front_offset = 0;
+            queue->frames.pop_front();
+        }
+    }
+}
+
+//between begin_broadcast and finish_broadcast frames are only queued, the writes and wake ups they need are collected here and done
+//once handlers_lock was released
+thread_local bool deferring_writes = false;
+thread_local std::vector<const client_t*> deferred_writes{};
+thread_local std::vector<uring_reactor_t*> deferred_wakes{};
+
+void epoll_send_frame(const client_t& client, const shared_frame_t& frame)
+{
+    outbound_queue_t* queue = client.outbound;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if(!queue->closed)
+    {
+        queue->frames.push_back(frame);
+        queue->queued_size += frame->size();
+
+        if(queue->frames.size() == 1 && deferring_writes)
+        {
+            deferred_writes.push_back(&client);
+        }
+        else if(queue->frames.size() == 1) //otherwise an earlier write is waiting for the socket to become writable
+        {
+            flush_outbound_queue(client.socket, queue);
+        }
+
+        if(queue->queued_size > max_outbound_queue_size)
+        {
+            LOG_WARNING("client: {}. is not reading, disconnecting it", address2string(client.address));
+
+            queue->frames.clear();
+            queue->queued_size = 0;
+            queue->closed = true;
+            (void)shutdown(client.socket, SHUT_RDWR); //the owning reactor sees the hang up and removes the client
+        }
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void uring_send_frame(const client_t& client, const shared_frame_t& frame);
+
+//handlers build every frame in version 1, frames for a version 2 client are encoded again from it right before they are sent
+shared_frame_t encode_v2_frame(const shared_frame_t& frame)
+{
+    const auto header = read_unaligned<frame_header_t>(frame->data());
+    const uint8_t* data = frame->data() + frame_header_size;
+
+    thread_local std::vector<uint8_t> payload{};
+    thread_local std::u16string name{};
+    payload.clear();
+
+    auto append_entries = [data](uint64_t offset, uint32_t entry_count)
+    {
+        for(uint32_t entry_index = 0; entry_index < entry_count; ++entry_index)
+        {
+            const auto entry = read_unaligned<handler_entry_t>(data + offset);
+            append_v2_handler_entry(&payload, entry.key, entry.version, read_utf16(data + offset + sizeof(entry), entry.name_size / 2, &name));
+            offset += sizeof(entry) + entry.name_size;
+        }
+    };
+
+    switch(static_cast<server_message_type_e>(header.type))
+    {
+        case server_message_type_e::login_response:
+            payload.push_back(data[0]);
+            append_v2_sync_point(&payload, read_unaligned<sync_point_t>(data + 1));
+            break;
+        case server_message_type_e::sent_handler_name:
+            append_varint(&payload, pack_handler_key(read_unaligned<handler_key_t>(data)));
+            append_utf8(&payload, read_utf16(data + sizeof(handler_key_t), ((header.size - sizeof(handler_key_t)) / 2) - 1, &name)); //without the null terminator
+            break;
+        case server_message_type_e::sent_handler_range:
+        case server_message_type_e::sent_handler_updates:
+        {
+            const auto entry_count = read_unaligned<uint32_t>(data);
+            append_varint(&payload, entry_count);
+            append_entries(sizeof(uint32_t), entry_count);
+            break;
+        }
+        case server_message_type_e::sent_handler_changes:
+        {
+            const auto entry_count = read_unaligned<uint32_t>(data + sizeof(sync_point_t));
+            append_v2_sync_point(&payload, read_unaligned<sync_point_t>(data));
+            append_varint(&payload, entry_count);
+            append_entries(sizeof(sync_point_t) + sizeof(uint32_t), entry_count);
+            break;
+        }
+        case server_message_type_e::edited_handler:
+        {
+            const auto edit = read_unaligned<handler_edit_t>(data);
+            append_varint(&payload, pack_handler_key(edit.key));
+            append_varint(&payload, edit.base_version);
+            append_varint(&payload, edit.position);
+            append_varint(&payload, edit.delete_count);
+            append_utf8(&payload, read_utf16(data + sizeof(handler_edit_t), (header.size - sizeof(handler_edit_t)) / 2, &name));
+            break;
+        }
+        case server_message_type_e::edit_acknowledged:
+            append_varint(&payload, pack_handler_key(read_unaligned<handler_key_t>(data)));
+            append_varint(&payload, read_unaligned<uint32_t>(data + sizeof(handler_key_t)));
+            break;
+        case server_message_type_e::edit_rebased:
+            append_entries(0, 1);
+            break;
+        case server_message_type_e::handlers_not_modified:
+            append_v2_range(&payload, read_unaligned<handler_range_t>(data));
+            break;
+        default:
+            payload.insert(payload.end(), data, data + header.size);
+            break;
+    }
+
+    auto encoded = std::make_shared<std::vector<uint8_t>>();
+    encoded->reserve((2 * max_varint_size) + payload.size());
+    append_v2_frame_header(encoded.get(), header.type, payload.size());
+    encoded->insert(encoded->end(), payload.begin(), payload.end());
+
+    return encoded;
+}
+
+//never waits for the client, frames that do not fit in the socket are queued on the connection. the frame must already be in the
+//version the client speaks. replies are sent from the reactor that owns the client, every other sender must hold clients_lock
+void send_encoded_frame(const client_t& client, const shared_frame_t& frame)
+{
+    const uint64_t start = metrics_enabled ? monotonic_nanoseconds() : 0;
+
+    if(io_backend == io_backend_e::uring)
+    {
+        uring_send_frame(client, frame);
+    }
+    else
+    {
+        epoll_send_frame(client, frame);
+    }
+
+    if(metrics_enabled)
+    {
+        local_metrics().send_nanoseconds += monotonic_nanoseconds() - start;
+    }
+}
+
+//sends a frame built in version 1 to a client of either version
+void send_frame(const client_t& client, const shared_frame_t& frame)
+{
+    send_encoded_frame(client, client.protocol_version == 1 ? frame : encode_v2_frame(frame));
+}
+
+//frames sent until finish_broadcast are only queued. called with handlers_lock held, so clients receive the changes of a key in the
+//order they were applied no matter which thread broadcasts them
+void begin_broadcast()
+{
+    timed_rdlock(&clients_lock, lock_metric_e::clients_read);
+    deferring_writes = true;
+}
+
+//writes what was queued since begin_broadcast, called once handlers_lock was released so other writers never wait on a socket.
+//clients_lock is held until the writes are done, so none of the clients can be removed meanwhile
+void finish_broadcast()
+{
+    deferring_writes = false;
+
+    const uint64_t start = metrics_enabled ? monotonic_nanoseconds() : 0;
+
+    for(const client_t* client : deferred_writes)
+    {
+        pthread_mutex_lock(&client->outbound->lock);
+        flush_outbound_queue(client->socket, client->outbound);
+        pthread_mutex_unlock(&client->outbound->lock);
+    }
+
+    for(uring_reactor_t* reactor : deferred_wakes)
+    {
+        (void)eventfd_write(reactor->wake_event, 1);
+    }
+
+    deferred_writes.clear();
+    deferred_wakes.clear();
+
+    if(metrics_enabled)
+    {
+        local_metrics().send_nanoseconds += monotonic_nanoseconds() - start;
+    }
+
+    pthread_rwlock_unlock(&clients_lock);
+}
+
+//a frame broadcast to many clients, the version 2 form is encoded once for the first client that speaks it.
+//recipients are visited by one thread at a time
+struct broadcast_frame_t
+{
+    shared_frame_t frame{};
+    mutable shared_frame_t frame_v2{};
+
+    void send(const client_t& client) const
+    {
+        if(client.protocol_version == 1)
+        {
+            send_encoded_frame(client, frame);
+            return;
+        }
+
+        if(frame_v2 == nullptr)
+        {
+            frame_v2 = encode_v2_frame(frame);
+        }
+        send_encoded_frame(client, frame_v2);
+    }
+};
+
+void on_invalid_message(std::span<uint8_t> message, const client_t& sender)
+{
+    LOG_WARNING("recieved invalid message {}. from: {}", read_unaligned<uint32_t>(message.data()), address2string(sender.address));
+}
+
+//the password is null terminated. the frame is read where it was received, so the terminator has to be its last byte
+void on_login_request(std::span<uint8_t> message, client_t& sender)
+{
+    if(message.size() <= 8 || message.back() != 0)
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    constexpr std::string_view password = "washington";
+    const std::string_view entered_password{reinterpret_cast<const char*>(&message[8]), message.size() - 8 - 1};
+
+    server_message_t response{server_message_type_e::login_response, 1 + sizeof(sync_point_t)}; //older clients only read the first byte
+    *response.message_data() = entered_password == password;
+
+    timed_rdlock(&handlers_lock, lock_metric_e::handlers_read);
+    const sync_point_t sync_point = handler_change_log.sync_point();
+    pthread_rwlock_unlock(&handlers_lock);
+
+    std::memcpy(response.message_data() + 1, &sync_point, sizeof(sync_point_t));
+
+    LOG_DEBUG("login request: {} : {}", address2string(sender.address), *response.message_data() ? "success" : "failure");
+
+    sender.logged_in = *response.message_data();
+    send_frame(sender, share_frame(std::move(response)));
+}
+
+void send_handler_range(const handler_range_t& range, const uint8_t* known_versions, const client_t& sender);
+
+//a get may end with the version the client already has, it is then answered like a range of one key
+void on_get_handler_request(std::span<uint8_t> message, const client_t& sender)
+{
+    if(message.size() != 16 && message.size() != 16 + sizeof(uint32_t))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    auto key = read_unaligned<handler_key_t>(&message[8]);
+    if(!handler_table_t::valid_key(key))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    LOG_DEBUG("{} requested handler {}", address2string(sender.address), key.to_string());
+
+    if(message.size() != 16)
+    {
+        const handler_range_t range{.id_mask = static_cast<uint16_t>(1 << key.id), .first_day_of_year = key.day_of_year, .day_count = 1, .reserved = 0, .year = key.year};
+        send_handler_range(range, &message[16], sender);
+        return;
+    }
+
+    handler_readers.enter(current_reactor->index); //the name is copied straight from the interned record into the response
+    const handler_year_t* year = handlers.find_published_year(key.year);
+    const std::u16string_view handler_name = year != nullptr ? year->read(key.day_of_year, key.id).second : std::u16string_view{};
+
+    server_message_t response{server_message_type_e::sent_handler_name, static_cast<uint32_t>(sizeof(handler_key_t) + ((handler_name.size() + 1) * 2))};
+    std::memcpy(response.message_data(), &key, sizeof(handler_key_t));
+    std::memcpy(response.message_data() + sizeof(handler_key_t), handler_name.data(), handler_name.size() * 2); //the null terminator is already zeroed
+
+    handler_readers.leave(current_reactor->index);
+
+    send_frame(sender, share_frame(std::move(response)));
+}
+
+shared_frame_t encode_handler_name(handler_key_t key, std::u16string_view handler_name)
+{
+    server_message_t message{server_message_type_e::sent_handler_name, static_cast<uint32_t>(sizeof(handler_key_t) + ((handler_name.size() + 1) * 2))};
+    std::memcpy(message.message_data(), &key, sizeof(handler_key_t));
+    std::memcpy(message.message_data() + sizeof(handler_key_t), handler_name.data(), handler_name.size() * 2);
+
+    return share_frame(std::move(message));
+}
+
+//calls on_recipient(client) for every client viewing the key except the one that changed it, called with clients_lock held
+template<typename F>
+void for_each_recipient(handler_key_t key, uint32_t sender_connection_id, F on_recipient)
+{
+    handler_subscriptions.for_each_subscriber(key, [sender_connection_id, &on_recipient](const client_t& client)
+    {
+        if(client.connection_id != sender_connection_id)
+        {
+            on_recipient(client);
+        }
+    });
+
+    for(const client_t* client : clients)
+    {
+        if(!client->subscribed && client->connection_id != sender_connection_id)
+        {
+            on_recipient(*client);
+        }
+    }
+}
+
+constexpr uint64_t max_update_batch_size = 16 << 10; //a batch is sent once it grows past this, the rest goes in the next one
+
+//changes that become due together are sent to a subscribed client as one sent_handler_updates frame instead of a frame each.
+//every entry is encoded once per version and copied into the batch of each client viewing it
+struct update_batch_t
+{
+    const client_t* client;
+    server_message_t message{server_message_type_e::sent_handler_updates, sizeof(uint32_t)}; //version 2 entries follow the same room
+    uint32_t entry_count = 0;
+};
+
+struct encoded_update_t
+{
+    handler_key_t key;
+    uint32_t sender_connection_id;
+    std::vector<uint8_t> entry{};
+    mutable std::vector<uint8_t> entry_v2{}; //encoded from entry for the first version 2 client it is sent to
+    broadcast_frame_t frame{}; //the single sent_handler_name frame for clients that never subscribed
+
+    const std::vector<uint8_t>& entry_for(const client_t& client) const
+    {
+        if(client.protocol_version == 1)
+        {
+            return entry;
+        }
+
+        if(entry_v2.empty())
+        {
+            thread_local std::u16string name{};
+            const auto header = read_unaligned<handler_entry_t>(entry.data());
+            append_v2_handler_entry(&entry_v2, header.key, header.version, read_utf16(&entry[sizeof(handler_entry_t)], header.name_size / 2, &name));
+        }
+        return entry_v2;
+    }
+};
+
+//encodes the current value of the key, called with handlers_lock held
+encoded_update_t encode_update(handler_key_t key, uint32_t sender_connection_id)
+{
+    const std::u16string_view handler_name = handlers.find(key);
+
+    encoded_update_t update{.key = key, .sender_connection_id = sender_connection_id};
+    update.entry.reserve(sizeof(handler_entry_t) + (handler_name.size() * 2));
+    append_handler_entry(&update.entry, key, handlers.version(key), handler_name);
+    update.frame.frame = encode_handler_name(key, handler_name);
+
+    return update;
+}
+
+void send_update_batch(update_batch_t* batch)
+{
+    if(batch->client->protocol_version == 1)
+    {
+        finish_handler_entries(&batch->message, batch->entry_count);
+        send_encoded_frame(*batch->client, share_frame(std::move(batch->message)));
+    }
+    else
+    {
+        const std::span<const uint8_t> entries{batch->message.message_data() + sizeof(uint32_t), batch->message.message_buffer.data() + batch->message.message_buffer.size()};
+        uint8_t entry_count[max_varint_size];
+        const uint32_t entry_count_size = encode_varint(batch->entry_count, entry_count);
+
+        auto encoded = std::make_shared<std::vector<uint8_t>>();
+        encoded->reserve((2 * max_varint_size) + entry_count_size + entries.size());
+        append_v2_frame_header(encoded.get(), static_cast<uint32_t>(server_message_type_e::sent_handler_updates), entry_count_size + entries.size());
+        encoded->insert(encoded->end(), entry_count, entry_count + entry_count_size);
+        encoded->insert(encoded->end(), entries.begin(), entries.end());
+
+        send_encoded_frame(*batch->client, encoded);
+    }
+
+    batch->message = server_message_t{server_message_type_e::sent_handler_updates, sizeof(uint32_t)};
+    batch->entry_count = 0;
+}
+
+//called between begin_broadcast and finish_broadcast with handlers_lock held, so every client receives the changes of a key in version order
+void broadcast_handler_changes(std::span<const encoded_update_t> updates)
+{
+    std::unordered_map<int, update_batch_t> batches{};
+
+    for(const encoded_update_t& update : updates)
+    {
+        uint64_t recipients = 0;
+        for_each_recipient(update.key, update.sender_connection_id, [&batches, &update, &recipients](const client_t& client)
+        {
+            ++recipients;
+            if(!client.subscribed) //older clients only know single updates
+            {
+                update.frame.send(client);
+                return;
+            }
+
+            const std::vector<uint8_t>& entry = update.entry_for(client);
+            update_batch_t& batch = batches.try_emplace(client.socket, update_batch_t{.client = &client}).first->second;
+            batch.message.message_buffer.insert(batch.message.message_buffer.end(), entry.begin(), entry.end());
+            ++batch.entry_count;
+
+            if(batch.message.message_buffer.size() >= max_update_batch_size)
+            {
+                send_update_batch(&batch);
+            }
+        });
+
+        if(metrics_enabled)
+        {
+            local_metrics().broadcast_fan_out.record(recipients);
+        }
+    }
+
+    for(auto& [socket, batch] : batches)
+    {
+        if(batch.entry_count != 0)
+        {
+            send_update_batch(&batch);
+        }
+    }
+}
+
+//a text field sends a set for every keystroke. sets are applied to the table and logged right away so none is lost, but broadcasting
+//a key waits until it has not changed for a window, so a burst costs one frame per client
+struct set_coalescer_t
+{
+    struct pending_set_t
+    {
+        uint32_t sender_connection_id; //the last client to change the key already shows the value. a socket could be reused by then
+        uint64_t first_set;
+        uint64_t last_set;
+    };
+
+    static constexpr uint64_t max_windows = 4; //a key that keeps changing is still flushed at least this often
+
+    pthread_t thread = 0;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t scheduled_cond{};
+    std::unordered_map<uint64_t, pending_set_t> pending{};
+    uint64_t window_nanoseconds = 0; //0 disables coalescing
+    bool stopping = false;
+
+    bool start(uint32_t window_milliseconds)
+    {
+        window_nanoseconds = window_milliseconds * 1'000'000ull;
+        if(window_nanoseconds == 0)
+        {
+            return true;
+        }
+
+        pthread_condattr_t cond_attr{};
+        pthread_condattr_init(&cond_attr);
+        pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&scheduled_cond, &cond_attr);
+        pthread_condattr_destroy(&cond_attr);
+
+        if(int error = pthread_create(&thread, nullptr, &flush_loop, this); error != 0)
+        {
+            LOG_ERROR("error creating coalescing thread {}", strerror(error));
+            return false;
+        }
+
+        return true;
+    }
+
+    void schedule(handler_key_t key, uint32_t sender_connection_id)
+    {
+        const uint64_t now = monotonic_nanoseconds();
+
+        pthread_mutex_lock(&lock);
+
+        auto [pending_set, inserted] = pending.try_emplace(std::bit_cast<uint64_t>(key), pending_set_t{.sender_connection_id = sender_connection_id, .first_set = now, .last_set = now});
+        pending_set->second.sender_connection_id = sender_connection_id;
+        pending_set->second.last_set = now;
+
+        pthread_mutex_unlock(&lock);
+
+        if(inserted)
+        {
+            pthread_cond_signal(&scheduled_cond);
+        }
+    }
+
+    uint64_t due_time(const pending_set_t& pending_set) const
+    {
+        return std::min(pending_set.last_set + window_nanoseconds, pending_set.first_set + (max_windows * window_nanoseconds));
+    }
+
+    //broadcasts the current values of the keys together, called without the lock so sets are never held up by a slow fan out
+    static void flush(std::vector<encoded_update_t>* updates)
+    {
+        timed_rdlock(&handlers_lock, lock_metric_e::handlers_read); //sets take the write lock, so every client ends up with the latest value
+        for(encoded_update_t& update : *updates)
+        {
+            update = encode_update(update.key, update.sender_connection_id);
+        }
+
+        begin_broadcast();
+        broadcast_handler_changes(*updates);
+        pthread_rwlock_unlock(&handlers_lock);
+        finish_broadcast();
+
+        updates->clear();
+    }
+
+    static void* flush_loop(void* coalescer_ptr)
+    {
+        set_coalescer_t& coalescer = *static_cast<set_coalescer_t*>(coalescer_ptr);
+
+        std::vector<encoded_update_t> due_updates{};
+
+        pthread_mutex_lock(&coalescer.lock);
+        while(!coalescer.stopping)
+        {
+            if(coalescer.pending.empty())
+            {
+                pthread_cond_wait(&coalescer.scheduled_cond, &coalescer.lock);
+                continue;
+            }
+
+            const uint64_t now = monotonic_nanoseconds();
+            uint64_t next_due = UINT64_MAX;
+
+            for(auto pending_set = coalescer.pending.begin(); pending_set != coalescer.pending.end();)
+            {
+                const uint64_t due = coalescer.due_time(pending_set->second);
+                if(due <= now + (coalescer.window_nanoseconds / 4)) //keys that are almost due go along, so a bulk edit leaves as one batch
+                {
+                    due_updates.push_back(encoded_update_t{.key = std::bit_cast<handler_key_t>(pending_set->first), .sender_connection_id = pending_set->second.sender_connection_id});
+                    pending_set = coalescer.pending.erase(pending_set);
+                }
+                else
+                {
+                    next_due = std::min(next_due, due);
+                    ++pending_set;
+                }
+            }
+
+            if(!due_updates.empty())
+            {
+                pthread_mutex_unlock(&coalescer.lock); //sets scheduled meanwhile go into pending and are picked up next round
+                flush(&due_updates);
+                pthread_mutex_lock(&coalescer.lock);
+                continue;
+            }
+
+            if(next_due != UINT64_MAX)
+            {
+                const timespec wake_time{.tv_sec = static_cast<time_t>(next_due / 1'000'000'000), .tv_nsec = static_cast<long>(next_due % 1'000'000'000)};
+                pthread_cond_timedwait(&coalescer.scheduled_cond, &coalescer.lock, &wake_time);
+            }
+        }
+        pthread_mutex_unlock(&coalescer.lock);
+
+        return nullptr;
+    }
+
+    //stops the thread once it finished the flush in progress, then flushes everything still pending
+    void stop()
+    {
+        if(thread == 0)
+        {
+            return;
+        }
+
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_mutex_unlock(&lock);
+        pthread_cond_signal(&scheduled_cond);
+
+        pthread_join(thread, nullptr);
+        thread = 0;
+
+        std::vector<encoded_update_t> updates{};
+        pthread_mutex_lock(&lock);
+        for(const auto& [key, pending_set] : pending)
+        {
+            updates.push_back(encoded_update_t{.key = std::bit_cast<handler_key_t>(key), .sender_connection_id = pending_set.sender_connection_id});
+        }
+        pending.clear();
+        pthread_mutex_unlock(&lock);
+
+        if(!updates.empty())
+        {
+            flush(&updates);
+        }
+    }
+};
+
+set_coalescer_t set_coalescer{};
+
+void stop_set_coalescer()
+{
+    set_coalescer.stop();
+}
+
+constexpr uint32_t max_change_history = 32; //an edit based on a version older than this many changes is rejected
+
+//where each recent change of a key replaced text, an edit made against an older version is moved past these before it is applied
+struct change_history_t
+{
+    struct change_t
+    {
+        uint32_t version; //of the handler after the change
+        uint32_t position;
+        uint32_t delete_count;
+        uint32_t insert_count;
+        uint64_t sequence = 0; //set by record
+    };
+
+    struct recorded_t
+    {
+        uint64_t key;
+        uint64_t sequence;
+    };
+
+    std::unordered_map<uint64_t, std::deque<change_t>> keys{};
+    std::deque<recorded_t> recent{}; //the last change_log_capacity changes of every key, older ones are dropped from keys with them
+    uint64_t next_sequence = 0;
+
+    void record(handler_key_t key, change_t change)
+    {
+        change.sequence = next_sequence++;
+
+        std::deque<change_t>& changes = keys[std::bit_cast<uint64_t>(key)];
+        changes.push_back(change);
+
+        if(changes.size() > max_change_history)
+        {
+            changes.pop_front();
+        }
+
+        recent.push_back(recorded_t{.key = std::bit_cast<uint64_t>(key), .sequence = change.sequence});
+        if(recent.size() > change_log_capacity)
+        {
+            forget(recent.front());
+            recent.pop_front();
+        }
+    }
+
+    //a key that has not changed in the last change_log_capacity changes loses its history, edits against it are answered with the name
+    void forget(const recorded_t& recorded)
+    {
+        auto changes = keys.find(recorded.key);
+        if(changes == keys.end() || changes->second.front().sequence != recorded.sequence) //already pushed out by later changes of the key
+        {
+            return;
+        }
+
+        changes->second.pop_front();
+        if(changes->second.empty())
+        {
+            keys.erase(changes);
+        }
+    }
+
+    //moves the replaced range of an edit made at base_version past every later change, in the order they were applied.
+    //text inserted by an earlier change stays in front of an edit at the same position, text it deleted is not deleted twice.
+    //returns false if the history does not reach back to base_version
+    bool rebase(handler_key_t key, uint32_t base_version, uint32_t current_version, uint32_t* position, uint32_t* delete_count) const
+    {
+        if(base_version == current_version)
+        {
+            return true;
+        }
+
+        auto changes = keys.find(std::bit_cast<uint64_t>(key));
+        if(base_version > current_version || changes == keys.end() || changes->second.front().version > base_version + 1)
+        {
+            return false;
+        }
+
+        for(const change_t& change : changes->second)
+        {
+            if(change.version <= base_version)
+            {
+                continue;
+            }
+
+            const uint32_t change_end = change.position + change.delete_count;
+            const uint32_t start = *position;
+            const uint32_t end = *position + *delete_count;
+
+            const uint32_t moved_start = start < change.position ? start : start >= change_end ? start - change.delete_count + change.insert_count : change.position + change.insert_count;
+            const uint32_t moved_end = end <= change.position ? end : end >= change_end ? end - change.delete_count + change.insert_count : change.position;
+
+            *position = moved_start;
+            *delete_count = moved_end > moved_start ? moved_end - moved_start : 0;
+        }
+
+        return true;
+    }
+};
+
+change_history_t handler_changes{}; //guarded by handlers_lock
+
+void on_set_handler_request(std::span<uint8_t> message, const client_t& sender)
+{
+    if(message.size() < 18 || (message.size() - 16) % 2 != 0) //a key and at least the null terminator of the name, in whole code units
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    if(!sender.logged_in)
+    {
+        LOG_WARNING("{} tried to set a handler name but is not logged in", address2string(sender.address));
+        return;
+    }
+
+    auto key = read_unaligned<handler_key_t>(&message[8]);
+    if(!handler_table_t::valid_key(key))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    thread_local std::u16string received_name{};
+    const std::u16string_view handler_name = read_utf16(&message[16], ((message.size() - 16) / 2) - 1, &received_name);
+
+    LOG_DEBUG("{}: set handler {} to {}", address2string(sender.address), key.to_string(), cvt_str16_to_str8(handler_name));
+
+    timed_wrlock(&handlers_lock, lock_metric_e::handlers_write);
+    const std::u16string_view previous_name = handlers.find(key);
+    const uint32_t previous_size = previous_name.size();
+
+    //recorded while the previous name is still alive, the set makes it the next version
+    handler_audit.append(realtime_nanoseconds(), sender.address, std::bit_cast<uint64_t>(key), handlers.version(key) + 1, previous_name, handler_name);
+    handlers.set(key, handler_name);
+
+    handler_changes.record(key, change_history_t::change_t{.version = handlers.version(key), .position = 0, .delete_count = previous_size, .insert_count = static_cast<uint32_t>(handler_name.size())});
+    handler_change_log.record(key);
+
+    handlers_wal.append(std::bit_cast<uint64_t>(key), handlers.version(key), handler_name); //appended under the lock so the log order matches the order sets were applied in
+
+    if(set_coalescer.window_nanoseconds != 0)
+    {
+        pthread_rwlock_unlock(&handlers_lock);
+        set_coalescer.schedule(key, sender.connection_id); //broadcast once the key has been quiet for a window
+        return;
+    }
+
+    const encoded_update_t update = encode_update(key, sender.connection_id);
+    begin_broadcast();
+    broadcast_handler_changes(std::span{&update, 1});
+
+    pthread_rwlock_unlock(&handlers_lock);
+    finish_broadcast();
+}
+
+shared_frame_t encode_handler_entry(server_message_type_e message_type, handler_key_t key, uint32_t version, std::u16string_view handler_name)
+{
+    server_message_t message{message_type, 0};
+    append_handler_entry(&message.message_buffer, key, version, handler_name);
+    reinterpret_cast<uint32_t&>(message.message_buffer[4]) = message.message_buffer.size() - 8;
+
+    return share_frame(std::move(message));
+}
+
+//applies one keystroke worth of change instead of the whole name. edits of two clients made against the same version are both kept,
+//the later one is moved past the earlier. the sender is acknowledged with the new version, or sent the whole name if its edit had to be
+//moved or could not be applied, and everyone else viewing the key is sent just the edit
+void on_edit_handler_request(std::span<uint8_t> message, const client_t& sender)
+{
+    if(message.size() < 8 + sizeof(handler_edit_t) || (message.size() - 8 - sizeof(handler_edit_t)) % 2 != 0)
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    if(!sender.logged_in)
+    {
+        LOG_WARNING("{} tried to edit a handler name but is not logged in", address2string(sender.address));
+        return;
+    }
+
+    auto edit = read_unaligned<handler_edit_t>(&message[8]);
+    if(!handler_table_t::valid_key(edit.key))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    thread_local std::u16string received_text{};
+    const std::u16string_view inserted = read_utf16(&message[8 + sizeof(handler_edit_t)], (message.size() - 8 - sizeof(handler_edit_t)) / 2, &received_text);
+
+    timed_wrlock(&handlers_lock, lock_metric_e::handlers_write);
+
+    const std::u16string_view current_name = handlers.find(edit.key);
+    const uint32_t current_version = handlers.version(edit.key);
+
+    uint32_t position = edit.position;
+    uint32_t delete_count = edit.delete_count;
+
+    const bool applicable = handler_changes.rebase(edit.key, edit.base_version, current_version, &position, &delete_count)
+        && position + delete_count <= current_name.size() && position <= UINT16_MAX && delete_count <= UINT16_MAX;
+
+    if(!applicable)
+    {
+        LOG_WARNING("{} sent an edit of handler {} against version {} that can not be applied to version {}", address2string(sender.address), edit.key.to_string(), static_cast<uint32_t>(edit.base_version), current_version);
+
+        begin_broadcast(); //queued under handlers_lock like every reply to an edit, so it never overtakes a later broadcast of the key
+        send_frame(sender, encode_handler_entry(server_message_type_e::edit_rebased, edit.key, current_version, current_name));
+        pthread_rwlock_unlock(&handlers_lock);
+        finish_broadcast();
+        return;
+    }
+
+    std::u16string edited_name{current_name.substr(0, position)};
+    edited_name += inserted;
+    edited_name += current_name.substr(position + delete_count);
+
+    handler_audit.append(realtime_nanoseconds(), sender.address, std::bit_cast<uint64_t>(edit.key), current_version + 1, current_name, edited_name);
+    handlers.set(edit.key, edited_name);
+    const uint32_t version = handlers.version(edit.key);
+
+    handler_changes.record(edit.key, change_history_t::change_t{.version = version, .position = position, .delete_count = delete_count, .insert_count = static_cast<uint32_t>(inserted.size())});
+    handler_change_log.record(edit.key);
+    handlers_wal.append(std::bit_cast<uint64_t>(edit.key), version, edited_name);
+
+    begin_broadcast(); //the reply and the broadcast are queued under handlers_lock so every client receives the edits of a key in version order
+
+    if(edit.base_version == current_version)
+    {
+        server_message_t acknowledgement{server_message_type_e::edit_acknowledged, sizeof(handler_key_t) + sizeof(uint32_t)};
+        std::memcpy(acknowledgement.message_data(), &edit.key, sizeof(handler_key_t));
+        std::memcpy(acknowledgement.message_data() + sizeof(handler_key_t), &version, sizeof(uint32_t));
+
+        send_frame(sender, share_frame(std::move(acknowledgement)));
+    }
+    else
+    {
+        send_frame(sender, encode_handler_entry(server_message_type_e::edit_rebased, edit.key, version, edited_name));
+    }
+
+    const handler_edit_t applied_edit{.key = edit.key, .base_version = version - 1, .position = static_cast<uint16_t>(position), .delete_count = static_cast<uint16_t>(delete_count)};
+
+    server_message_t edit_message{server_message_type_e::edited_handler, static_cast<uint32_t>(sizeof(handler_edit_t) + (inserted.size() * 2))};
+    std::memcpy(edit_message.message_data(), &applied_edit, sizeof(handler_edit_t));
+    std::memcpy(edit_message.message_data() + sizeof(handler_edit_t), inserted.data(), inserted.size() * 2);
+
+    const broadcast_frame_t edit_frame{.frame = share_frame(std::move(edit_message))};
+    const broadcast_frame_t name_frame{.frame = encode_handler_name(edit.key, edited_name)};
+
+    uint64_t recipients = 0;
+    for_each_recipient(edit.key, sender.connection_id, [&edit_frame, &name_frame, &recipients](const client_t& client)
+    {
+        (client.subscribed ? edit_frame : name_frame).send(client); //older clients only know whole names
+        ++recipients;
+    });
+
+    if(metrics_enabled)
+    {
+        local_metrics().broadcast_fan_out.record(recipients);
+    }
+
+    pthread_rwlock_unlock(&handlers_lock);
+    finish_broadcast();
+}
+
+//answers a whole view in one frame: an entry count followed by an entry for every requested key, empty names included.
+//with the versions the client already has only the changed keys are sent, and a handlers_not_modified frame if none changed.
+//known_versions points at a uint32_t per key inside the received frame
+void send_handler_range(const handler_range_t& range, const uint8_t* known_versions, const client_t& sender)
+{
+    server_message_t response{server_message_type_e::sent_handler_range, sizeof(uint32_t)};
+    uint32_t entry_count = 0;
+    uint32_t key_index = 0;
+
+    handler_readers.enter(current_reactor->index); //sets go on while the range is read, each entry is a consistent version and name
+    const handler_year_t* year = handlers.find_published_year(range.year);
+
+    for(uint32_t day = range.first_day_of_year; day < range.end_day_of_year(); ++day) //the days of a year are contiguous
+    {
+        for(uint16_t id = 0; id < handler_id_count; ++id)
+        {
+            if((range.id_mask & (1 << id)) == 0)
+            {
+                continue;
+            }
+
+            const auto [version, handler_name] = year != nullptr ? year->read(day, id) : std::pair<uint32_t, std::u16string_view>{};
+            if(known_versions != nullptr && read_unaligned<uint32_t>(known_versions + (sizeof(uint32_t) * key_index++)) == version)
+            {
+                continue;
+            }
+
+            const handler_key_t key{.id = static_cast<handler_id_t>(id), .day_of_year = static_cast<uint16_t>(day), .year = range.year};
+
+            append_handler_entry(&response.message_buffer, key, version, handler_name);
+            ++entry_count;
+        }
+    }
+    handler_readers.leave(current_reactor->index);
+
+    if(entry_count == 0 && known_versions != nullptr)
+    {
+        server_message_t not_modified{server_message_type_e::handlers_not_modified, sizeof(handler_range_t)};
+        std::memcpy(not_modified.message_data(), &range, sizeof(handler_range_t));
+
+        send_frame(sender, share_frame(std::move(not_modified)));
+        return;
+    }
+
+    finish_handler_entries(&response, entry_count);
+
+    send_frame(sender, share_frame(std::move(response)));
+}
+
+//the range may be followed by the version the client has of every key in it, in the order the entries are sent in
+void on_get_handler_range_request(std::span<uint8_t> message, const client_t& sender)
+{
+    if(message.size() < 8 + sizeof(handler_range_t))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    auto range = read_unaligned<handler_range_t>(&message[8]);
+    const uint64_t key_count = static_cast<uint64_t>(std::popcount(range.id_mask)) * range.day_count;
+    const uint64_t versions_size = message.size() - 8 - sizeof(handler_range_t);
+
+    if(!range.valid() || (versions_size != 0 && versions_size != key_count * sizeof(uint32_t)))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    LOG_DEBUG("{} requested handler range {}", address2string(sender.address), range.to_string());
+
+    send_handler_range(range, versions_size != 0 ? &message[8 + sizeof(handler_range_t)] : nullptr, sender);
+}
+
+//a reconnecting client sends the sync point it last got and the range it views. the answer starts with the current sync point,
+//followed by the entries of the keys in the range that changed since, or of every key in the range if the log does not reach back
+void on_resync_request(std::span<uint8_t> message, const client_t& sender)
+{
+    if(message.size() != 8 + sizeof(sync_point_t) + sizeof(handler_range_t))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    auto client_sync_point = read_unaligned<sync_point_t>(&message[8]);
+    auto range = read_unaligned<handler_range_t>(&message[8 + sizeof(sync_point_t)]);
+    if(!range.valid())
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    auto in_range = [&range](handler_key_t key)
+    {
+        return key.year == range.year && key.day_of_year >= range.first_day_of_year && key.day_of_year < range.end_day_of_year()
+            && ((range.id_mask >> key.id) & 1) != 0;
+    };
+
+    server_message_t response{server_message_type_e::sent_handler_changes, sizeof(sync_point_t) + sizeof(uint32_t)};
+    uint32_t entry_count = 0;
+
+    timed_rdlock(&handlers_lock, lock_metric_e::handlers_read);
+
+    const sync_point_t sync_point = handler_change_log.sync_point();
+    const bool incremental = handler_change_log.reaches_back_to(client_sync_point);
+
+    std::array<std::array<bool, handler_id_count>, max_day_of_year + 1> sent{}; //a key changed many times is sent once
+    auto append_key = [&](handler_key_t key)
+    {
+        if(!in_range(key) || std::exchange(sent[key.day_of_year][key.id], true))
+        {
+            return;
+        }
+
+        append_handler_entry(&response.message_buffer, key, handlers.version(key), handlers.find(key));
+        ++entry_count;
+    };
+
+    if(incremental)
+    {
+        handler_change_log.for_each_since(client_sync_point, append_key);
+    }
+    else
+    {
+        for(uint32_t day = range.first_day_of_year; day < range.end_day_of_year(); ++day)
+        {
+            for(uint16_t id = 0; id < handler_id_count; ++id)
+            {
+                append_key(handler_key_t{.id = static_cast<handler_id_t>(id), .day_of_year = static_cast<uint16_t>(day), .year = range.year});
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&handlers_lock);
+
+    LOG_DEBUG("{} resynced handler range {}, sent {} entries{}", address2string(sender.address), range.to_string(), entry_count, incremental ? "" : " of the whole range");
+
+    reinterpret_cast<uint32_t&>(response.message_buffer[4]) = response.message_buffer.size() - 8;
+    std::memcpy(response.message_data(), &sync_point, sizeof(sync_point_t));
+    std::memcpy(response.message_data() + sizeof(sync_point_t), &entry_count, sizeof(entry_count));
+
+    send_frame(sender, share_frame(std::move(response)));
+}
+
+//after its first subscription a client is only sent the changes of the ranges it is subscribed to
+void on_subscribe_request(std::span<uint8_t> message, client_t& sender, bool subscribe)
+{
+    if(message.size() != 8 + sizeof(handler_range_t))
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    auto range = read_unaligned<handler_range_t>(&message[8]);
+    if(!range.valid())
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    if(!sender.logged_in)
+    {
+        LOG_WARNING("{} tried to change its subscriptions but is not logged in", address2string(sender.address));
+        return;
+    }
+
+    LOG_DEBUG("{} {} handler range {}", address2string(sender.address), subscribe ? "subscribed to" : "unsubscribed from", range.to_string());
+
+    timed_wrlock(&clients_lock, lock_metric_e::clients_write); //broadcasters read the index and the subscribed flag
+
+    if(subscribe && handler_subscriptions.subscribe(&sender, range))
+    {
+        sender.subscribed = true;
+    }
+    else if(subscribe) //it would miss the changes of days it shows, so it has to reconnect with fewer ranges
+    {
+        LOG_WARNING("{} has too many subscriptions, disconnecting it", address2string(sender.address));
+        (void)shutdown(sender.socket, SHUT_RDWR); //the owning reactor sees the hang up and removes the client
+    }
+    else
+    {
+        handler_subscriptions.unsubscribe(sender.socket, range);
+    }
+
+    pthread_rwlock_unlock(&clients_lock);
+}
+
+//the answer has to be the last frame in the old version. it is sent with clients_lock held for writing, so no broadcast is between
+//begin_broadcast and finish_broadcast: every frame one queued for the client is already in its outbound queue with epoll, or in the
+//outbox of its reactor with uring. this runs on that reactor, and uring_send_frame drains the outbox before the answer is queued
+void on_negotiate_protocol_request(std::span<uint8_t> message, client_t& sender)
+{
+    if(message.size() != 8 + sizeof(uint32_t) || sender.protocol_version != 1)
+    {
+        on_invalid_message(message, sender);
+        return;
+    }
+
+    const uint32_t version = std::clamp(read_unaligned<uint32_t>(&message[8]), 1u, newest_protocol_version);
+
+    server_message_t response{server_message_type_e::protocol_accepted, sizeof(uint32_t)};
+    std::memcpy(response.message_data(), &version, sizeof(uint32_t));
+
+    LOG_DEBUG("{} speaks protocol version {}", address2string(sender.address), version);
+
+    timed_wrlock(&clients_lock, lock_metric_e::clients_write);
+    send_encoded_frame(sender, share_frame(std::move(response)));
+    sender.protocol_version = version;
+    pthread_rwlock_unlock(&clients_lock);
+}
+
+void dispatch_client_message(std::span<uint8_t> message, client_t& sender)
+{
+    switch(read_unaligned<client_message_type_e>(message.data()))
+    {
+        case client_message_type_e::login:
+            on_login_request(message, sender);
+            break;
+        case client_message_type_e::get_handler:
+            on_get_handler_request(message, sender);
+            break;
+        case client_message_type_e::set_handler:
+            on_set_handler_request(message, sender);
+            break;
+        case client_message_type_e::get_handler_range:
+            on_get_handler_range_request(message, sender);
+            break;
+        case client_message_type_e::subscribe_handlers:
+            on_subscribe_request(message, sender, true);
+            break;
+        case client_message_type_e::unsubscribe_handlers:
+            on_subscribe_request(message, sender, false);
+            break;
+        case client_message_type_e::edit_handler:
+            on_edit_handler_request(message, sender);
+            break;
+        case client_message_type_e::resync_handlers:
+            on_resync_request(message, sender);
+            break;
+        case client_message_type_e::negotiate_protocol:
+            on_negotiate_protocol_request(message, sender);
+            break;
+        default:
+            on_invalid_message(message, sender);
+            break;
+    }
+}
+
+//records how long the message waited, how long its handler took and how much of that was spent sending
+void record_message_latency(std::span<uint8_t> message, uint64_t received_time, uint64_t start, uint64_t end)
+{
+    const uint32_t message_type = std::min(read_unaligned<uint32_t>(message.data()), static_cast<uint32_t>(client_message_type_e::max));
+
+    thread_metrics_t& metrics = local_metrics();
+    histogram_t* latency = metrics.message_latency[message_type];
+    latency[static_cast<uint32_t>(message_stage_e::queued)].record(start - received_time);
+    latency[static_cast<uint32_t>(message_stage_e::handler)].record(end - start);
+    latency[static_cast<uint32_t>(message_stage_e::send)].record(metrics.send_nanoseconds);
+}
+
+//decodes a frame of a version 2 client into the version 1 frame the handlers take. a malformed frame is decoded into one of an invalid
+//type, so it is answered and counted like any other invalid message
+void decode_v2_client_frame(uint32_t type, std::span<const uint8_t> payload, std::vector<uint8_t>* frame)
+{
+    frame->assign(frame_header_size, 0);
+    v2_reader_t reader{.input = payload};
+
+    auto append = [frame]<typename T>(const T& value)
+    {
+        frame->insert(frame->end(), reinterpret_cast<const uint8_t*>(&value), reinterpret_cast<const uint8_t*>(&value) + sizeof(T));
+    };
+
+    auto append_utf16 = [&reader, &append]()
+    {
+        if(!decode_utf8(reader.rest(), [&append](char16_t code_unit){ append(code_unit); }))
+        {
+            reader.failed = true;
+        }
+    };
+
+    switch(static_cast<client_message_type_e>(type))
+    {
+        case client_message_type_e::login:
+        {
+            const std::span<const uint8_t> password = reader.rest();
+            frame->insert(frame->end(), password.begin(), password.end());
+            frame->push_back(0);
+            break;
+        }
+        case client_message_type_e::get_handler:
+            append(reader.key());
+            if(!reader.at_end())
+            {
+                append(static_cast<uint32_t>(reader.varint(UINT32_MAX)));
+            }
+            break;
+        case client_message_type_e::set_handler:
+            append(reader.key());
+            append_utf16();
+            append(char16_t{0});
+            break;
+        case client_message_type_e::get_handler_range:
+            append(reader.range());
+            while(!reader.failed && !reader.at_end())
+            {
+                append(static_cast<uint32_t>(reader.varint(UINT32_MAX)));
+            }
+            break;
+        case client_message_type_e::subscribe_handlers:
+        case client_message_type_e::unsubscribe_handlers:
+            append(reader.range());
+            break;
+        case client_message_type_e::edit_handler:
+            append(handler_edit_t{.key = reader.key(), .base_version = static_cast<uint32_t>(reader.varint(UINT32_MAX)),
+                .position = static_cast<uint16_t>(reader.varint(UINT16_MAX)), .delete_count = static_cast<uint16_t>(reader.varint(UINT16_MAX))});
+            append_utf16();
+            break;
+        case client_message_type_e::resync_handlers:
+            append(reader.sync_point());
+            append(reader.range());
+            break;
+        default: //negotiate_protocol included, it is only valid in version 1
+            type = static_cast<uint32_t>(client_message_type_e::max);
+            break;
+    }
+
+    if(reader.failed || !reader.at_end())
+    {
+        frame->resize(frame_header_size);
+        type = static_cast<uint32_t>(client_message_type_e::max);
+    }
+
+    const frame_header_t header{.type = type, .size = static_cast<uint32_t>(frame->size() - frame_header_size)};
+    std::memcpy(frame->data(), &header, sizeof(header));
+}
+
+//dispatches every complete frame at the start of input and returns how many bytes they took up, or -1 if the client announced a frame
+//larger than max_frame_size or sent a malformed header. frames of version 1 clients are handled where they were received, nothing is
+//copied. received_time is when the recv that completed them returned
+int64_t dispatch_client_frames(std::span<uint8_t> input, client_t& sender, uint64_t received_time)
+{
+    uint64_t consumed = 0;
+    while(consumed < input.size())
+    {
+        uint32_t type = 0;
+        uint64_t payload_size = 0;
+        const int32_t header_size = decode_frame_header(input.data() + consumed, input.size() - consumed, sender.protocol_version, &type, &payload_size); //a negotiation changes the version between two frames
+        if(header_size == 0)
+        {
+            break;
+        }
+
+        if(header_size < 0)
+        {
+            LOG_WARNING("client: {}. sent a malformed frame header", address2string(sender.address));
+            return -1;
+        }
+
+        if(payload_size > max_frame_size - header_size)
+        {
+            LOG_WARNING("client: {}. sent a frame of {} bytes, more than the {} allowed", address2string(sender.address), header_size + payload_size, max_frame_size);
+            return -1;
+        }
+
+        const uint64_t frame_size = header_size + payload_size;
+        if(input.size() - consumed < frame_size)
+        {
+            break;
+        }
+
+        std::span<uint8_t> message = input.subspan(consumed, frame_size);
+        if(traffic_capture.enabled())
+        {
+            traffic_capture.append_frame(sender.connection_id, sender.protocol_version, type, message);
+        }
+
+        if(sender.protocol_version != 1)
+        {
+            thread_local std::vector<uint8_t> decoded{};
+            decode_v2_client_frame(type, message.subspan(header_size), &decoded);
+            message = decoded;
+        }
+
+        if(metrics_enabled)
+        {
+            local_metrics().send_nanoseconds = 0;
+            const uint64_t start = monotonic_nanoseconds();
+            dispatch_client_message(message, sender);
+            record_message_latency(message, received_time, start, monotonic_nanoseconds());
+        }
+        else
+        {
+            dispatch_client_message(message, sender);
+        }
+
+        consumed += frame_size;
+    }
+
+    return consumed;
+}
+
+void uring_discard_outbox(uring_reactor_t* reactor, int socket);
+
+//adds a newly accepted client to the registry, the context stays at the same address until remove_client frees it
+client_t* add_client(int socket, const sockaddr_in& address, uint32_t reactor)
+{
+    auto client = new client_t{.socket = socket, .reactor = reactor, .address = address};
+    if(io_backend == io_backend_e::epoll)
+    {
+        client->outbound = new outbound_queue_t{};
+    }
+
+    timed_wrlock(&clients_lock, lock_metric_e::clients_write);
+    client->registry_index = clients.size();
+    client->connection_id = next_connection_id++;
+    clients.push_back(client);
+    pthread_rwlock_unlock(&clients_lock);
+
+    if(traffic_capture.enabled())
+    {
+        traffic_capture.append(client->connection_id, capture_connected);
+    }
+
+    return client;
+}
+
+//removes a client that has disconnected or errored, only called by the reactor that owns it
+void remove_client(client_t* client)
+{
+    timed_wrlock(&clients_lock, lock_metric_e::clients_write);
+
+    if(io_backend == io_backend_e::uring) //frames queued by other reactors must not reach a new connection that reuses the socket
+    {
+        uring_discard_outbox(reactors[client->reactor].uring, client->socket);
+    }
+
+    if(close(client->socket) == -1) //closing also removes it from the reactors epoll set
+    {
+        perror("close");
+    }
+
+    handler_subscriptions.remove_client(client->socket);
+
+    client_t* moved = clients.back();
+    moved->registry_index = client->registry_index;
+    clients[client->registry_index] = moved;
+    clients.pop_back();
+
+    pthread_rwlock_unlock(&clients_lock);
+
+    if(traffic_capture.enabled())
+    {
+        traffic_capture.append(client->connection_id, capture_disconnected);
+    }
+
+    delete client->outbound; //nobody else can reach the client once it is out of the registry and the index
+    delete client;
+}
+
+//handles every complete message that has arrived on the socket. the socket is edge triggered so this has to run until recv would block.
+//each recv takes everything that fits in the receive buffer, however many frames that is
+void on_client_readable(client_t* client)
+{
+    auto on_recv_fail = [](ssize_t result, client_t* client)
+    {
+        if(result == 0)
+        {
+            LOG("client disconnected: {}", address2string(client->address));
+        }
+        else if(result == -1)
+        {
+            LOG_WARNING("client: {}. error on recv: {}", address2string(client->address), strerror(errno));
+        }
+
+        remove_client(client);
+    };
+
+    while(true)
+    {
+        const std::span<uint8_t> free_space = client->input.free_space(client->protocol_version);
+
+        ssize_t result = recv(client->socket, free_space.data(), free_space.size(), MSG_DONTWAIT);
+        if(result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        else if(result <= 0)
+        {
+            on_recv_fail(result, client);
+            return;
+        }
+
+        client->input.commit(result);
+
+        const int64_t consumed = dispatch_client_frames(client->input.pending(), *client, metrics_enabled ? monotonic_nanoseconds() : 0);
+        if(consumed == -1)
+        {
+            remove_client(client);
+            return;
+        }
+
+        client->input.consume(consumed);
+    }
+}
+
+void on_client_writable(client_t* client)
+{
+    pthread_mutex_lock(&client->outbound->lock);
+    flush_outbound_queue(client->socket, client->outbound);
+    pthread_mutex_unlock(&client->outbound->lock);
+}
+
+void accept_clients(reactor_t& reactor)
+{
+    while(true)
+    {
+        sockaddr_in client_addr{};
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_socket = accept4(reactor.server_socket, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(client_socket == -1)
+        {
+            if(errno == EINVAL) //the server socket was shut down, stop waiting on it
+            {
+                (void)epoll_ctl(reactor.epoll, EPOLL_CTL_DEL, reactor.server_socket, nullptr);
+            }
+            else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("accept");
+            }
+
+            return;
+        }
+
+        LOG("client connected: {}", address2string(client_addr));
+
+        client_t* client = add_client(client_socket, client_addr, reactor.index);
+
+        //EPOLLOUT only has an edge after a write would have blocked, so it costs nothing while the queue is empty
+        epoll_event client_event{.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data = {.ptr = client}};
+        if(epoll_ctl(reactor.epoll, EPOLL_CTL_ADD, client_socket, &client_event) == -1)
+        {
+            perror("epoll_ctl");
+            remove_client(client);
+        }
+    }
+}
+
+void* reactor_loop(void* reactor_ptr)
+{
+    reactor_t& reactor = *static_cast<reactor_t*>(reactor_ptr);
+    current_reactor = &reactor;
+
+    epoll_event events[64];
+    while(true)
+    {
+        int event_count = epoll_wait(reactor.epoll, events, std::size(events), -1);
+        if(event_count == -1)
+        {
+            if(errno != EINTR)
+            {
+                perror("epoll_wait");
+            }
+
+            continue;
+        }
+
+        for(int index = 0; index < event_count; ++index)
+        {
+            auto client = static_cast<client_t*>(events[index].data.ptr);
+            if(client == nullptr) //the server socket
+            {
+                accept_clients(reactor);
+                continue;
+            }
+
+            if(events[index].events & EPOLLOUT)
+            {
+                on_client_writable(client);
+            }
+
+            if(events[index].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                on_client_readable(client);
+            }
+        }
+    }
+}
+
+uint64_t uring_user_data(uring_operation_e operation, void* target = nullptr)
+{
+    return reinterpret_cast<uint64_t>(target) | static_cast<uint64_t>(operation);
+}
+
+void uring_submit_accept(reactor_t& reactor)
+{
+    io_uring_sqe* sqe = reactor.uring->ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = reactor.server_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT; //one submission keeps accepting until it is cancelled or fails
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = uring_user_data(uring_operation_e::accept);
+}
+
+void uring_submit_recv(uring_reactor_t* reactor, uring_connection_t* connection)
+{
+    io_uring_sqe* sqe = reactor->ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT; //the kernel picks a receive buffer only once data arrives, idle connections hold none
+    sqe->buf_group = 0;
+    sqe->user_data = uring_user_data(uring_operation_e::recv, connection);
+}
+
+void uring_submit_wake_read(uring_reactor_t* reactor)
+{
+    io_uring_sqe* sqe = reactor->ring.get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reactor->wake_event;
+    sqe->addr = reinterpret_cast<uint64_t>(&reactor->wake_value);
+    sqe->len = sizeof(reactor->wake_value);
+    sqe->user_data = uring_user_data(uring_operation_e::wake);
+}
+
+void uring_recycle_recv_buffer(uring_reactor_t* reactor, uint16_t buffer_id)
+{
+    std::atomic_ref<uint16_t> tail{reactor->recv_buffer_ring->tail};
+    const uint16_t index = tail.load(std::memory_order_relaxed);
+
+    //the flexible bufs member is laid out differently in c++, the entries start at the beginning of the ring with the tail overlaid
+    io_uring_buf& buffer = reinterpret_cast<io_uring_buf*>(reactor->recv_buffer_ring)[index & (uring_recv_buffer_count - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(reactor->recv_buffer_memory + (buffer_id * uring_recv_buffer_size));
+    buffer.len = uring_recv_buffer_size;
+    buffer.bid = buffer_id;
+
+    tail.store(index + 1, std::memory_order_release);
+}
+
+void uring_start_write(uring_reactor_t* reactor, uring_connection_t* connection)
+{
+    if(connection->writing || connection->queued_size() == 0)
+    {
+        return;
+    }
+
+    io_uring_sqe* sqe = reactor->ring.get_sqe();
+    sqe->fd = connection->socket;
+    sqe->user_data = uring_user_data(uring_operation_e::write, connection);
+
+    if(!reactor->free_send_slots.empty())
+    {
+        connection->send_slot = static_cast<int32_t>(reactor->free_send_slots.back());
+        reactor->free_send_slots.pop_back();
+
+        uint8_t* slot = reactor->send_slot_memory + (connection->send_slot * uring_send_slot_size);
+        connection->write_size = std::min<uint64_t>(connection->queued_size(), uring_send_slot_size);
+        std::memcpy(slot, connection->queued_output.data() + connection->queued_offset, connection->write_size);
+        connection->consume_queued(connection->write_size);
+
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(slot);
+        sqe->len = connection->write_size;
+        sqe->buf_index = 0; //every slot lives in the single registered region
+    }
+    else
+    {
+        if(connection->queued_offset == 0)
+        {
+            connection->unregistered_output.swap(connection->queued_output);
+        }
+        else
+        {
+            connection->unregistered_output.assign(connection->queued_output.begin() + connection->queued_offset, connection->queued_output.end());
+        }
+        connection->discard_queued();
+        connection->write_size = connection->unregistered_output.size();
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<uint64_t>(connection->unregistered_output.data());
+        sqe->len = connection->write_size;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+
+    connection->write_offset = 0;
+    connection->writing = true;
+}
+
+void uring_continue_write(uring_reactor_t* reactor, uring_connection_t* connection)
+{
+    const uint8_t* bytes = connection->send_slot != -1
+        ? reactor->send_slot_memory + (connection->send_slot * uring_send_slot_size)
+        : connection->unregistered_output.data();
+
+    io_uring_sqe* sqe = reactor->ring.get_sqe();
+    sqe->opcode = connection->send_slot != -1 ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+    sqe->fd = connection->socket;
+    sqe->addr = reinterpret_cast<uint64_t>(bytes + connection->write_offset);
+    sqe->len = connection->write_size - connection->write_offset;
+    sqe->msg_flags = connection->send_slot != -1 ? 0 : MSG_NOSIGNAL;
+    sqe->user_data = uring_user_data(uring_operation_e::write, connection);
+}
+
+void uring_queue_output(uring_reactor_t* reactor, uring_connection_t* connection, const shared_frame_t& frame)
+{
+    if(connection->closed || connection->shut_down)
+    {
+        return;
+    }
+
+    if(connection->queued_size() + frame->size() > max_outbound_queue_size)
+    {
+        LOG_WARNING("client socket {} is not reading, disconnecting it", connection->socket);
+
+        connection->discard_queued();
+        connection->shut_down = true;
+        (void)shutdown(connection->socket, SHUT_RDWR); //the receive completes and closes the connection
+        return;
+    }
+
+    connection->queued_output.insert(connection->queued_output.end(), frame->begin(), frame->end());
+    uring_start_write(reactor, connection);
+}
+
+void uring_drain_outbox(uring_reactor_t* reactor)
+{
+    pthread_mutex_lock(&reactor->outbox_lock);
+    reactor->draining_outbox.swap(reactor->outbox);
+    pthread_mutex_unlock(&reactor->outbox_lock);
+
+    for(const uring_outbox_record_t& record : reactor->draining_outbox)
+    {
+        auto connection = reactor->connections.find(record.socket);
+        if(connection != reactor->connections.end())
+        {
+            uring_queue_output(reactor, connection->second, record.frame);
+        }
+    }
+
+    reactor->draining_outbox.clear();
+}
+
+//frames for connections owned by other reactors go through their outbox, which costs at most one eventfd write per reactor and broadcast.
+//the outbox only holds a reference to the frame, it is copied once into the send buffer of each connection. the owner queues directly
+//once it drained its outbox, so its frames never overtake the ones other threads queued for the same connection earlier
+void uring_send_frame(const client_t& client, const shared_frame_t& frame)
+{
+    reactor_t& owner = reactors[client.reactor];
+
+    if(&owner == current_reactor)
+    {
+        uring_drain_outbox(owner.uring);
+
+        auto connection = owner.uring->connections.find(client.socket);
+        if(connection != owner.uring->connections.end())
+        {
+            uring_queue_output(owner.uring, connection->second, frame);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&owner.uring->outbox_lock);
+    const bool was_empty = owner.uring->outbox.empty();
+    owner.uring->outbox.push_back(uring_outbox_record_t{.socket = client.socket, .frame = frame});
+    pthread_mutex_unlock(&owner.uring->outbox_lock);
+
+    if(was_empty && deferring_writes)
+    {
+        deferred_wakes.push_back(owner.uring);
+    }
+    else if(was_empty)
+    {
+        (void)eventfd_write(owner.uring->wake_event, 1);
+    }
+}
+
+//called with clients_lock held for writing, so no other reactor can be appending frames for this socket
+void uring_discard_outbox(uring_reactor_t* reactor, int socket)
+{
+    pthread_mutex_lock(&reactor->outbox_lock);
+    std::erase_if(reactor->outbox, [socket](const uring_outbox_record_t& record){ return record.socket == socket; });
+    pthread_mutex_unlock(&reactor->outbox_lock);
+}
+
+void uring_close_connection(uring_reactor_t* reactor, uring_connection_t* connection, int32_t result)
+{
+    if(connection->client != nullptr)
+    {
+        if(result == 0)
+        {
+            LOG("client disconnected: {}", address2string(connection->client->address));
+        }
+        else
+        {
+            LOG_WARNING("client: {}. error on recv: {}", address2string(connection->client->address), strerror(-result));
+        }
+
+        remove_client(std::exchange(connection->client, nullptr));
+    }
+
+    reactor->connections.erase(connection->socket);
+    connection->closed = true;
+
+    if(!connection->writing) //otherwise freed once the write in flight completes
+    {
+        delete connection;
+    }
+}
+
+//parses every complete message out of the received bytes and keeps the incomplete tail for the next receive. while nothing is
+//buffered the frames are handled straight from the provided buffer and only the tail is copied
+void uring_on_received(uring_connection_t* connection, uint8_t* data, uint32_t size)
+{
+    if(connection->shut_down)
+    {
+        return;
+    }
+
+    auto reject = [connection]()
+    {
+        connection->shut_down = true;
+        (void)shutdown(connection->socket, SHUT_RDWR); //the receive completes and closes the connection
+    };
+
+    const uint64_t received_time = metrics_enabled ? monotonic_nanoseconds() : 0;
+
+    std::span<uint8_t> received{data, size};
+    if(connection->input.empty())
+    {
+        const int64_t consumed = dispatch_client_frames(received, *connection->client, received_time);
+        if(consumed == -1)
+        {
+            reject();
+            return;
+        }
+
+        received = received.subspan(consumed);
+    }
+
+    while(!received.empty())
+    {
+        const std::span<uint8_t> free_space = connection->input.free_space(connection->client->protocol_version);
+        const uint64_t copied = std::min(free_space.size(), received.size());
+        std::memcpy(free_space.data(), received.data(), copied);
+        connection->input.commit(copied);
+        received = received.subspan(copied);
+
+        const int64_t consumed = dispatch_client_frames(connection->input.pending(), *connection->client, received_time);
+        if(consumed == -1)
+        {
+            reject();
+            return;
+        }
+
+        connection->input.consume(consumed);
+    }
+}
+
+void uring_on_accept(reactor_t& reactor, const io_uring_cqe& cqe)
+{
+    if(cqe.res == -EINVAL || cqe.res == -EBADF) //the server socket was shut down
+    {
+        return;
+    }
+
+    if(!(cqe.flags & IORING_CQE_F_MORE))
+    {
+        uring_submit_accept(reactor);
+    }
+
+    if(cqe.res < 0)
+    {
+        if(cqe.res != -EAGAIN && cqe.res != -EINTR && cqe.res != -ECANCELED)
+        {
+            LOG_ERROR("error on accept: {}", strerror(-cqe.res));
+        }
+
+        return;
+    }
+
+    sockaddr_in client_addr{};
+    socklen_t client_addr_len = sizeof(client_addr);
+    (void)getpeername(cqe.res, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len);
+
+    LOG("client connected: {}", address2string(client_addr));
+
+    auto connection = new uring_connection_t{};
+    connection->socket = cqe.res;
+    connection->client = add_client(connection->socket, client_addr, reactor.index);
+    reactor.uring->connections[connection->socket] = connection;
+
+    uring_submit_recv(reactor.uring, connection);
+}
+
+void uring_on_recv(reactor_t& reactor, uring_connection_t* connection, const io_uring_cqe& cqe)
+{
+    if(cqe.flags & IORING_CQE_F_BUFFER)
+    {
+        const uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if(cqe.res > 0)
+        {
+            uring_on_received(connection, reactor.uring->recv_buffer_memory + (buffer_id * uring_recv_buffer_size), cqe.res);
+        }
+
+        uring_recycle_recv_buffer(reactor.uring, buffer_id);
+    }
+
+    if(cqe.flags & IORING_CQE_F_MORE)
+    {
+        return;
+    }
+
+    if(cqe.res > 0 || cqe.res == -ENOBUFS) //the multishot receive stopped but the connection is still alive
+    {
+        uring_submit_recv(reactor.uring, connection);
+        return;
+    }
+
+    uring_close_connection(reactor.uring, connection, cqe.res);
+}
+
+void uring_on_write(reactor_t& reactor, uring_connection_t* connection, const io_uring_cqe& cqe)
+{
+    if(cqe.res > 0 && !connection->closed)
+    {
+        connection->write_offset += cqe.res;
+        if(connection->write_offset < connection->write_size)
+        {
+            uring_continue_write(reactor.uring, connection);
+            return;
+        }
+    }
+    else if(cqe.res <= 0) //the receive side notices the broken connection and closes it
+    {
+        connection->discard_queued();
+    }
+
+    if(connection->send_slot != -1)
+    {
+        reactor.uring->free_send_slots.push_back(connection->send_slot);
+        connection->send_slot = -1;
+    }
+
+    connection->unregistered_output.clear();
+    connection->writing = false;
+
+    if(connection->closed)
+    {
+        delete connection;
+        return;
+    }
+
+    uring_start_write(reactor.uring, connection);
+}
+
+void* uring_reactor_loop(void* reactor_ptr)
+{
+    reactor_t& reactor = *static_cast<reactor_t*>(reactor_ptr);
+    current_reactor = &reactor;
+
+    uring_submit_accept(reactor);
+    uring_submit_wake_read(reactor.uring);
+
+    while(true)
+    {
+        //everything queued while handling the previous completions goes out in this one call
+        int result = reactor.uring->ring.submit_and_wait(1);
+        if(result < 0 && result != -EINTR && result != -EBUSY)
+        {
+            LOG_ERROR("error on io_uring_enter: {}", strerror(-result));
+        }
+
+        reactor.uring->ring.for_each_cqe([&reactor](const io_uring_cqe& cqe)
+        {
+            auto target = reinterpret_cast<uring_connection_t*>(cqe.user_data & ~uint64_t{0b111});
+
+            switch(static_cast<uring_operation_e>(cqe.user_data & 0b111))
+            {
+                case uring_operation_e::accept:
+                    uring_on_accept(reactor, cqe);
+                    break;
+                case uring_operation_e::recv:
+                    uring_on_recv(reactor, target, cqe);
+                    break;
+                case uring_operation_e::write:
+                    uring_on_write(reactor, target, cqe);
+                    break;
+                case uring_operation_e::wake:
+                    uring_drain_outbox(reactor.uring);
+                    uring_submit_wake_read(reactor.uring);
+                    break;
+            }
+        });
+    }
+}
+
+void destroy_uring_reactor(reactor_t& reactor)
+{
+    if(reactor.uring == nullptr)
+    {
+        return;
+    }
+
+    reactor.uring->ring.destroy();
+
+    if(reactor.uring->wake_event != -1)
+    {
+        close(reactor.uring->wake_event);
+    }
+
+    if(reactor.uring->recv_buffer_ring != nullptr)
+    {
+        munmap(reactor.uring->recv_buffer_ring, uring_recv_buffer_count * sizeof(io_uring_buf));
+    }
+
+    std::free(reactor.uring->recv_buffer_memory);
+    std::free(reactor.uring->send_slot_memory);
+
+    delete reactor.uring;
+    reactor.uring = nullptr;
+}
+
+//kernels before 6.0 register provided buffer rings but fail every multishot receive with -EINVAL, which would drop each connection.
+//a multishot receive on a socket pair whose peer already shut down completes with 0 where it is supported
+int probe_multishot_recv(uring_reactor_t* uring)
+{
+    int sockets[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1)
+    {
+        return -errno;
+    }
+    (void)shutdown(sockets[1], SHUT_WR);
+
+    io_uring_sqe* sqe = uring->ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockets[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+
+    int result = uring->ring.submit_and_wait(1);
+    if(result >= 0)
+    {
+        uring->ring.for_each_cqe([uring, &result](const io_uring_cqe& cqe)
+        {
+            result = std::min(cqe.res, 0);
+            if(cqe.flags & IORING_CQE_F_BUFFER)
+            {
+                uring_recycle_recv_buffer(uring, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+        });
+    }
+
+    close(sockets[0]);
+    close(sockets[1]);
+    return result;
+}
+
+//returns -errno on failure, the caller falls back to epoll
+int init_uring_reactor(reactor_t& reactor)
+{
+    reactor.uring = new uring_reactor_t{};
+    uring_reactor_t* uring = reactor.uring;
+
+    if(int error = uring->ring.init(uring_queue_depth); error < 0)
+    {
+        return error;
+    }
+
+    uring->send_slot_memory = static_cast<uint8_t*>(std::aligned_alloc(4096, uring_send_slot_count * uring_send_slot_size));
+    uring->recv_buffer_memory = static_cast<uint8_t*>(std::aligned_alloc(4096, uring_recv_buffer_count * uring_recv_buffer_size));
+
+    iovec send_region{.iov_base = uring->send_slot_memory, .iov_len = uring_send_slot_count * uring_send_slot_size};
+    if(int error = uring->ring.register_resource(IORING_REGISTER_BUFFERS, &send_region, 1); error < 0)
+    {
+        return error;
+    }
+
+    for(uint32_t slot = 0; slot < uring_send_slot_count; ++slot)
+    {
+        uring->free_send_slots.push_back(slot);
+    }
+
+    void* buffer_ring = mmap(nullptr, uring_recv_buffer_count * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(buffer_ring == MAP_FAILED)
+    {
+        return -errno;
+    }
+    uring->recv_buffer_ring = static_cast<io_uring_buf_ring*>(buffer_ring);
+
+    io_uring_buf_reg buffer_ring_registration{}; //the kernel rejects the registration unless the padding is zero
+    buffer_ring_registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+    buffer_ring_registration.ring_entries = uring_recv_buffer_count;
+    buffer_ring_registration.bgid = 0;
+
+    if(int error = uring->ring.register_resource(IORING_REGISTER_PBUF_RING, &buffer_ring_registration, 1); error < 0)
+    {
+        return error;
+    }
+
+    for(uint16_t buffer_id = 0; buffer_id < uring_recv_buffer_count; ++buffer_id)
+    {
+        uring_recycle_recv_buffer(uring, buffer_id);
+    }
+
+    if(int error = probe_multishot_recv(uring); error < 0)
+    {
+        return error;
+    }
+
+    uring->wake_event = eventfd(0, EFD_CLOEXEC);
+    if(uring->wake_event == -1)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+//answers a scrape of the metrics port, the histograms are summed over every thread that recorded into them
+void format_server_metrics(std::string* output)
+{
+    constexpr uint32_t message_type_count = static_cast<uint32_t>(client_message_type_e::max) + 1;
+    constexpr uint32_t stage_count = static_cast<uint32_t>(message_stage_e::max);
+    constexpr uint32_t lock_count = static_cast<uint32_t>(lock_metric_e::max);
+    constexpr std::string_view stage_names[] = {"queued", "handler", "send"};
+    constexpr std::string_view lock_names[] = {"handlers", "handlers", "clients", "clients"};
+    constexpr std::string_view lock_modes[] = {"read", "write", "read", "write"};
+
+    auto totals = std::make_unique<histogram_totals_t[]>((message_type_count * stage_count) + 1 + lock_count); //too large for the stack
+    histogram_totals_t* message_totals = &totals[0];
+    histogram_totals_t& fan_out_totals = totals[message_type_count * stage_count];
+    histogram_totals_t* lock_totals = &totals[(message_type_count * stage_count) + 1];
+
+    for(const thread_metrics_t* metrics = all_thread_metrics.load(std::memory_order_acquire); metrics != nullptr; metrics = metrics->next)
+    {
+        for(uint32_t type = 0; type < message_type_count; ++type)
+        {
+            for(uint32_t stage = 0; stage < stage_count; ++stage)
+            {
+                message_totals[(type * stage_count) + stage].add(metrics->message_latency[type][stage]);
+            }
+        }
+
+        fan_out_totals.add(metrics->broadcast_fan_out);
+        for(uint32_t lock = 0; lock < lock_count; ++lock)
+        {
+            lock_totals[lock].add(metrics->lock_wait[lock]);
+        }
+    }
+
+    auto out = std::back_inserter(*output);
+
+    output->append("# HELP stall_message_seconds time a client message spent queued after its recv, in its handler and sending inside the handler\n"
+                   "# TYPE stall_message_seconds histogram\n");
+    for(uint32_t type = 0; type < message_type_count; ++type)
+    {
+        for(uint32_t stage = 0; stage < stage_count; ++stage)
+        {
+            const std::string labels = fmt::format("type=\"{}\",stage=\"{}\"", client_message_type_names[type], stage_names[stage]);
+            message_totals[(type * stage_count) + stage].format(output, "stall_message_seconds", labels, 1e9);
+        }
+    }
+
+    output->append("# HELP stall_broadcast_fan_out clients a change was sent to\n"
+                   "# TYPE stall_broadcast_fan_out histogram\n");
+    fan_out_totals.format(output, "stall_broadcast_fan_out", "scope=\"change\"", 1);
+
+    output->append("# HELP stall_lock_wait_seconds time spent waiting for a lock, zero when it was free\n"
+                   "# TYPE stall_lock_wait_seconds histogram\n");
+    for(uint32_t lock = 0; lock < lock_count; ++lock)
+    {
+        const std::string labels = fmt::format("lock=\"{}\",mode=\"{}\"", lock_names[lock], lock_modes[lock]);
+        lock_totals[lock].format(output, "stall_lock_wait_seconds", labels, 1e9);
+    }
+
+    pthread_rwlock_rdlock(&clients_lock); //the gauges are read with the plain locks, a scrape is not worth timing
+    const uint64_t client_count = clients.size();
+    pthread_rwlock_unlock(&clients_lock);
+
+    const uint64_t handler_count = handlers.named_count.load(std::memory_order_relaxed);
+    pthread_rwlock_rdlock(&handlers_lock);
+    const uint64_t year_count = handlers.years.size();
+    const uint64_t name_count = handlers.names.index.size();
+    pthread_rwlock_unlock(&handlers_lock);
+
+    fmt::format_to(out, "# HELP stall_connected_clients clients currently connected\n# TYPE stall_connected_clients gauge\nstall_connected_clients {}\n", client_count);
+    fmt::format_to(out, "# HELP stall_handlers handlers with a name\n# TYPE stall_handlers gauge\nstall_handlers {}\n", handler_count);
+    fmt::format_to(out, "# HELP stall_handler_years years with a block in the handler table\n# TYPE stall_handler_years gauge\nstall_handler_years {}\n", year_count);
+    fmt::format_to(out, "# HELP stall_handler_names distinct names in the handler table\n# TYPE stall_handler_names gauge\nstall_handler_names {}\n", name_count);
+}
+
+//the cpus this process may run on, in order. reactors are pinned to them and accepts are steered by them, so both agree on which
+//reactor serves which cpu even when the affinity mask or the online cpus leave gaps in the numbering
+std::vector<uint32_t> allowed_cpus()
+{
+    std::vector<uint32_t> cpus{};
+
+    cpu_set_t affinity{};
+    if(sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
+    {
+        for(uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if(CPU_ISSET(cpu, &affinity))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    else
+    {
+        perror("sched_getaffinity");
+    }
+
+    if(cpus.empty())
+    {
+        cpus.push_back(0);
+    }
+
+    return cpus;
+}
+
+bool parse_options(int argc, char** argv, server_options_t* options)
+{
+    constexpr option long_options[] = {
+        {"reactors", required_argument, nullptr, 'r'},
+        {"io", required_argument, nullptr, 'i'},
+        {"backlog", required_argument, nullptr, 'b'},
+        {"shard-accept", no_argument, nullptr, 's'},
+        {"pin-cpus", no_argument, nullptr, 'p'},
+        {"data-dir", required_argument, nullptr, 'd'},
+        {"snapshot-interval", required_argument, nullptr, 'n'},
+        {"coalesce-ms", required_argument, nullptr, 'c'},
+        {"max-frame-size", required_argument, nullptr, 'f'},
+        {"receive-budget", required_argument, nullptr, 'm'},
+        {"log-level", required_argument, nullptr, 'l'},
+        {"metrics-port", required_argument, nullptr, 'e'},
+        {"capture", required_argument, nullptr, 'a'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int option_char;
+    while((option_char = getopt_long(argc, argv, "r:i:b:spd:n:c:f:m:l:e:a:", long_options, nullptr)) != -1)
+    {
+        switch(option_char)
+        {
+            case 'r':
+                options->reactor_count = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'i':
+                if(std::strcmp(optarg, "epoll") == 0)
+                {
+                    options->io_backend = io_backend_e::epoll;
+                }
+                else if(std::strcmp(optarg, "uring") == 0)
+                {
+                    options->io_backend = io_backend_e::uring;
+                }
+                else
+                {
+                    LOG_ERROR("unknown io backend {}", optarg);
+                    return false;
+                }
+                break;
+            case 'b':
+            {
+                char* end = nullptr;
+                errno = 0;
+                const long backlog = std::strtol(optarg, &end, 10);
+                if(errno != 0 || end == optarg || *end != '\0' || backlog <= 0 || backlog > INT_MAX)
+                {
+                    LOG_ERROR("the backlog has to be a number from 1 to {}", INT_MAX);
+                    return false;
+                }
+
+                options->backlog = static_cast<int>(backlog);
+                break;
+            }
+            case 's':
+                options->shard_accept = true;
+                break;
+            case 'p':
+                options->pin_cpus = true;
+                break;
+            case 'd':
+                options->data_directory = optarg;
+                break;
+            case 'n':
+                options->snapshot_interval = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'c':
+                options->coalesce_window = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'f':
+                options->max_frame_size = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'm':
+                options->receive_budget = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'l':
+            {
+                auto level = std::find(std::begin(log_level_names), std::end(log_level_names), optarg);
+                if(level == std::end(log_level_names))
+                {
+                    LOG_ERROR("unknown log level {}", optarg);
+                    return false;
+                }
+
+                options->log_level = static_cast<log_level_e>(std::distance(std::begin(log_level_names), level));
+                break;
+            }
+            case 'e':
+                options->metrics_port = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'a':
+                options->capture_path = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if(optind + 1 != argc)
+    {
+        LOG_ERROR("port number not supplied");
+        return false;
+    }
+
+    errno = 0;
+    options->port = std::strtoul(argv[optind], nullptr, 10);
+    if(errno != 0)
+    {
+        perror("strtoul");
+        return false;
+    }
+
+    if(options->reactor_count == 0)
+    {
+        options->reactor_count = allowed_cpus().size();
+    }
+
+    if(options->max_frame_size < frame_header_size || options->max_frame_size > options->receive_budget)
+    {
+        LOG_ERROR("the max frame size has to fit in the receive budget");
+        return false;
+    }
+
+    return true;
+}
+
+std::string handlers_wal_path(const char* data_directory, uint64_t generation)
+{
+    return fmt::format("{}/handlers.{}.wal", data_directory, generation);
+}
+
+std::string handlers_snapshot_path(const char* data_directory)
+{
+    return fmt::format("{}/handlers.snapshot", data_directory);
+}
+
+bool list_wal_generations(const char* data_directory, std::vector<uint64_t>* generations)
+{
+    DIR* directory = opendir(data_directory);
+    if(directory == nullptr)
+    {
+        perror("opendir");
+        return false;
+    }
+
+    while(dirent* entry = readdir(directory))
+    {
+        uint64_t generation;
+        int name_length = 0;
+        if(std::sscanf(entry->d_name, "handlers.%lu.wal%n", &generation, &name_length) == 1 && entry->d_name[name_length] == '\0')
+        {
+            generations->push_back(generation);
+        }
+    }
+
+    closedir(directory);
+
+    std::sort(generations->begin(), generations->end());
+    return true;
+}
+
+//log files older than the snapshot are fully contained in it
+void remove_wal_generations_before(const char* data_directory, uint64_t generation)
+{
+    std::vector<uint64_t> generations{};
+    if(!list_wal_generations(data_directory, &generations))
+    {
+        return;
+    }
+
+    for(uint64_t old_generation : generations)
+    {
+        if(old_generation < generation && unlink(handlers_wal_path(data_directory, old_generation).c_str()) == -1)
+        {
+            perror("unlink");
+        }
+    }
+}
+
+//data directories written before log generations existed have a single handlers.wal. its records are still readable, so it becomes the first generation
+bool migrate_legacy_wal(const char* data_directory, uint64_t first_generation)
+{
+    const std::string legacy_path = fmt::format("{}/handlers.wal", data_directory);
+    if(access(legacy_path.c_str(), F_OK) == -1)
+    {
+        return errno == ENOENT;
+    }
+
+    std::vector<uint64_t> generations{};
+    if(!list_wal_generations(data_directory, &generations))
+    {
+        return false;
+    }
+
+    if(!generations.empty())
+    {
+        LOG_WARNING("{} is left alone because log generations already exist next to it", legacy_path);
+        return true;
+    }
+
+    const std::string wal_path = handlers_wal_path(data_directory, first_generation);
+    if(rename(legacy_path.c_str(), wal_path.c_str()) == -1)
+    {
+        perror("rename");
+        return false;
+    }
+
+    int directory_file = ::open(data_directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directory_file == -1 || fsync(directory_file) == -1) //make the rename itself durable
+    {
+        perror("fsync");
+    }
+
+    if(directory_file != -1)
+    {
+        ::close(directory_file);
+    }
+
+    LOG("migrated {} to {}", legacy_path, wal_path);
+    return true;
+}
+
+//everything needed to rebuild the handlers of one year, independent of every other year
+struct year_load_t
+{
+    uint32_t year = 0;
+    const snapshot_entry_t* snapshot_entries = nullptr;
+    uint64_t snapshot_entry_count = 0;
+    std::vector<std::tuple<uint64_t, uint32_t, std::u16string_view>> changes{}; //log records in the order they were appended
+};
+
+struct load_partition_t
+{
+    pthread_t thread = 0;
+    const snapshot_view_t* snapshot = nullptr;
+    std::vector<const year_load_t*> years{};
+    handler_table_t handlers{};
+};
+
+void* load_partition(void* partition_ptr)
+{
+    load_partition_t& partition = *static_cast<load_partition_t*>(partition_ptr);
+
+    for(const year_load_t* year : partition.years)
+    {
+        for(uint64_t index = 0; index < year->snapshot_entry_count; ++index)
+        {
+            const snapshot_entry_t& entry = year->snapshot_entries[index];
+            const auto key = std::bit_cast<handler_key_t>(entry.key);
+            if(handler_table_t::valid_key(key)) //keys were not checked before the table became dense
+            {
+                partition.handlers.set(key, partition.snapshot->name(entry), entry.version);
+            }
+        }
+
+        for(const auto& [key_bits, version, name] : year->changes)
+        {
+            const auto key = std::bit_cast<handler_key_t>(key_bits);
+            if(handler_table_t::valid_key(key))
+            {
+                partition.handlers.set(key, name, version);
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+struct load_summary_t
+{
+    uint64_t snapshot_entries = 0;
+    uint64_t wal_records = 0;
+    uint64_t wal_files = 0;
+    uint64_t discarded_bytes = 0;
+    uint64_t years = 0;
+    uint64_t threads = 0;
+};
+
+//maps the latest snapshot and the log files written after it, then rebuilds every year on its own thread
+bool load_handlers(const char* data_directory, load_summary_t* summary)
+{
+    const std::string snapshot_path = handlers_snapshot_path(data_directory);
+
+    snapshot_view_t snapshot{};
+    uint64_t first_generation = 0;
+
+    if(snapshot.map(snapshot_path.c_str()))
+    {
+        first_generation = snapshot.header->wal_generation;
+        summary->snapshot_entries = snapshot.header->entry_count;
+    }
+    else if(errno != ENOENT)
+    {
+        LOG_ERROR("could not load snapshot {}: {}", snapshot_path, strerror(errno));
+        return false;
+    }
+
+    if(!migrate_legacy_wal(data_directory, first_generation))
+    {
+        return false;
+    }
+
+    std::vector<uint64_t> generations{};
+    if(!list_wal_generations(data_directory, &generations))
+    {
+        return false;
+    }
+
+    std::erase_if(generations, [first_generation](uint64_t generation){ return generation < first_generation; });
+    remove_wal_generations_before(data_directory, first_generation);
+
+    std::vector<year_load_t> years{};
+    std::unordered_map<uint32_t, uint64_t> year_indices{};
+
+    auto find_year = [&years, &year_indices](uint32_t year) -> year_load_t&
+    {
+        auto [index, inserted] = year_indices.try_emplace(year, years.size());
+        if(inserted)
+        {
+            years.push_back(year_load_t{.year = year});
+        }
+        return years[index->second];
+    };
+
+    for(uint64_t index = 0; snapshot.contents != nullptr && index < snapshot.header->year_count; ++index)
+    {
+        year_load_t& year = find_year(snapshot.years[index].year);
+        year.snapshot_entries = snapshot.entries + snapshot.years[index].first_entry;
+        year.snapshot_entry_count = snapshot.years[index].entry_count;
+    }
+
+    std::vector<wal_file_view_t> wal_files(generations.size());
+    for(uint64_t index = 0; index < generations.size(); ++index)
+    {
+        if(!wal_files[index].map(handlers_wal_path(data_directory, generations[index]).c_str()))
+        {
+            return false;
+        }
+
+        //records are only bucketed here, applying them is what gets spread over the threads
+        wal_files[index].for_each_record([&find_year](uint64_t key, uint32_t version, std::u16string_view name)
+        {
+            find_year(std::bit_cast<handler_key_t>(key).year).changes.emplace_back(key, version, name);
+        });
+
+        summary->wal_records += wal_files[index].records;
+        summary->discarded_bytes += wal_files[index].size - wal_files[index].valid_size;
     }
-}
 
-struct __attribute__((packed)) handler_key_t
-{
-    handler_id_t id;
-    uint16_t day_of_year;
-    uint32_t year;
+    summary->wal_files = wal_files.size();
+    summary->years = years.size();
+    summary->threads = std::min<uint64_t>(years.size(), std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
 
-    constexpr friend bool operator==(const handler_key_t& lhs, const handler_key_t& rhs)
+    std::vector<load_partition_t> partitions(summary->threads);
+    for(uint64_t index = 0; index < years.size(); ++index)
     {
-        return std::bit_cast<uint64_t>(lhs) == std::bit_cast<uint64_t>(rhs);
+        partitions[index % partitions.size()].years.push_back(&years[index]);
     }
 
-    std::string to_string() const
+    for(load_partition_t& partition : partitions)
     {
-        return fmt::format("id: {}, day: {}, year: {}", handler_id2string(id), day_of_year, year);
+        partition.snapshot = &snapshot;
+
+        if(int error = pthread_create(&partition.thread, nullptr, &load_partition, &partition); error != 0)
+        {
+            LOG_ERROR("error creating load thread {}", strerror(error));
+            return false;
+        }
     }
-};
 
-template<>
-struct std::hash<handler_key_t>
-{
-    constexpr size_t operator()(const handler_key_t& in) const
+    for(load_partition_t& partition : partitions)
     {
-        return std::bit_cast<size_t>(in);
+        pthread_join(partition.thread, nullptr);
+        handlers.merge(partition.handlers); //years never overlap between partitions so every year block is moved over
     }
-};
 
-sig_atomic_t shutdown_server = 0;
-int server_socket = 0;
+    uint64_t newest_generation = first_generation;
+    uint64_t newest_valid_size = 0;
+    if(!generations.empty())
+    {
+        newest_generation = generations.back();
+        newest_valid_size = wal_files.back().valid_size;
+    }
 
-std::vector<client_t> clients{};
-pthread_rwlock_t clients_lock{};
+    for(wal_file_view_t& wal_file : wal_files)
+    {
+        wal_file.unmap();
+    }
+    snapshot.unmap();
 
-std::unordered_map<handler_key_t, std::u16string> handlers{};
-pthread_rwlock_t handlers_lock{};
+    handlers_wal_generation = newest_generation;
 
-enum class client_message_type_e : uint32_t
-{
-    login = 0,
-    get_handler,
-    set_handler,
-    max
-};
+    const std::string wal_path = handlers_wal_path(data_directory, newest_generation);
+    if(!handlers_wal.open(wal_path.c_str(), newest_valid_size))
+    {
+        LOG_ERROR("could not open write ahead log {}", wal_path);
+        return false;
+    }
 
-enum class server_message_type_e : uint32_t
-{
-    login_response = 0,
-    sent_handler_name,
-    max
-};
+    return true;
+}
 
-struct server_message_t
+//copies the table and rotates the log at the same point, then writes the copy out and deletes the logs it replaces
+bool take_snapshot(const char* data_directory)
 {
-    std::vector<uint8_t> message_buffer{};
-
-    server_message_t(server_message_type_e message_type, uint32_t data_size)
+    if(handlers_wal.records_since_last_rotation() == 0)
     {
-        message_buffer.resize(8 + data_size);
-        reinterpret_cast<uint32_t&>(message_buffer[0]) = static_cast<uint32_t>(message_type);
-        reinterpret_cast<uint32_t&>(message_buffer[4]) = data_size;
+        return true;
     }
 
-    uint8_t* message_data()
+    const uint64_t next_generation = handlers_wal_generation + 1;
+    const std::string next_wal_path = handlers_wal_path(data_directory, next_generation);
+
+    int next_wal = open(next_wal_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(next_wal == -1)
     {
-        return message_buffer.data() + 8;
+        perror("open");
+        return false;
     }
-};
 
-std::string address2string(sockaddr_in address)
-{
-    return fmt::format("{}:{}", inet_ntoa(address.sin_addr), address.sin_port);
-}
+    std::vector<snapshot_source_entry_t> entries{};
 
-std::string timestamp_formatted()
-{
-    time_t now;
-    time(&now);
+    timed_rdlock(&handlers_lock, lock_metric_e::handlers_read); //sets append to the log while holding the write lock, so the copy and the rotation see the same changes
 
-    char buffer[100];
-    size_t size = strftime(buffer, sizeof(buffer), "%a %Y-%m-%d %H:%M:%S %Z", localtime(&now));
+    handlers.for_each([&entries](handler_key_t key, uint32_t version, std::u16string_view name) //already in the year and key order the snapshot is laid out in
+    {
+        entries.push_back(snapshot_source_entry_t{.year = key.year, .key = std::bit_cast<uint64_t>(key), .version = version, .name = std::u16string{name}});
+    });
 
-    return std::string{buffer, size};
-}
+    const uint64_t compacted_records = handlers_wal.rotate(next_wal);
 
-std::string cvt_str16_to_str8(std::u16string_view str)
-{
-    std::string converted{};
-    converted.resize(str.size());
+    pthread_rwlock_unlock(&handlers_lock);
 
-    for(uint64_t index = 0; index < str.size(); ++index)
+    handlers_wal_generation = next_generation;
+
+    const std::string snapshot_path = handlers_snapshot_path(data_directory);
+    if(!write_snapshot(snapshot_path.c_str(), data_directory, next_generation, entries))
     {
-        converted[index] = str[index] > 128 ? '?' : static_cast<char>(str[index]);
+        LOG_ERROR("could not write snapshot {}", snapshot_path);
+        return false;
     }
 
-    return converted;
-}
+    handlers_wal.wait_for_rotation();
+    remove_wal_generations_before(data_directory, next_generation);
 
-void sigterm_handler(int, siginfo_t*, void*)
-{
-    shutdown_server = 1;
+    LOG("snapshot of {} handlers written, compacted {} logged changes", entries.size(), compacted_records);
+    return true;
 }
 
-void close_server_socket()
+void* snapshot_loop(void* interval_ptr)
 {
-    if(shutdown(server_socket, SHUT_RDWR) == -1)
-    {
-        perror("shutdown");
-    }
+    const uint32_t interval_seconds = *static_cast<const uint32_t*>(interval_ptr);
 
-    if(close(server_socket) == -1)
+    while(true)
     {
-        perror("close");
+        sleep(interval_seconds);
+        (void)take_snapshot(current_data_directory);
     }
 }
 
-void disconnect_clients()
+int open_server_socket(const server_options_t& options)
 {
-    pthread_rwlock_wrlock(&clients_lock);
-    for(const client_t& client : clients)
+    //io_uring fails accepts on a non-blocking socket with EAGAIN instead of waiting
+    const int socket_flags = SOCK_CLOEXEC | (io_backend == io_backend_e::epoll ? SOCK_NONBLOCK : 0);
+
+    int server_socket = socket(AF_INET, SOCK_STREAM | socket_flags, 0);
+    if(server_socket == -1)
     {
-        if(shutdown(client.socket, SHUT_RDWR) == -1)
-        {
-            perror("shutdown");
-        }
+        perror("socket");
+        return -1;
     }
-    pthread_rwlock_unlock(&clients_lock);
 
-    while(true)
+    server_sockets.push_back(server_socket);
+
+    const int enable = 1;
+    if(options.shard_accept && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
     {
-        pthread_rwlock_rdlock(&clients_lock);
-        const uint64_t remaining = clients.size();
-        pthread_rwlock_unlock(&clients_lock);
+        perror("setsockopt");
+        return -1;
+    }
 
-        if(remaining == 0)
-        {
-            break;
-        }
+    const sockaddr_in server_addr{
+        .sin_family = AF_INET,
+        .sin_port = htons(options.port),
+        .sin_addr = {.s_addr = htonl(INADDR_ANY)},
+        .sin_zero = {}
+    };
 
-        sched_yield();
+    if(bind(server_socket, reinterpret_cast<const sockaddr*>(&server_addr), sizeof(server_addr)) == -1)
+    {
+        perror("bind");
+        return -1;
+    }
+
+    if(listen(server_socket, options.backlog) == -1)
+    {
+        perror("listen");
+        return -1;
     }
+
+    return server_socket;
 }
 
-ssize_t read_client_message(int socket, uint32_t* buffer_size, void* buffer)
+//makes the kernel hand a connection to the socket of the reactor pinned to the cpu that received it, instead of hashing the address
+//reactor n is pinned to cpus[n % cpus.size()], so a connection arriving on cpus[n] goes to reactor n % reactor_count. the program
+//compares the cpu against every allowed one, cpus without a match fall back to the default hash
+bool steer_accepts_by_cpu(int server_socket, uint32_t reactor_count, const std::vector<uint32_t>& cpus)
 {
-    if(buffer == nullptr)
+    std::vector<sock_filter> select_by_cpu{};
+    select_by_cpu.push_back({BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)});
+
+    for(uint32_t position = 0; position < cpus.size(); ++position)
     {
-        struct{
-            uint32_t type;
-            uint32_t size;
-        } message_header;
+        select_by_cpu.push_back({BPF_JMP | BPF_JEQ | BPF_K, 0, 1, cpus[position]});
+        select_by_cpu.push_back({BPF_RET | BPF_K, 0, 0, position % reactor_count});
+    }
 
-        ssize_t nread = recv(socket, &message_header, sizeof(message_header), MSG_WAITALL | MSG_PEEK);
-        if(nread <= 0)
-        {
-            return nread;
-        }
+    select_by_cpu.push_back({BPF_RET | BPF_K, 0, 0, UINT32_MAX}); //out of range, the kernel picks a socket by hash
 
-        *buffer_size = sizeof(message_header) + message_header.size;
-        return 1;
-    }
-    else
+    if(select_by_cpu.size() > BPF_MAXINSNS)
     {
-        return recv(socket, buffer, *buffer_size, MSG_WAITALL);
+        LOG_WARNING("too many cpus to steer accepts by cpu");
+        return false;
     }
-}
-
-bool find_client(pthread_t listener, client_t* result)
-{
-    pthread_rwlock_rdlock(&clients_lock);
 
-    for(const client_t& client : clients)
+    const sock_fprog program{.len = static_cast<uint16_t>(select_by_cpu.size()), .filter = select_by_cpu.data()};
+    if(setsockopt(server_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1)
     {
-        if(client.listener == listener)
-        {
-            *result = client;
-            pthread_rwlock_unlock(&clients_lock);
-            return true;
-        }
+        perror("setsockopt");
+        return false;
     }
 
-    pthread_rwlock_unlock(&clients_lock);
-    return false;
+    return true;
 }
 
-template<typename C>
-bool mutate_client(pthread_t listener, C mutator)
+bool pin_reactor(pthread_attr_t* thread_attr, uint32_t cpu)
 {
-    pthread_rwlock_wrlock(&clients_lock);
+    cpu_set_t cpus{};
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
 
-    for(client_t& client : clients)
+    if(int error = pthread_attr_setaffinity_np(thread_attr, sizeof(cpus), &cpus); error != 0)
     {
-        if(client.listener == listener)
-        {
-            mutator(&client);
-            pthread_rwlock_unlock(&clients_lock);
-            return true;
-        }
+        LOG_WARNING("could not pin reactor to cpu {}: {}", cpu, strerror(error));
+        return false;
     }
 
-    pthread_rwlock_unlock(&clients_lock);
-    return false;
+    return true;
 }
 
-void on_invalid_message(std::span<uint8_t> message, client_t sender)
-{
-    LOG("recieved invalid message {}. from: {}", reinterpret_cast<const uint32_t&>(message[0]), address2string(sender.address));
-}
+#ifndef STALL_BENCHMARK //the benchmarks include this file to reach the server internals and bring their own main
 
-void on_login_request(std::span<uint8_t> message, client_t sender)
+int main(int argc, char** argv)
 {
-    constexpr char password[] = "washington";
-    auto entered_password = reinterpret_cast<const char*>(&message[8]);
+    timespec start_time{};
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-    server_message_t response{server_message_type_e::login_response, 1};
-    *response.message_data() = (std::strcmp(password, entered_password) == 0);
+    struct sigaction on_terminate{};
+    on_terminate.sa_sigaction = &sigterm_handler;
 
-    LOG("login request: {} : {}", address2string(sender.address), *response.message_data() ? "success" : "failure");
+    if(sigaction(SIGTERM, &on_terminate, nullptr) == -1)
+    {
+        perror("sigaction");
+        return EXIT_FAILURE;
+    }
 
-    auto set_login_status = [accepted = *response.message_data()](client_t* client){
-        client->logged_in = accepted;
-    };
+    struct sigaction ignore{};
+    ignore.sa_handler = SIG_IGN;
 
-    if(mutate_client(sender.listener, set_login_status))
+    if(sigaction(SIGPIPE, &ignore, nullptr) == -1) //io_uring writes to a socket the peer has closed raise SIGPIPE, there is no MSG_NOSIGNAL for them
     {
-        (void)send(sender.socket, response.message_buffer.data(), response.message_buffer.size(), MSG_NOSIGNAL);
+        perror("sigaction");
+        return EXIT_FAILURE;
     }
-}
 
-void on_get_handler_request(std::span<uint8_t> message, client_t sender)
-{
-    if(message.size() != 16)
+    if(!logger.start() || atexit([]{ logger.stop(); }) != 0) //registered first so it runs last and writes what the other handlers log
     {
-        on_invalid_message(message, sender);
-        return;
+        perror("logger");
+        return EXIT_FAILURE;
     }
 
-    auto key = *reinterpret_cast<const handler_key_t*>(&message[8]);
-
-    LOG("{} requested handler {}", address2string(sender.address), key.to_string());
-
-    pthread_rwlock_wrlock(&handlers_lock);
-    std::u16string handler_name = handlers[key];
-    pthread_rwlock_unlock(&handlers_lock);
-
-    const uint64_t handler_name_bytes = ((handler_name.size() + 1) * 2);
-
-    server_message_t response{server_message_type_e::sent_handler_name, static_cast<uint32_t>(sizeof(handler_key_t) + handler_name_bytes)};
-    std::memcpy(response.message_data(), &key, sizeof(handler_key_t));
-    std::memcpy(response.message_data() + sizeof(handler_key_t), handler_name.data(), handler_name_bytes);
-
-    (void)send(sender.socket, response.message_buffer.data(), response.message_buffer.size(), MSG_NOSIGNAL);
-}
-
-void on_set_handler_request(std::span<uint8_t> message, client_t sender)
-{
-    if(message.size() <= 16)
+    server_options_t options{};
+    if(!parse_options(argc, argv, &options))
     {
-        on_invalid_message(message, sender);
-        return;
+        LOG_ERROR("usage: {} [--reactors count] [--io epoll|uring] [--backlog length] [--shard-accept] [--pin-cpus] [--data-dir path] [--snapshot-interval seconds] [--coalesce-ms milliseconds] [--max-frame-size bytes] [--receive-budget bytes] [--log-level debug|info|warning|error] [--metrics-port port] [--capture path] port", argv[0]);
+        return EXIT_FAILURE;
     }
 
-    if(!sender.logged_in)
+    if(atexit(&close_server_sockets) != 0)
     {
-        LOG("{} tried to set a handler name but is not logged in", address2string(sender.address));
-        return;
+        perror("atexit");
+        return EXIT_FAILURE;
     }
 
-    auto key = *reinterpret_cast<const handler_key_t*>(&message[8]);
-    std::u16string handler_name{reinterpret_cast<const char16_t*>(&message[16]), ((message.size() - 16) / 2) - 1};
-
-    LOG("{}: set handler {} to {}", address2string(sender.address), key.to_string(), cvt_str16_to_str8(handler_name));
-
-    pthread_rwlock_wrlock(&handlers_lock);
-    handlers[key] = handler_name;
-    pthread_rwlock_unlock(&handlers_lock);
-
-    const uint64_t handler_name_bytes = ((handler_name.size() + 1) * 2);
-
-    server_message_t broadcast_message{server_message_type_e::sent_handler_name, static_cast<uint32_t>(sizeof(handler_key_t) + handler_name_bytes)};
-    std::memcpy(broadcast_message.message_data(), &key, sizeof(handler_key_t));
-    std::memcpy(broadcast_message.message_data() + sizeof(handler_key_t), handler_name.data(), handler_name_bytes);
-
-    pthread_rwlock_rdlock(&clients_lock);
-    for(const client_t& client : clients)
+    reactors.resize(options.reactor_count);
+    for(uint32_t index = 0; index < reactors.size(); ++index)
     {
-        if(client.listener != sender.listener)
-        {
-            (void)send(client.socket, broadcast_message.message_buffer.data(), broadcast_message.message_buffer.size(), MSG_NOSIGNAL);
-        }
+        reactors[index].index = index;
     }
-    pthread_rwlock_unlock(&clients_lock);
-}
 
-void* client_listener(void*)
-{
-    auto on_recv_fail = [](ssize_t result, client_t client)
+    handler_readers.init(reactors.size());
+    handlers.names.reclaimer = &handler_readers;
+
+    logger.level = options.log_level;
+    io_backend = options.io_backend;
+    max_frame_size = options.max_frame_size;
+    receive_budget = options.receive_budget;
+    if(io_backend == io_backend_e::uring)
     {
-        if(result == 0)
+        for(reactor_t& reactor : reactors)
         {
-            LOG("client disconnected: {}", address2string(client.address));
-        }
-        else if(result == -1)
-        {
-            LOG("client: {}. error on recv: {}", address2string(client.address), strerror(errno));
+            if(int error = init_uring_reactor(reactor); error < 0)
+            {
+                LOG_WARNING("io_uring unavailable ({}), falling back to epoll", strerror(-error));
+                io_backend = io_backend_e::epoll;
+                break;
+            }
         }
 
-        mutate_client(pthread_self(), [](client_t* client) //remove client, it has disconnected or errored
+        if(io_backend == io_backend_e::epoll)
         {
-            if(close(client->socket) == -1)
+            for(reactor_t& reactor : reactors)
             {
-                perror("close");
+                destroy_uring_reactor(reactor);
             }
+        }
+    }
 
-            uint64_t index = std::distance(clients.data(), client);
-            clients[index] = clients.back();
-            clients.pop_back();
-        });
-
-        pthread_exit(nullptr);
-    };
-
-    while(true)
+    for(reactor_t& reactor : reactors)
     {
-        client_t client;
-        if(!find_client(pthread_self(), &client))
+        if(options.shard_accept || &reactor == &reactors.front())
         {
-            pthread_exit(nullptr);
+            reactor.server_socket = open_server_socket(options);
+            if(reactor.server_socket == -1)
+            {
+                return EXIT_FAILURE;
+            }
         }
-
-        uint32_t message_size;
-        ssize_t result = read_client_message(client.socket, &message_size, nullptr);
-        if(result <= 0)
+        else
         {
-            on_recv_fail(result, client);
+            reactor.server_socket = reactors.front().server_socket;
         }
+    }
 
-        std::vector<uint8_t> message_buffer(message_size);
-        result = read_client_message(client.socket, &message_size, message_buffer.data());
-        if(result <= 0)
-        {
-            on_recv_fail(result, client);
-        }
+    const std::vector<uint32_t> cpus = allowed_cpus();
 
-        switch(reinterpret_cast<client_message_type_e&>(message_buffer[0]))
-        {
-            case client_message_type_e::login:
-                on_login_request(message_buffer, client);
-                break;
-            case client_message_type_e::get_handler:
-                on_get_handler_request(message_buffer, client);
-                break;
-            case client_message_type_e::set_handler:
-                on_set_handler_request(message_buffer, client);
-                break;
-            default:
-                on_invalid_message(message_buffer, client);
-                break;
-        }
+    if(options.shard_accept && options.pin_cpus && !steer_accepts_by_cpu(reactors.front().server_socket, reactors.size(), cpus))
+    {
+        return EXIT_FAILURE;
     }
-}
 
-int main(int argc, char** argv)
-{
-    struct sigaction on_terminate{};
-    on_terminate.sa_sigaction = &sigterm_handler;
+    LOG("socket initialized and listening");
 
-    if(sigaction(SIGTERM, &on_terminate, nullptr) == -1)
+    pthread_rwlock_init(&clients_lock, nullptr);
+    pthread_rwlock_init(&handlers_lock, nullptr);
+
+    current_data_directory = options.data_directory;
+
+    timespec epoch_time{};
+    clock_gettime(CLOCK_REALTIME, &epoch_time);
+    handler_change_log.epoch = epoch_time.tv_sec * 1'000'000'000ull + epoch_time.tv_nsec; //sync points from an earlier run fall back to a full resync
+
+    load_summary_t load_summary{};
+    if(!load_handlers(options.data_directory, &load_summary))
     {
-        perror("sigaction");
         return EXIT_FAILURE;
     }
 
-    if(argc != 2)
+    LOG("loaded {} handlers from the snapshot and {} changes from {} log files, {} years on {} threads{}", load_summary.snapshot_entries,
+        load_summary.wal_records, load_summary.wal_files, load_summary.years, load_summary.threads,
+        load_summary.discarded_bytes != 0 ? fmt::format(", discarded {} bytes of torn records", load_summary.discarded_bytes) : "");
+
+    if(options.metrics_port != 0)
     {
-        LOG("port number not supplied");
-        return EXIT_FAILURE;
+        metrics_enabled = true; //set before any reactor starts and never changed afterwards, scrapes read the table so it has to be loaded
+
+        static metrics_server_t metrics_server{};
+        if(!metrics_server.start(options.metrics_port, &format_server_metrics))
+        {
+            return EXIT_FAILURE;
+        }
+
+        LOG("serving metrics on 127.0.0.1:{}", options.metrics_port);
     }
 
-    const uint16_t server_port = std::strtoul(argv[1], nullptr, 10);
-    if(errno != 0)
+    if(atexit(&close_handlers_wal) != 0) //registered before disconnect_clients so it runs after the last set has been handled
     {
-        perror("strtoul");
+        perror("atexit");
         return EXIT_FAILURE;
     }
 
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if(server_socket == -1)
+    if(!handler_audit.open(options.data_directory))
     {
-        perror("socket");
+        LOG_ERROR("could not open the audit log in {}", options.data_directory);
         return EXIT_FAILURE;
     }
 
-    if(atexit(&close_server_socket) != 0)
+    if(atexit(&close_handler_audit) != 0)
     {
         perror("atexit");
         return EXIT_FAILURE;
     }
 
-    const sockaddr_in server_addr{
-        .sin_family = AF_INET,
-        .sin_port = htons(server_port),
-        .sin_addr = {INADDR_ANY}
-    };
-
-    if(bind(server_socket, reinterpret_cast<const sockaddr*>(&server_addr), sizeof(server_addr)) == -1)
+    if(options.capture_path != nullptr)
     {
-        perror("bind");
-        return EXIT_FAILURE;
+        if(!traffic_capture.open(options.capture_path) || atexit(&close_traffic_capture) != 0) //closed after disconnect_clients recorded the disconnects
+        {
+            return EXIT_FAILURE;
+        }
+
+        LOG("capturing inbound traffic to {}", options.capture_path);
     }
 
-    if(listen(server_socket, 8) == -1)
+    if(atexit(&stop_set_coalescer) != 0) //runs after disconnect_clients, every set is already logged so only the thread has to go
     {
-        perror("listen");
+        perror("atexit");
         return EXIT_FAILURE;
     }
 
-    LOG("socket initialized and listening");
-
-    pthread_rwlock_init(&clients_lock, nullptr);
-    pthread_rwlock_init(&handlers_lock, nullptr);
-
-    pthread_attr_t detached_thread_attr{};
-    pthread_attr_init(&detached_thread_attr);
-    pthread_attr_setdetachstate(&detached_thread_attr, PTHREAD_CREATE_DETACHED);
-
     if(atexit(&disconnect_clients) != 0)
     {
         perror("atexit");
         return EXIT_FAILURE;
     }
 
-    while(shutdown_server == 0) //accept clients
+    sigset_t terminate_signal{};
+    sigemptyset(&terminate_signal);
+    sigaddset(&terminate_signal, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &terminate_signal, nullptr); //reactors inherit the mask so SIGTERM is always delivered to the main thread
+
+    if(!set_coalescer.start(options.coalesce_window))
     {
-        sockaddr_in client_addr{};
-        socklen_t client_addr_len = sizeof(client_addr);
-        int client_socket = accept(server_socket, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_len);
+        return EXIT_FAILURE;
+    }
 
-        if(client_socket == -1)
+    for(reactor_t& reactor : reactors)
+    {
+        if(io_backend == io_backend_e::epoll)
         {
-            perror("accept");
-            return EXIT_FAILURE;
+            reactor.epoll = epoll_create1(EPOLL_CLOEXEC);
+            if(reactor.epoll == -1)
+            {
+                perror("epoll_create1");
+                return EXIT_FAILURE;
+            }
+
+            //without sharding every reactor waits on the same server socket, EPOLLEXCLUSIVE makes sure only one of them is woken per connection
+            epoll_event accept_event{.events = EPOLLIN | EPOLLEXCLUSIVE, .data = {.ptr = nullptr}}; //client events carry their context
+            if(epoll_ctl(reactor.epoll, EPOLL_CTL_ADD, reactor.server_socket, &accept_event) == -1)
+            {
+                perror("epoll_ctl");
+                return EXIT_FAILURE;
+            }
         }
 
-        LOG("client connected: {}", address2string(client_addr));
+        pthread_attr_t reactor_thread_attr{};
+        pthread_attr_init(&reactor_thread_attr);
 
-        pthread_rwlock_wrlock(&clients_lock);
+        if(options.pin_cpus)
+        {
+            (void)pin_reactor(&reactor_thread_attr, cpus[reactor.index % cpus.size()]);
+        }
 
-        client_t& new_client = clients.emplace_back();
-        new_client.address = client_addr;
-        new_client.socket = client_socket;
-        new_client.logged_in = false;
+        auto loop = io_backend == io_backend_e::uring ? &uring_reactor_loop : &reactor_loop;
 
-        int listener_thread_error = pthread_create(&new_client.listener, &detached_thread_attr, &client_listener, nullptr);
+        int reactor_thread_error = pthread_create(&reactor.thread, &reactor_thread_attr, loop, &reactor);
+        pthread_attr_destroy(&reactor_thread_attr);
 
-        pthread_rwlock_unlock(&clients_lock);
+        if(reactor_thread_error != 0)
+        {
+            LOG_ERROR("error creating reactor thread {}", strerror(reactor_thread_error));
+            return EXIT_FAILURE;
+        }
+    }
 
-        if(listener_thread_error != 0)
+    if(options.snapshot_interval != 0)
+    {
+        pthread_t snapshot_thread{};
+        if(int error = pthread_create(&snapshot_thread, nullptr, &snapshot_loop, &options.snapshot_interval); error != 0)
         {
-            LOG("error creating listener thread {}", strerror(listener_thread_error));
+            LOG_ERROR("error creating snapshot thread {}", strerror(error));
             return EXIT_FAILURE;
         }
+        pthread_detach(snapshot_thread);
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &terminate_signal, nullptr);
+
+    timespec ready_time{};
+    clock_gettime(CLOCK_MONOTONIC, &ready_time);
+    const double startup_milliseconds = (ready_time.tv_sec - start_time.tv_sec) * 1e3 + (ready_time.tv_nsec - start_time.tv_nsec) / 1e6;
+
+    LOG("serving clients on {} {} reactor threads{}{}, ready after {:.1f} ms", reactors.size(), io_backend == io_backend_e::uring ? "io_uring" : "epoll",
+        options.shard_accept ? ", sharded accept" : "", options.pin_cpus ? ", pinned to cpus" : "", startup_milliseconds);
+
+    while(shutdown_server == 0)
+    {
+        pause();
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+#endif
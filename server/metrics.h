@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include <atomic>
+#include <algorithm>
+#include <bit>
+#include <string>
+#include <string_view>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fmt/format.h>
+
+#include "background.h"
+
+//what every latency the server and its tools record is measured with
+inline uint64_t monotonic_nanoseconds()
+{
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1'000'000'000ull + now.tv_nsec;
+}
+
+//log-linear buckets like an hdr histogram: every power of 2 is split into 2^histogram_sub_bucket_bits buckets, so a bucket is never
+//wider than a sixteenth of the values in it. values past the last bucket are counted in it
+constexpr uint32_t histogram_sub_bucket_bits = 4;
+constexpr uint32_t histogram_sub_buckets = 1 << histogram_sub_bucket_bits;
+constexpr uint32_t histogram_max_exponent = 40; //about 18 minutes in nanoseconds
+constexpr uint32_t histogram_bucket_count = (histogram_max_exponent - histogram_sub_bucket_bits + 2) * histogram_sub_buckets;
+
+constexpr uint32_t histogram_bucket(uint64_t value)
+{
+    if(value < histogram_sub_buckets)
+    {
+        return value;
+    }
+
+    const uint32_t exponent = std::bit_width(value) - 1;
+    if(exponent > histogram_max_exponent)
+    {
+        return histogram_bucket_count - 1;
+    }
+
+    const uint32_t shift = exponent - histogram_sub_bucket_bits;
+    return ((shift + 1) * histogram_sub_buckets) + ((value >> shift) & (histogram_sub_buckets - 1));
+}
+
+//largest value that falls in the bucket
+constexpr uint64_t histogram_bucket_limit(uint32_t bucket)
+{
+    if(bucket < histogram_sub_buckets)
+    {
+        return bucket;
+    }
+
+    const uint32_t shift = (bucket / histogram_sub_buckets) - 1;
+    const uint64_t lower = uint64_t{histogram_sub_buckets + (bucket % histogram_sub_buckets)} << shift;
+    return lower + (uint64_t{1} << shift) - 1;
+}
+
+//written by one thread only, so recording is a plain load and store without a locked instruction. readers sum the histograms of
+//every thread and may see a record half done, which only makes the sum lag by one value
+struct histogram_t
+{
+    std::atomic<uint64_t> buckets[histogram_bucket_count]{};
+    std::atomic<uint64_t> sum{0};
+
+    void record(uint64_t value)
+    {
+        std::atomic<uint64_t>& bucket = buckets[histogram_bucket(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+//what a scrape adds the histograms of every thread up into
+struct histogram_totals_t
+{
+    uint64_t buckets[histogram_bucket_count]{};
+    uint64_t sum = 0;
+
+    void add(const histogram_t& histogram)
+    {
+        for(uint32_t bucket = 0; bucket < histogram_bucket_count; ++bucket)
+        {
+            buckets[bucket] += histogram.buckets[bucket].load(std::memory_order_relaxed);
+        }
+        sum += histogram.sum.load(std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for(uint64_t bucket_count : buckets)
+        {
+            total += bucket_count;
+        }
+
+        return total;
+    }
+
+    //the limit of the bucket holding the value that fraction of all values are at or below, so it overstates by less than a bucket
+    uint64_t percentile(double fraction) const
+    {
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * count())));
+
+        uint64_t seen = 0;
+        for(uint32_t bucket = 0; bucket < histogram_bucket_count; ++bucket)
+        {
+            seen += buckets[bucket];
+            if(seen >= rank)
+            {
+                return histogram_bucket_limit(bucket);
+            }
+        }
+
+        return 0; //nothing recorded
+    }
+
+    //appends one bucket per power of 2 in the prometheus text format, values are divided by scale. every scrape has the same buckets
+    //whatever was recorded, so a series never appears or disappears. the finer buckets only go into percentile.
+    //labels are written inside the braces of every line and must not be empty
+    void format(std::string* output, std::string_view name, std::string_view labels, double scale) const
+    {
+        auto out = std::back_inserter(*output);
+
+        uint64_t count = 0;
+        for(uint32_t bucket = 0; bucket < histogram_bucket_count; ++bucket)
+        {
+            count += buckets[bucket];
+            if((bucket + 1) % histogram_sub_buckets == 0) //the last bucket below the next power of 2
+            {
+                fmt::format_to(out, "{}_bucket{{{},le=\"{}\"}} {}\n", name, labels, histogram_bucket_limit(bucket) / scale, count);
+            }
+        }
+
+        fmt::format_to(out, "{}_bucket{{{},le=\"+Inf\"}} {}\n", name, labels, count);
+        fmt::format_to(out, "{}_sum{{{}}} {}\n", name, labels, sum / scale);
+        fmt::format_to(out, "{}_count{{{}}} {}\n", name, labels, count);
+    }
+};
+
+//serves whatever format_metrics(std::string*) appends on every http request to a port of the loopback address, one request at a time
+struct metrics_server_t
+{
+    int server_socket = -1;
+    pthread_t thread = 0;
+    void (*format_metrics)(std::string* output) = nullptr;
+
+    bool start(uint16_t port, void (*format)(std::string* output))
+    {
+        format_metrics = format;
+
+        server_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(server_socket == -1)
+        {
+            perror("socket");
+            return false;
+        }
+
+        int enable = 1;
+        (void)setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        sockaddr_in address{.sin_family = AF_INET, .sin_port = htons(port), .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)}, .sin_zero = {}};
+        if(bind(server_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(server_socket, 16) == -1)
+        {
+            perror("bind metrics");
+            return false;
+        }
+
+        if(!spawn_signal_blocked_thread(&thread, &serve_loop, this))
+        {
+            return false;
+        }
+
+        pthread_detach(thread);
+        return true;
+    }
+
+    static void* serve_loop(void* server_ptr)
+    {
+        metrics_server_t& server = *static_cast<metrics_server_t*>(server_ptr);
+
+        std::string body{};
+        std::string response{};
+
+        while(true)
+        {
+            int client = accept4(server.server_socket, nullptr, nullptr, SOCK_CLOEXEC);
+            if(client == -1)
+            {
+                if(errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+
+                return nullptr;
+            }
+
+            timeval timeout{.tv_sec = 1, .tv_usec = 0}; //a scraper that never sends its request does not hold up the next one
+            (void)setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            (void)setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            char request[1024];
+            ssize_t request_size = 0;
+            while(request_size < static_cast<ssize_t>(sizeof(request)))
+            {
+                ssize_t nread = recv(client, request + request_size, sizeof(request) - request_size, 0);
+                if(nread <= 0)
+                {
+                    break;
+                }
+
+                request_size += nread;
+                if(std::string_view{request, static_cast<uint64_t>(request_size)}.find("\r\n\r\n") != std::string_view::npos)
+                {
+                    break;
+                }
+            }
+
+            body.clear();
+            server.format_metrics(&body);
+
+            response.clear();
+            fmt::format_to(std::back_inserter(response), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n", body.size());
+            response += body;
+
+            for(uint64_t offset = 0; offset < response.size();)
+            {
+                ssize_t nwritten = send(client, response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+                if(nwritten <= 0)
+                {
+                    break;
+                }
+                offset += nwritten;
+            }
+
+            close(client);
+        }
+    }
+};
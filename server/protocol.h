@@ -0,0 +1,471 @@
+#pragma once
+
+#include <cstdint>
+#include <bit>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <fmt/format.h>
+
+//the wire format shared by the server and the tools that talk to it. in version 1 every frame is a frame_header_t followed by size
+//bytes, all fields are little endian and names are utf-16 without a byte order mark. version 2 is described further down
+
+constexpr uint32_t frame_header_size = 8; //type, then the size of the rest of the frame
+
+struct __attribute__((packed)) frame_header_t
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+//frames are read where they were received, at whatever offset they landed on, so fields are copied out instead of referenced
+template<typename T>
+inline T read_unaligned(const uint8_t* bytes)
+{
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+//copies count utf-16 code units out of a frame into text and returns them
+inline std::u16string_view read_utf16(const uint8_t* bytes, uint64_t count, std::u16string* text)
+{
+    text->resize(count);
+    std::memcpy(text->data(), bytes, count * sizeof(char16_t));
+    return *text;
+}
+
+enum handler_id_t : uint16_t
+{
+    pasture = 0b00,
+    stable_in = 0b01,
+    stable_out = 0b10
+};
+
+inline std::string handler_id2string(handler_id_t handler_id)
+{
+    switch(handler_id)
+    {
+        case handler_id_t::pasture: return "pasture";
+        case handler_id_t::stable_in: return "stable_in";
+        case handler_id_t::stable_out: return "stable_out";
+        default: return "invalid value";
+    }
+}
+
+struct __attribute__((packed)) handler_key_t
+{
+    handler_id_t id;
+    uint16_t day_of_year;
+    uint32_t year;
+
+    constexpr friend bool operator==(const handler_key_t& lhs, const handler_key_t& rhs)
+    {
+        return std::bit_cast<uint64_t>(lhs) == std::bit_cast<uint64_t>(rhs);
+    }
+
+    std::string to_string() const
+    {
+        return fmt::format("id: {}, day: {}, year: {}", handler_id2string(id), day_of_year, year);
+    }
+};
+
+constexpr uint32_t handler_id_count = 3;
+constexpr uint32_t max_day_of_year = 366;
+
+//every handler id set in id_mask for day_count days starting at first_day_of_year, all within one year
+struct __attribute__((packed)) handler_range_t
+{
+    uint16_t id_mask;
+    uint16_t first_day_of_year;
+    uint16_t day_count;
+    uint16_t reserved;
+    uint32_t year;
+
+    //the range must not be empty and must end inside its year, so a loop up to end_day_of_year can never wrap
+    bool valid() const
+    {
+        return first_day_of_year <= max_day_of_year && day_count != 0 && day_count <= max_day_of_year + 1 - first_day_of_year && id_mask != 0 && (id_mask >> handler_id_count) == 0;
+    }
+
+    //one past the last day, only meaningful for a valid range
+    uint32_t end_day_of_year() const
+    {
+        return static_cast<uint32_t>(first_day_of_year) + day_count;
+    }
+
+    constexpr friend bool operator==(const handler_range_t& lhs, const handler_range_t& rhs)
+    {
+        return lhs.id_mask == rhs.id_mask && lhs.first_day_of_year == rhs.first_day_of_year && lhs.day_count == rhs.day_count && lhs.year == rhs.year;
+    }
+
+    std::string to_string() const
+    {
+        return fmt::format("ids: {:#b}, days: {}-{}, year: {}", id_mask, first_day_of_year, end_day_of_year() - 1, year);
+    }
+};
+
+//one per key of a sent_handler_range or sent_handler_updates frame, followed by the name without a null terminator
+struct __attribute__((packed)) handler_entry_t
+{
+    handler_key_t key;
+    uint32_t version;
+    uint32_t name_size; //in bytes
+};
+
+//replaces delete_count characters at position with the text that follows, without a null terminator. positions and counts are in
+//char16_t of the name as it was at base_version. the server moves edits made against an older version past the changes since
+struct __attribute__((packed)) handler_edit_t
+{
+    handler_key_t key;
+    uint32_t base_version;
+    uint16_t position;
+    uint16_t delete_count;
+};
+
+//identifies a point in the change log, a client that stored one can later ask for everything that changed after it
+struct __attribute__((packed)) sync_point_t
+{
+    uint64_t epoch; //differs every time the server starts, sequences of an older run mean nothing
+    uint64_t sequence; //how many changes were made before the point
+};
+
+enum class client_message_type_e : uint32_t
+{
+    login = 0,
+    get_handler,
+    set_handler,
+    get_handler_range,
+    subscribe_handlers,
+    unsubscribe_handlers,
+    edit_handler,
+    resync_handlers,
+    negotiate_protocol,
+    max
+};
+
+enum class server_message_type_e : uint32_t
+{
+    login_response = 0,
+    sent_handler_name,
+    sent_handler_range,
+    sent_handler_updates,
+    edited_handler,
+    edit_acknowledged,
+    edit_rebased,
+    handlers_not_modified,
+    sent_handler_changes,
+    protocol_accepted,
+    max
+};
+
+constexpr uint32_t max_varint_size = 10; //enough for any uint64_t
+
+//little endian base 128: 7 bits per byte, the high bit is set on every byte but the last. returns the bytes written
+inline uint32_t encode_varint(uint64_t value, uint8_t* output)
+{
+    uint32_t size = 0;
+    while(value >= 0x80)
+    {
+        output[size++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    output[size++] = static_cast<uint8_t>(value);
+
+    return size;
+}
+
+//returns the bytes read, 0 if input ends inside the varint or -1 if it is longer than any uint64_t
+inline int32_t decode_varint(const uint8_t* input, uint64_t input_size, uint64_t* value)
+{
+    uint64_t decoded = 0;
+    for(uint32_t index = 0; index < max_varint_size; ++index)
+    {
+        if(index == input_size)
+        {
+            return 0;
+        }
+
+        decoded |= uint64_t{input[index] & 0x7Fu} << (7 * index);
+        if((input[index] & 0x80) == 0)
+        {
+            *value = decoded;
+            return index + 1;
+        }
+    }
+
+    return -1;
+}
+
+//a client that speaks a newer version sends negotiate_protocol as its first frame, carrying the newest version it speaks as a uint32_t.
+//the server answers with protocol_accepted carrying the version both use from then on. both frames are in version 1, the answer is the
+//last frame of the old version the client receives. clients send nothing else until the answer arrives, servers that only know
+//version 1 never send one
+//
+//version 2 frames are a varint type and a varint payload size followed by the payload. every field is a varint unless noted.
+//names are utf-8 and run to the end of the frame, inside entries they are preceded by their size in bytes. edit positions and counts
+//stay in char16_t, so both versions apply an edit to the same characters:
+//  key: (year << 11) | (day_of_year << 2) | id
+//  range: id_mask, first_day_of_year, day_count, year
+//  sync point: epoch, sequence
+//  entry: key, version, name size, name
+//  login: password, without a null terminator          login_response: success byte, sync point
+//  get_handler: key [, known version]                  sent_handler_name: key, name
+//  set_handler: key, name                              sent_handler_range, sent_handler_updates: entry count, entries
+//  get_handler_range: range [, known versions]         sent_handler_changes: sync point, entry count, entries
+//  subscribe_handlers, unsubscribe_handlers: range     edited_handler: key, base version, position, delete count, inserted text
+//  edit_handler: key, base version, position,          edit_acknowledged: key, version
+//      delete count, inserted text                     edit_rebased: entry
+//  resync_handlers: sync point, range                  handlers_not_modified: range
+constexpr uint32_t newest_protocol_version = 2;
+
+//reads the header of the frame at the start of input. returns its size, 0 if input ends inside it or -1 if it is malformed
+inline int32_t decode_frame_header(const uint8_t* input, uint64_t input_size, uint32_t protocol_version, uint32_t* type, uint64_t* payload_size)
+{
+    if(protocol_version == 1)
+    {
+        if(input_size < frame_header_size)
+        {
+            return 0;
+        }
+
+        frame_header_t header{};
+        std::memcpy(&header, input, sizeof(header));
+        *type = header.type;
+        *payload_size = header.size;
+        return frame_header_size;
+    }
+
+    uint64_t decoded_type = 0;
+    const int32_t type_size = decode_varint(input, input_size, &decoded_type);
+    if(type_size <= 0)
+    {
+        return type_size;
+    }
+
+    const int32_t size_size = decode_varint(input + type_size, input_size - type_size, payload_size);
+    if(size_size <= 0)
+    {
+        return size_size;
+    }
+
+    if(decoded_type > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    *type = decoded_type;
+    return type_size + size_size;
+}
+
+inline void append_varint(std::vector<uint8_t>* output, uint64_t value)
+{
+    uint8_t encoded[max_varint_size];
+    output->insert(output->end(), encoded, encoded + encode_varint(value, encoded));
+}
+
+inline void append_v2_frame_header(std::vector<uint8_t>* output, uint32_t type, uint64_t payload_size)
+{
+    append_varint(output, type);
+    append_varint(output, payload_size);
+}
+
+inline uint64_t pack_handler_key(handler_key_t key)
+{
+    return (uint64_t{key.year} << 11) | (uint64_t{key.day_of_year} << 2) | key.id;
+}
+
+inline handler_key_t unpack_handler_key(uint64_t packed)
+{
+    return handler_key_t{.id = static_cast<handler_id_t>(packed & 0b11), .day_of_year = static_cast<uint16_t>((packed >> 2) & 0x1FF), .year = static_cast<uint32_t>(packed >> 11)};
+}
+
+//lone surrogates, which an edit can leave in the middle of a name, are encoded like any other character below 0x10000,
+//so every utf-16 name comes back unchanged
+template<typename T>
+void append_utf8(T* output, std::u16string_view text)
+{
+    using byte_t = typename T::value_type;
+
+    for(uint64_t index = 0; index < text.size(); ++index)
+    {
+        uint32_t code_point = text[index];
+        if(code_point >= 0xD800 && code_point < 0xDC00 && index + 1 < text.size() && text[index + 1] >= 0xDC00 && text[index + 1] < 0xE000)
+        {
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (text[++index] - 0xDC00);
+        }
+
+        if(code_point < 0x80)
+        {
+            output->push_back(static_cast<byte_t>(code_point));
+        }
+        else if(code_point < 0x800)
+        {
+            output->push_back(static_cast<byte_t>(0xC0 | (code_point >> 6)));
+            output->push_back(static_cast<byte_t>(0x80 | (code_point & 0x3F)));
+        }
+        else if(code_point < 0x10000)
+        {
+            output->push_back(static_cast<byte_t>(0xE0 | (code_point >> 12)));
+            output->push_back(static_cast<byte_t>(0x80 | ((code_point >> 6) & 0x3F)));
+            output->push_back(static_cast<byte_t>(0x80 | (code_point & 0x3F)));
+        }
+        else
+        {
+            output->push_back(static_cast<byte_t>(0xF0 | (code_point >> 18)));
+            output->push_back(static_cast<byte_t>(0x80 | ((code_point >> 12) & 0x3F)));
+            output->push_back(static_cast<byte_t>(0x80 | ((code_point >> 6) & 0x3F)));
+            output->push_back(static_cast<byte_t>(0x80 | (code_point & 0x3F)));
+        }
+    }
+}
+
+inline uint64_t utf8_size(std::u16string_view text)
+{
+    uint64_t size = 0;
+    for(uint64_t index = 0; index < text.size(); ++index)
+    {
+        const char16_t code_unit = text[index];
+        if(code_unit >= 0xD800 && code_unit < 0xDC00 && index + 1 < text.size() && text[index + 1] >= 0xDC00 && text[index + 1] < 0xE000)
+        {
+            size += 4;
+            ++index;
+        }
+        else
+        {
+            size += code_unit < 0x80 ? 1 : code_unit < 0x800 ? 2 : 3;
+        }
+    }
+
+    return size;
+}
+
+inline std::string utf16_to_utf8(std::u16string_view text)
+{
+    std::string converted{};
+    converted.reserve(text.size());
+    append_utf8(&converted, text);
+
+    return converted;
+}
+
+//calls on_code_unit(char16_t) for every utf-16 code unit of the text, returns false if it is not utf-8. overlong sequences and
+//characters past 0x10FFFF are rejected, encoded surrogates are let through like append_utf8 writes them
+template<typename F>
+bool decode_utf8(std::span<const uint8_t> text, F on_code_unit)
+{
+    for(uint64_t index = 0; index < text.size();)
+    {
+        const uint8_t lead = text[index];
+        const uint32_t size = lead < 0x80 ? 1 : (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 0;
+        if(size == 0 || text.size() - index < size)
+        {
+            return false;
+        }
+
+        uint32_t code_point = size == 1 ? lead : lead & (0x7F >> size);
+        for(uint32_t continuation = 1; continuation < size; ++continuation)
+        {
+            if((text[index + continuation] & 0xC0) != 0x80)
+            {
+                return false;
+            }
+            code_point = (code_point << 6) | (text[index + continuation] & 0x3F);
+        }
+
+        constexpr uint32_t smallest_code_point[] = {0, 0, 0x80, 0x800, 0x10000};
+        if(code_point < smallest_code_point[size] || code_point > 0x10FFFF)
+        {
+            return false;
+        }
+
+        if(code_point >= 0x10000)
+        {
+            on_code_unit(static_cast<char16_t>(0xD800 + ((code_point - 0x10000) >> 10)));
+            on_code_unit(static_cast<char16_t>(0xDC00 + ((code_point - 0x10000) & 0x3FF)));
+        }
+        else
+        {
+            on_code_unit(static_cast<char16_t>(code_point));
+        }
+
+        index += size;
+    }
+
+    return true;
+}
+
+inline void append_v2_range(std::vector<uint8_t>* output, const handler_range_t& range)
+{
+    append_varint(output, range.id_mask);
+    append_varint(output, range.first_day_of_year);
+    append_varint(output, range.day_count);
+    append_varint(output, range.year);
+}
+
+inline void append_v2_sync_point(std::vector<uint8_t>* output, const sync_point_t& sync_point)
+{
+    append_varint(output, sync_point.epoch);
+    append_varint(output, sync_point.sequence);
+}
+
+inline void append_v2_handler_entry(std::vector<uint8_t>* output, handler_key_t key, uint32_t version, std::u16string_view handler_name)
+{
+    append_varint(output, pack_handler_key(key));
+    append_varint(output, version);
+    append_varint(output, utf8_size(handler_name));
+    append_utf8(output, handler_name);
+}
+
+//reads the fields of a version 2 payload in order. once a field is missing, malformed or out of range every later read fails too
+struct v2_reader_t
+{
+    std::span<const uint8_t> input;
+    uint64_t offset = 0;
+    bool failed = false;
+
+    bool at_end() const
+    {
+        return offset == input.size();
+    }
+
+    uint64_t varint(uint64_t limit = UINT64_MAX)
+    {
+        uint64_t value = 0;
+        const int32_t field_size = failed ? 0 : decode_varint(input.data() + offset, input.size() - offset, &value);
+        if(field_size <= 0 || value > limit)
+        {
+            failed = true;
+            return 0;
+        }
+
+        offset += field_size;
+        return value;
+    }
+
+    handler_key_t key()
+    {
+        return unpack_handler_key(varint((uint64_t{UINT32_MAX} << 11) | 0x7FF));
+    }
+
+    handler_range_t range()
+    {
+        return handler_range_t{.id_mask = static_cast<uint16_t>(varint(UINT16_MAX)), .first_day_of_year = static_cast<uint16_t>(varint(UINT16_MAX)),
+            .day_count = static_cast<uint16_t>(varint(UINT16_MAX)), .reserved = 0, .year = static_cast<uint32_t>(varint(UINT32_MAX))};
+    }
+
+    sync_point_t sync_point()
+    {
+        return sync_point_t{.epoch = varint(), .sequence = varint()};
+    }
+
+    //the text that runs to the end of the frame
+    std::span<const uint8_t> rest()
+    {
+        const std::span<const uint8_t> text = failed ? std::span<const uint8_t>{} : input.subspan(offset);
+        offset = input.size();
+        return text;
+    }
+};
@@ -0,0 +1,398 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "capture.h"
+#include "metrics.h"
+
+//plays a capture written by stall_server --capture back against a server:
+//stall_replay [--host address] [--speed factor] [--password password] capture port
+//connections are opened, fed and closed at their captured times divided by the speed, and the frames of a connection are sent in
+//the order they were captured. replies are read and dropped so the server never disconnects a replayed client for not reading.
+//captures hold logins without their password, they log in with --password or are turned away
+
+struct replay_options_t
+{
+    const char* host = "127.0.0.1";
+    uint16_t port = 0;
+    double speed = 1;
+    const char* capture_path = nullptr;
+    const char* password = nullptr;
+};
+
+struct replayed_connection_t
+{
+    int socket = -1;
+    std::vector<uint8_t> output{}; //frames the socket did not take yet
+    bool closing = false; //closed once the output is sent
+};
+
+struct replay_t
+{
+    const replay_options_t& options;
+    int epoll = -1;
+    std::unordered_map<uint32_t, replayed_connection_t> connections{};
+    histogram_t lag{}; //nanoseconds a record was applied after its scaled time
+    uint64_t connections_opened = 0;
+    uint64_t connections_lost = 0; //closed by the server or never connected
+    uint64_t frames_sent = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+
+    replayed_connection_t* connect_to_server(uint32_t connection_id)
+    {
+        replayed_connection_t& connection = connections[connection_id];
+
+        connection.socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(connection.socket == -1)
+        {
+            perror("socket");
+            connections.erase(connection_id);
+            ++connections_lost;
+            return nullptr;
+        }
+
+        sockaddr_in address{.sin_family = AF_INET, .sin_port = htons(options.port), .sin_addr = {}, .sin_zero = {}};
+        inet_pton(AF_INET, options.host, &address.sin_addr);
+
+        if(connect(connection.socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            perror("connect");
+            close(connection.socket);
+            connections.erase(connection_id);
+            ++connections_lost;
+            return nullptr;
+        }
+
+        int enable = 1;
+        (void)setsockopt(connection.socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        fcntl(connection.socket, F_SETFL, fcntl(connection.socket, F_GETFL) | O_NONBLOCK);
+
+        epoll_event event{.events = EPOLLIN | EPOLLOUT | EPOLLET, .data = {.u64 = connection_id}};
+        epoll_ctl(epoll, EPOLL_CTL_ADD, connection.socket, &event);
+
+        ++connections_opened;
+        return &connection;
+    }
+
+    void disconnect(uint32_t connection_id)
+    {
+        auto found = connections.find(connection_id);
+        if(found != connections.end())
+        {
+            close(found->second.socket); //also removes it from the epoll set
+            connections.erase(found);
+        }
+    }
+
+    //sends what the socket takes, returns false if the server closed the connection
+    bool flush(replayed_connection_t* connection)
+    {
+        uint64_t sent = 0;
+        while(sent < connection->output.size())
+        {
+            ssize_t result = send(connection->socket, connection->output.data() + sent, connection->output.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if(result == -1)
+            {
+                if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    break;
+                }
+
+                return false;
+            }
+            sent += result;
+        }
+
+        connection->output.erase(connection->output.begin(), connection->output.begin() + sent);
+        return true;
+    }
+
+    //every connection that got a frame in this pass is flushed once at the end, so frames captured together go out together
+    void apply(const capture_record_t& record, std::vector<uint32_t>* touched)
+    {
+        if(record.event == capture_connected)
+        {
+            connect_to_server(record.connection);
+            return;
+        }
+
+        auto found = connections.find(record.connection);
+        if(record.event == capture_disconnected)
+        {
+            if(found != connections.end())
+            {
+                found->second.closing = true;
+                touched->push_back(record.connection);
+            }
+            return;
+        }
+
+        replayed_connection_t* connection = found != connections.end() ? &found->second : connect_to_server(record.connection); //the capture began after it connected
+        if(connection == nullptr)
+        {
+            return;
+        }
+
+        const uint64_t output_size = connection->output.size();
+        if(!append_login(record.frame, &connection->output))
+        {
+            connection->output.insert(connection->output.end(), record.frame.begin(), record.frame.end());
+        }
+        touched->push_back(record.connection);
+
+        ++frames_sent;
+        bytes_sent += connection->output.size() - output_size;
+    }
+
+    //appends a login with the password of the options in place of a redacted one, returns false for any other frame
+    bool append_login(std::span<const uint8_t> frame, std::vector<uint8_t>* output) const
+    {
+        if(options.password == nullptr)
+        {
+            return false;
+        }
+
+        const std::string_view password{options.password};
+        if(std::ranges::equal(frame, redacted_login_v1))
+        {
+            const frame_header_t header{.type = static_cast<uint32_t>(client_message_type_e::login), .size = static_cast<uint32_t>(password.size() + 1)};
+            output->insert(output->end(), reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header) + sizeof(header));
+            output->insert(output->end(), password.begin(), password.end());
+            output->push_back(0);
+            return true;
+        }
+
+        if(std::ranges::equal(frame, redacted_login_v2))
+        {
+            uint8_t header[max_varint_size * 2];
+            uint32_t header_size = encode_varint(static_cast<uint32_t>(client_message_type_e::login), header);
+            header_size += encode_varint(password.size(), header + header_size);
+            output->insert(output->end(), header, header + header_size);
+            output->insert(output->end(), password.begin(), password.end());
+            return true;
+        }
+
+        return false;
+    }
+
+    void flush_touched(std::vector<uint32_t>* touched)
+    {
+        std::sort(touched->begin(), touched->end());
+        touched->erase(std::unique(touched->begin(), touched->end()), touched->end());
+
+        for(uint32_t connection_id : *touched)
+        {
+            auto found = connections.find(connection_id);
+            if(found == connections.end())
+            {
+                continue;
+            }
+
+            if(!flush(&found->second))
+            {
+                ++connections_lost;
+                disconnect(connection_id);
+            }
+            else if(found->second.closing && found->second.output.empty())
+            {
+                disconnect(connection_id);
+            }
+        }
+
+        touched->clear();
+    }
+
+    void on_event(const epoll_event& event)
+    {
+        const uint32_t connection_id = event.data.u64;
+        auto found = connections.find(connection_id);
+        if(found == connections.end())
+        {
+            return;
+        }
+        replayed_connection_t& connection = found->second;
+
+        uint8_t buffer[64 << 10];
+        while(event.events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            ssize_t result = recv(connection.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if(result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            {
+                break;
+            }
+            else if(result <= 0)
+            {
+                ++connections_lost;
+                disconnect(connection_id);
+                return;
+            }
+
+            bytes_received += result;
+        }
+
+        if(!flush(&connection))
+        {
+            ++connections_lost;
+            disconnect(connection_id);
+        }
+        else if(connection.closing && connection.output.empty())
+        {
+            disconnect(connection_id);
+        }
+    }
+};
+
+bool parse_options(int argc, char** argv, replay_options_t* options)
+{
+    constexpr option long_options[] = {
+        {"host", required_argument, nullptr, 'h'},
+        {"speed", required_argument, nullptr, 's'},
+        {"password", required_argument, nullptr, 'p'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int option_char;
+    while((option_char = getopt_long(argc, argv, "h:s:p:", long_options, nullptr)) != -1)
+    {
+        switch(option_char)
+        {
+            case 'h':
+                options->host = optarg;
+                break;
+            case 's':
+                options->speed = std::strtod(optarg, nullptr);
+                break;
+            case 'p':
+                options->password = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if(optind + 2 != argc || !(options->speed > 0))
+    {
+        return false;
+    }
+
+    options->capture_path = argv[optind];
+    options->port = std::strtoul(argv[optind + 1], nullptr, 10);
+
+    in_addr address{};
+    if(inet_pton(AF_INET, options->host, &address) != 1)
+    {
+        fmt::print(stderr, "{} is not an ipv4 address\n", options->host);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    replay_options_t options{};
+    if(!parse_options(argc, argv, &options))
+    {
+        fmt::print(stderr, "usage: {} [--host address] [--speed factor] [--password password] capture port\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    capture_reader_t reader{};
+    if(!reader.open(options.capture_path))
+    {
+        return EXIT_FAILURE;
+    }
+
+    replay_t replay{.options = options};
+    replay.epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(replay.epoll == -1)
+    {
+        perror("epoll_create1");
+        return EXIT_FAILURE;
+    }
+
+    const uint64_t start_time = monotonic_nanoseconds();
+    auto due_time = [&options, start_time](const capture_record_t& record)
+    {
+        return start_time + static_cast<uint64_t>(record.time * 1000 / options.speed);
+    };
+
+    capture_record_t record{};
+    bool more = reader.next(&record);
+    uint64_t captured_microseconds = 0;
+
+    std::vector<uint32_t> touched{};
+    epoll_event events[256];
+
+    while(more || !replay.connections.empty())
+    {
+        uint64_t now = monotonic_nanoseconds();
+        while(more && due_time(record) <= now)
+        {
+            replay.lag.record(now - due_time(record));
+            replay.apply(record, &touched);
+            captured_microseconds = record.time;
+
+            more = reader.next(&record);
+        }
+        replay.flush_touched(&touched);
+
+        if(!more) //the server was stopped with clients still connected, or the capture was cut short
+        {
+            for(auto& [connection_id, connection] : replay.connections)
+            {
+                connection.closing = true;
+                touched.push_back(connection_id);
+            }
+            replay.flush_touched(&touched);
+        }
+
+        int timeout = 100; //waiting on connections that still have output
+        if(more)
+        {
+            now = monotonic_nanoseconds();
+            const uint64_t due = due_time(record);
+            timeout = due > now ? static_cast<int>(std::min<uint64_t>((due - now + 999'999) / 1'000'000, 100)) : 0;
+        }
+
+        const int event_count = epoll_wait(replay.epoll, events, std::size(events), timeout);
+        for(int event_index = 0; event_index < event_count; ++event_index)
+        {
+            replay.on_event(events[event_index]);
+        }
+    }
+
+    const double seconds = (monotonic_nanoseconds() - start_time) / 1e9;
+
+    histogram_totals_t lag{};
+    lag.add(replay.lag);
+
+    fmt::print("replayed {} connections and {} frames ({} bytes) of {:.1f} s of traffic in {:.1f} s at {}x, received {} bytes\n",
+        replay.connections_opened, replay.frames_sent, replay.bytes_sent, captured_microseconds / 1e6, seconds, options.speed, replay.bytes_received);
+    fmt::print("behind schedule: p50 {:.3f} ms, p99 {:.3f} ms, p999 {:.3f} ms\n", lag.percentile(0.5) / 1e6, lag.percentile(0.99) / 1e6, lag.percentile(0.999) / 1e6);
+
+    if(replay.connections_lost != 0)
+    {
+        fmt::print("{} connections were closed by the server or could not connect\n", replay.connections_lost);
+    }
+
+    reader.close();
+    close(replay.epoll);
+    return replay.connections_lost == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "wal.h"
+
+//the file is laid out so it can be used straight from a read only mapping:
+//header, one snapshot_year_t per year, the entries of every year in year order, then all names back to back
+struct snapshot_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum; //crc32c of everything after the header
+    uint64_t wal_generation; //first log file whose records are not contained in the snapshot
+    uint64_t year_count;
+    uint64_t entry_count;
+    uint64_t names_size; //in char16_t
+};
+
+struct snapshot_year_t
+{
+    uint32_t year;
+    uint32_t reserved;
+    uint64_t first_entry;
+    uint64_t entry_count;
+};
+
+struct snapshot_entry_t
+{
+    uint64_t key;
+    uint64_t name_offset; //in char16_t from the start of the names
+    uint32_t name_size; //in char16_t
+    uint32_t version; //of the handler, 0 in snapshots written before versions existed
+};
+
+constexpr char snapshot_magic[8] = {'S', 'T', 'A', 'L', 'L', 'S', 'N', 'P'};
+constexpr uint32_t snapshot_version = 1;
+
+struct snapshot_source_entry_t
+{
+    uint32_t year;
+    uint64_t key;
+    uint32_t version;
+    std::u16string name;
+};
+
+//writes the entries, which must be sorted by year, to a temporary file and atomically replaces the snapshot at path with it
+inline bool write_snapshot(const char* path, const char* directory, uint64_t wal_generation, const std::vector<snapshot_source_entry_t>& entries)
+{
+    std::vector<snapshot_year_t> years{};
+    std::vector<snapshot_entry_t> packed_entries{};
+    std::u16string names{};
+
+    packed_entries.reserve(entries.size());
+    for(const snapshot_source_entry_t& entry : entries)
+    {
+        if(years.empty() || years.back().year != entry.year)
+        {
+            years.push_back(snapshot_year_t{.year = entry.year, .reserved = 0, .first_entry = packed_entries.size(), .entry_count = 0});
+        }
+
+        ++years.back().entry_count;
+        packed_entries.push_back(snapshot_entry_t{.key = entry.key, .name_offset = names.size(), .name_size = static_cast<uint32_t>(entry.name.size()), .version = entry.version});
+        names += entry.name;
+    }
+
+    std::vector<uint8_t> body(years.size() * sizeof(snapshot_year_t) + packed_entries.size() * sizeof(snapshot_entry_t) + names.size() * sizeof(char16_t));
+    uint8_t* cursor = body.data();
+    cursor = static_cast<uint8_t*>(std::memcpy(cursor, years.data(), years.size() * sizeof(snapshot_year_t))) + years.size() * sizeof(snapshot_year_t);
+    cursor = static_cast<uint8_t*>(std::memcpy(cursor, packed_entries.data(), packed_entries.size() * sizeof(snapshot_entry_t))) + packed_entries.size() * sizeof(snapshot_entry_t);
+    std::memcpy(cursor, names.data(), names.size() * sizeof(char16_t));
+
+    snapshot_header_t header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.checksum = crc32c(0, body.data(), body.size());
+    header.wal_generation = wal_generation;
+    header.year_count = years.size();
+    header.entry_count = packed_entries.size();
+    header.names_size = names.size();
+
+    const std::string temporary_path = std::string{path} + ".tmp";
+
+    int file = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(file == -1)
+    {
+        perror("open");
+        return false;
+    }
+
+    const iovec parts[] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = body.data(), .iov_len = body.size()}
+    };
+
+    const ssize_t expected_size = sizeof(header) + body.size();
+    if(writev(file, parts, std::size(parts)) != expected_size || fdatasync(file) == -1)
+    {
+        perror("write snapshot");
+        ::close(file);
+        unlink(temporary_path.c_str());
+        return false;
+    }
+
+    ::close(file);
+
+    if(rename(temporary_path.c_str(), path) == -1)
+    {
+        perror("rename");
+        return false;
+    }
+
+    int directory_file = ::open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directory_file == -1 || fsync(directory_file) == -1) //make the rename itself durable
+    {
+        perror("fsync");
+    }
+
+    if(directory_file != -1)
+    {
+        ::close(directory_file);
+    }
+
+    return true;
+}
+
+//read only mapping of a snapshot file
+struct snapshot_view_t
+{
+    const uint8_t* contents = nullptr;
+    uint64_t size = 0;
+    const snapshot_header_t* header = nullptr;
+    const snapshot_year_t* years = nullptr;
+    const snapshot_entry_t* entries = nullptr;
+    const char16_t* names = nullptr;
+
+    //returns false with errno set to EBADMSG if the file is not a valid snapshot
+    bool map(const char* path)
+    {
+        int file = ::open(path, O_RDONLY | O_CLOEXEC);
+        if(file == -1)
+        {
+            return false;
+        }
+
+        struct stat file_stat{};
+        if(fstat(file, &file_stat) == -1)
+        {
+            ::close(file);
+            return false;
+        }
+
+        size = file_stat.st_size;
+        if(size < sizeof(snapshot_header_t))
+        {
+            ::close(file);
+            errno = EBADMSG;
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+        ::close(file);
+
+        if(mapping == MAP_FAILED)
+        {
+            return false;
+        }
+
+        contents = static_cast<const uint8_t*>(mapping);
+        header = reinterpret_cast<const snapshot_header_t*>(contents);
+
+        const uint64_t expected_size = sizeof(snapshot_header_t)
+            + header->year_count * sizeof(snapshot_year_t)
+            + header->entry_count * sizeof(snapshot_entry_t)
+            + header->names_size * sizeof(char16_t);
+
+        if(std::memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header->version != snapshot_version || expected_size != size
+            || crc32c(0, contents + sizeof(snapshot_header_t), size - sizeof(snapshot_header_t)) != header->checksum)
+        {
+            unmap();
+            errno = EBADMSG;
+            return false;
+        }
+
+        years = reinterpret_cast<const snapshot_year_t*>(contents + sizeof(snapshot_header_t));
+        entries = reinterpret_cast<const snapshot_entry_t*>(years + header->year_count);
+        names = reinterpret_cast<const char16_t*>(entries + header->entry_count);
+
+        return true;
+    }
+
+    void unmap()
+    {
+        if(contents != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(contents), size);
+        }
+
+        *this = snapshot_view_t{};
+    }
+
+    std::u16string_view name(const snapshot_entry_t& entry) const
+    {
+        return std::u16string_view{names + entry.name_offset, entry.name_size};
+    }
+};
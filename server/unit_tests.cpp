@@ -0,0 +1,509 @@
+//checks the parts of the server a client's bytes drive, run by ctest. the whole server is compiled in like in stall_benchmark, so the
+//code checked is the code that runs. every failed check is printed and the exit status says whether any failed
+#define STALL_BENCHMARK
+#include "main.cpp"
+
+#include <tuple>
+#include <sys/socket.h>
+
+uint32_t failed_checks = 0;
+
+void check(bool passed, const char* condition, const char* file, int line)
+{
+    if(!passed)
+    {
+        fmt::print(stderr, "{}:{}: check failed: {}\n", file, line, condition);
+        ++failed_checks;
+    }
+}
+
+#define CHECK(condition) check(condition, #condition, __FILE__, __LINE__)
+
+std::vector<uint8_t> v1_frame(client_message_type_e type, std::span<const uint8_t> payload)
+{
+    const frame_header_t header{.type = static_cast<uint32_t>(type), .size = static_cast<uint32_t>(payload.size())};
+
+    std::vector<uint8_t> frame(sizeof(header) + payload.size());
+    std::memcpy(frame.data(), &header, sizeof(header));
+    if(!payload.empty())
+    {
+        std::memcpy(frame.data() + sizeof(header), payload.data(), payload.size());
+    }
+
+    return frame;
+}
+
+std::vector<uint8_t> v2_frame(client_message_type_e type, std::span<const uint8_t> payload)
+{
+    std::vector<uint8_t> frame{};
+    append_v2_frame_header(&frame, static_cast<uint32_t>(type), payload.size());
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    return frame;
+}
+
+std::span<const uint8_t> as_bytes(std::string_view text)
+{
+    return {reinterpret_cast<const uint8_t*>(text.data()), text.size()};
+}
+
+struct reply_t
+{
+    uint32_t type;
+    std::vector<uint8_t> payload;
+};
+
+//a client of the epoll backend whose replies are read back from the other end of a socket pair
+struct test_client_t
+{
+    client_t* client = nullptr;
+    int peer = -1;
+    std::vector<uint8_t> received{};
+
+    bool open()
+    {
+        int sockets[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1)
+        {
+            perror("socketpair");
+            return false;
+        }
+
+        client = add_client(sockets[0], sockaddr_in{}, 0);
+        peer = sockets[1];
+        return true;
+    }
+
+    void close()
+    {
+        remove_client(client);
+        ::close(peer);
+    }
+
+    //dispatches input like the reactor does after a read and returns what dispatch_client_frames did
+    int64_t receive(std::span<uint8_t> input)
+    {
+        return dispatch_client_frames(input, *client, monotonic_nanoseconds());
+    }
+
+    //the next frame the server sent, in the given version. returns false if no whole frame arrived
+    bool next_reply(uint32_t protocol_version, reply_t* reply)
+    {
+        uint8_t buffer[4096];
+        ssize_t received_size = 0;
+        while((received_size = recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+        {
+            received.insert(received.end(), buffer, buffer + received_size);
+        }
+
+        uint64_t payload_size = 0;
+        const int32_t header_size = decode_frame_header(received.data(), received.size(), protocol_version, &reply->type, &payload_size);
+        if(header_size <= 0 || received.size() - header_size < payload_size)
+        {
+            return false;
+        }
+
+        reply->payload.assign(received.begin() + header_size, received.begin() + header_size + payload_size);
+        received.erase(received.begin(), received.begin() + header_size + payload_size);
+        return true;
+    }
+};
+
+//frames are parsed where they were received, several per read, and bounded before they are buffered
+void test_framing()
+{
+    test_client_t tester{};
+    if(!tester.open())
+    {
+        CHECK(false);
+        return;
+    }
+
+    std::vector<uint8_t> input = v1_frame(client_message_type_e::login, as_bytes(std::string_view{"wrong\0", 6}));
+    const std::vector<uint8_t> login = v1_frame(client_message_type_e::login, as_bytes(std::string_view{"washington\0", 11}));
+    input.insert(input.end(), login.begin(), login.end());
+    const uint64_t whole_frames_size = input.size();
+    input.insert(input.end(), login.begin(), login.begin() + 5); //the next frame, cut inside its header
+
+    CHECK(tester.receive(input) == static_cast<int64_t>(whole_frames_size));
+
+    reply_t reply{};
+    CHECK(tester.next_reply(1, &reply) && reply.type == static_cast<uint32_t>(server_message_type_e::login_response) && reply.payload.at(0) == 0);
+    CHECK(tester.next_reply(1, &reply) && reply.type == static_cast<uint32_t>(server_message_type_e::login_response) && reply.payload.at(0) == 1);
+    CHECK(!tester.next_reply(1, &reply));
+    CHECK(tester.client->logged_in);
+
+    std::vector<uint8_t> partial(login.begin(), login.end() - 1); //cut inside the payload
+    CHECK(tester.receive(partial) == 0);
+
+    //a password without its terminator, and a login without any payload, are not answered
+    tester.client->logged_in = false;
+    std::vector<uint8_t> unterminated = v1_frame(client_message_type_e::login, as_bytes("washington"));
+    std::vector<uint8_t> empty = v1_frame(client_message_type_e::login, {});
+    CHECK(tester.receive(unterminated) == static_cast<int64_t>(unterminated.size()));
+    CHECK(tester.receive(empty) == static_cast<int64_t>(empty.size()));
+    CHECK(!tester.next_reply(1, &reply));
+    CHECK(!tester.client->logged_in);
+
+    //a frame larger than max_frame_size is refused from its header alone
+    frame_header_t oversized{.type = static_cast<uint32_t>(client_message_type_e::login), .size = max_frame_size};
+    std::vector<uint8_t> oversized_header(reinterpret_cast<const uint8_t*>(&oversized), reinterpret_cast<const uint8_t*>(&oversized) + sizeof(oversized));
+    CHECK(tester.receive(oversized_header) == -1);
+
+    oversized.size = max_frame_size - frame_header_size;
+    std::memcpy(oversized_header.data(), &oversized, sizeof(oversized));
+    CHECK(tester.receive(oversized_header) == 0); //the largest allowed frame is waited for
+
+    tester.close();
+}
+
+//the receive buffer grows to fit the frame at its front, never past receive_budget, and shrinks back once drained
+void test_receive_buffer()
+{
+    receive_buffer_t buffer{};
+
+    std::span<uint8_t> space = buffer.free_space(1);
+    CHECK(space.size() == initial_receive_buffer_size);
+
+    const frame_header_t header{.type = static_cast<uint32_t>(client_message_type_e::set_handler), .size = 3 * initial_receive_buffer_size};
+    std::memcpy(space.data(), &header, sizeof(header));
+    buffer.commit(sizeof(header));
+
+    space = buffer.free_space(1);
+    CHECK(buffer.capacity == frame_header_size + header.size);
+    CHECK(space.size() == header.size);
+    CHECK(buffer.pending().size() == frame_header_size);
+
+    const frame_header_t huge{.type = static_cast<uint32_t>(client_message_type_e::set_handler), .size = 2 * receive_budget};
+    std::memcpy(buffer.data + buffer.begin, &huge, sizeof(huge));
+    buffer.free_space(1);
+    CHECK(buffer.capacity == receive_budget);
+
+    buffer.consume(frame_header_size);
+    CHECK(buffer.empty());
+    space = buffer.free_space(1);
+    CHECK(buffer.capacity == initial_receive_buffer_size && space.size() == initial_receive_buffer_size);
+}
+
+//values round trip through the fewest bytes, input ending inside a varint is waited for and overlong ones are refused
+void test_varints()
+{
+    for(uint64_t value : {uint64_t{0}, uint64_t{1}, uint64_t{127}, uint64_t{128}, uint64_t{16383}, uint64_t{16384}, uint64_t{UINT32_MAX}, uint64_t{UINT64_MAX}})
+    {
+        uint8_t encoded[max_varint_size];
+        const uint32_t size = encode_varint(value, encoded);
+        CHECK(size == (value == 0 ? 1 : (std::bit_width(value) + 6) / 7));
+
+        uint64_t decoded = 0;
+        CHECK(decode_varint(encoded, size, &decoded) == static_cast<int32_t>(size) && decoded == value);
+        CHECK(decode_varint(encoded, size - 1, &decoded) == 0);
+    }
+
+    uint8_t encoded[max_varint_size];
+    CHECK(encode_varint(300, encoded) == 2 && encoded[0] == 0xAC && encoded[1] == 0x02);
+
+    uint8_t overlong[max_varint_size + 1];
+    std::memset(overlong, 0x80, sizeof(overlong));
+    uint64_t decoded = 0;
+    CHECK(decode_varint(overlong, sizeof(overlong), &decoded) == -1);
+
+    //version 2 headers: a type past uint32_t is malformed, one cut off is waited for
+    uint32_t type = 0;
+    uint64_t payload_size = 0;
+    const uint8_t header[] = {0x02, 0xAC, 0x02};
+    CHECK(decode_frame_header(header, sizeof(header), 2, &type, &payload_size) == 3 && type == 2 && payload_size == 300);
+    CHECK(decode_frame_header(header, 2, 2, &type, &payload_size) == 0);
+    CHECK(decode_frame_header(header, 2, 1, &type, &payload_size) == 0);
+
+    std::vector<uint8_t> wide_type{};
+    append_varint(&wide_type, uint64_t{UINT32_MAX} + 1);
+    append_varint(&wide_type, 0);
+    CHECK(decode_frame_header(wide_type.data(), wide_type.size(), 2, &type, &payload_size) == -1);
+}
+
+//version 2 frames are rebuilt as the version 1 frames the handlers read, anything that does not decode as a whole is invalid
+void test_v2_decoding()
+{
+    const handler_key_t key{.id = handler_id_t::stable_in, .day_of_year = 300, .year = 2026};
+
+    std::vector<uint8_t> payload{};
+    append_varint(&payload, pack_handler_key(key));
+    const std::string_view name = "\xC3\x85sa \xF0\x9F\x90\x8E"; //two code units for the horse
+    payload.insert(payload.end(), name.begin(), name.end());
+
+    std::vector<uint8_t> frame{};
+    decode_v2_client_frame(static_cast<uint32_t>(client_message_type_e::set_handler), payload, &frame);
+
+    frame_header_t header{};
+    std::memcpy(&header, frame.data(), sizeof(header));
+    const std::u16string_view expected_name{u"\u00C5sa \U0001F40E"};
+    CHECK(header.type == static_cast<uint32_t>(client_message_type_e::set_handler));
+    CHECK(header.size == sizeof(handler_key_t) + ((expected_name.size() + 1) * sizeof(char16_t)));
+    CHECK(frame.size() == frame_header_size + header.size);
+    CHECK(std::memcmp(frame.data() + frame_header_size, &key, sizeof(key)) == 0);
+    CHECK(std::memcmp(frame.data() + frame_header_size + sizeof(key), expected_name.data(), expected_name.size() * sizeof(char16_t)) == 0);
+    CHECK(frame.back() == 0 && frame[frame.size() - 2] == 0);
+
+    decode_v2_client_frame(static_cast<uint32_t>(client_message_type_e::login), as_bytes("washington"), &frame);
+    CHECK(frame.size() == frame_header_size + 11 && frame.back() == 0);
+    CHECK(std::memcmp(frame.data() + frame_header_size, "washington", 10) == 0);
+
+    const uint8_t invalid_utf8[] = {0x01, 0xFF};
+    decode_v2_client_frame(static_cast<uint32_t>(client_message_type_e::set_handler), invalid_utf8, &frame);
+    std::memcpy(&header, frame.data(), sizeof(header));
+    CHECK(header.type == static_cast<uint32_t>(client_message_type_e::max) && header.size == 0 && frame.size() == frame_header_size);
+
+    std::vector<uint8_t> trailing{};
+    append_varint(&trailing, 1);
+    append_varint(&trailing, 1);
+    append_varint(&trailing, 1);
+    append_varint(&trailing, 2026);
+    trailing.push_back(0x05); //one field too many for a range
+    decode_v2_client_frame(static_cast<uint32_t>(client_message_type_e::subscribe_handlers), trailing, &frame);
+    std::memcpy(&header, frame.data(), sizeof(header));
+    CHECK(header.type == static_cast<uint32_t>(client_message_type_e::max));
+
+    const uint8_t version[] = {2, 0, 0, 0};
+    decode_v2_client_frame(static_cast<uint32_t>(client_message_type_e::negotiate_protocol), version, &frame);
+    std::memcpy(&header, frame.data(), sizeof(header));
+    CHECK(header.type == static_cast<uint32_t>(client_message_type_e::max)); //only valid in version 1
+}
+
+//the answer is the last version 1 frame, the frames after the request in the same read are already parsed in the new version
+void test_negotiation()
+{
+    test_client_t tester{};
+    if(!tester.open())
+    {
+        CHECK(false);
+        return;
+    }
+
+    const uint32_t requested_version = newest_protocol_version + 5;
+    std::vector<uint8_t> input = v1_frame(client_message_type_e::negotiate_protocol, {reinterpret_cast<const uint8_t*>(&requested_version), sizeof(requested_version)});
+    const std::vector<uint8_t> login = v2_frame(client_message_type_e::login, as_bytes("washington"));
+    input.insert(input.end(), login.begin(), login.end());
+
+    CHECK(tester.receive(input) == static_cast<int64_t>(input.size()));
+    CHECK(tester.client->protocol_version == newest_protocol_version);
+    CHECK(tester.client->logged_in);
+
+    reply_t reply{};
+    uint32_t accepted_version = 0;
+    CHECK(tester.next_reply(1, &reply) && reply.type == static_cast<uint32_t>(server_message_type_e::protocol_accepted) && reply.payload.size() == sizeof(uint32_t));
+    std::memcpy(&accepted_version, reply.payload.data(), std::min<uint64_t>(reply.payload.size(), sizeof(accepted_version)));
+    CHECK(accepted_version == newest_protocol_version);
+    CHECK(tester.next_reply(2, &reply) && reply.type == static_cast<uint32_t>(server_message_type_e::login_response) && reply.payload.at(0) == 1);
+
+    //negotiating again is not answered, the version stays
+    std::vector<uint8_t> again = v2_frame(client_message_type_e::negotiate_protocol, {reinterpret_cast<const uint8_t*>(&requested_version), sizeof(requested_version)});
+    CHECK(tester.receive(again) == static_cast<int64_t>(again.size()));
+    CHECK(!tester.next_reply(2, &reply));
+    CHECK(tester.client->protocol_version == newest_protocol_version);
+
+    tester.close();
+
+    //a version below 1 is raised to it, a request of the wrong size is not answered
+    if(!tester.open())
+    {
+        CHECK(false);
+        return;
+    }
+
+    const uint32_t zero_version = 0;
+    std::vector<uint8_t> oldest = v1_frame(client_message_type_e::negotiate_protocol, {reinterpret_cast<const uint8_t*>(&zero_version), sizeof(zero_version)});
+    CHECK(tester.receive(oldest) == static_cast<int64_t>(oldest.size()));
+    CHECK(tester.next_reply(1, &reply) && reply.type == static_cast<uint32_t>(server_message_type_e::protocol_accepted));
+    std::memcpy(&accepted_version, reply.payload.data(), std::min<uint64_t>(reply.payload.size(), sizeof(accepted_version)));
+    CHECK(accepted_version == 1 && tester.client->protocol_version == 1);
+
+    std::vector<uint8_t> short_request = v1_frame(client_message_type_e::negotiate_protocol, {reinterpret_cast<const uint8_t*>(&requested_version), 2});
+    CHECK(tester.receive(short_request) == static_cast<int64_t>(short_request.size()));
+    CHECK(!tester.next_reply(1, &reply));
+    CHECK(tester.client->protocol_version == 1);
+
+    tester.close();
+}
+
+//an edit made against an older version is moved past every change since, in the order they were applied
+void test_rebase()
+{
+    const handler_key_t key{.id = handler_id_t::pasture, .day_of_year = 12, .year = 2026};
+    const handler_key_t other_key{.id = handler_id_t::pasture, .day_of_year = 13, .year = 2026};
+
+    change_history_t history{};
+    history.record(key, change_history_t::change_t{.version = 2, .position = 0, .delete_count = 0, .insert_count = 3}); //3 inserted in front
+    history.record(key, change_history_t::change_t{.version = 3, .position = 8, .delete_count = 6, .insert_count = 0}); //[8, 14) deleted
+
+    auto rebased = [&history](handler_key_t edited_key, uint32_t base_version, uint32_t position, uint32_t delete_count)
+    {
+        const bool known = history.rebase(edited_key, base_version, 3, &position, &delete_count);
+        return std::tuple{known, position, delete_count};
+    };
+
+    CHECK(rebased(key, 3, 5, 2) == std::tuple(true, 5u, 2u)); //made against the current version
+    CHECK(rebased(key, 2, 2, 3) == std::tuple(true, 2u, 3u)); //in front of every later change
+    CHECK(rebased(key, 1, 0, 0) == std::tuple(true, 3u, 0u)); //text inserted at the same position stays in front
+    CHECK(rebased(key, 1, 1, 2) == std::tuple(true, 4u, 2u));
+    CHECK(rebased(key, 2, 9, 2) == std::tuple(true, 8u, 0u)); //inside the deleted text, nothing is deleted twice
+    CHECK(rebased(key, 2, 6, 4) == std::tuple(true, 6u, 2u)); //overlapping its start
+    CHECK(rebased(key, 2, 12, 4) == std::tuple(true, 8u, 2u)); //overlapping its end
+    CHECK(rebased(key, 2, 20, 1) == std::tuple(true, 14u, 1u)); //behind it
+    CHECK(rebased(key, 1, 10, 1) == std::tuple(true, 8u, 0u)); //moved by the insert into the deleted text
+
+    CHECK(std::get<0>(rebased(key, 4, 0, 0)) == false); //a version the key never had
+    CHECK(std::get<0>(rebased(other_key, 1, 0, 0)) == false); //no history at all
+
+    //only the last max_change_history changes of a key are kept
+    change_history_t long_history{};
+    for(uint32_t version = 2; version <= max_change_history + 2; ++version)
+    {
+        long_history.record(key, change_history_t::change_t{.version = version, .position = 0, .delete_count = 0, .insert_count = 1});
+    }
+
+    uint32_t position = 0;
+    uint32_t delete_count = 0;
+    CHECK(!long_history.rebase(key, 1, max_change_history + 2, &position, &delete_count));
+    CHECK(long_history.rebase(key, 2, max_change_history + 2, &position, &delete_count) && position == max_change_history);
+
+    //and a key loses its history once change_log_capacity changes of other keys were recorded after its last one
+    CHECK(history.rebase(key, 1, 3, &position, &delete_count));
+    for(uint64_t change = 0; change < change_log_capacity; ++change)
+    {
+        history.record(other_key, change_history_t::change_t{.version = static_cast<uint32_t>(change + 2), .position = 0, .delete_count = 0, .insert_count = 0});
+    }
+
+    CHECK(!history.rebase(key, 1, 3, &position, &delete_count));
+    CHECK(!history.keys.contains(std::bit_cast<uint64_t>(key)));
+}
+
+std::vector<uint8_t> range_frame(client_message_type_e type, const handler_range_t& range)
+{
+    return v1_frame(type, {reinterpret_cast<const uint8_t*>(&range), sizeof(range)});
+}
+
+//a client is only treated as subscribed once a subscription was taken, one refused for the limit is disconnected
+void test_subscriptions()
+{
+    test_client_t tester{};
+    if(!tester.open())
+    {
+        CHECK(false);
+        return;
+    }
+
+    tester.client->logged_in = true;
+
+    std::vector<uint8_t> no_ids = range_frame(client_message_type_e::subscribe_handlers, handler_range_t{.id_mask = 0, .first_day_of_year = 1, .day_count = 7, .reserved = 0, .year = 2026});
+    tester.receive(no_ids);
+    CHECK(!tester.client->subscribed);
+
+    std::vector<uint8_t> unsubscribe = range_frame(client_message_type_e::unsubscribe_handlers, handler_range_t{.id_mask = 1, .first_day_of_year = 1, .day_count = 7, .reserved = 0, .year = 2026});
+    tester.receive(unsubscribe);
+    CHECK(!tester.client->subscribed);
+
+    for(uint32_t subscription = 0; subscription < max_client_subscriptions; ++subscription)
+    {
+        std::vector<uint8_t> week = range_frame(client_message_type_e::subscribe_handlers, handler_range_t{.id_mask = 1, .first_day_of_year = static_cast<uint16_t>(1 + subscription), .day_count = 7, .reserved = 0, .year = 2026});
+        tester.receive(week);
+    }
+    CHECK(tester.client->subscribed);
+
+    uint8_t byte = 0;
+    CHECK(recv(tester.peer, &byte, 1, MSG_DONTWAIT) == -1 && errno == EAGAIN);
+
+    std::vector<uint8_t> one_too_many = range_frame(client_message_type_e::subscribe_handlers, handler_range_t{.id_mask = 1, .first_day_of_year = 100, .day_count = 7, .reserved = 0, .year = 2026});
+    tester.receive(one_too_many);
+    CHECK(recv(tester.peer, &byte, 1, MSG_DONTWAIT) == 0); //hung up
+
+    tester.close();
+}
+
+template<typename T>
+std::span<const uint8_t> bytes_of(const T& value)
+{
+    return {reinterpret_cast<const uint8_t*>(&value), sizeof(T)};
+}
+
+//frames are handled where they were received, so after a login with an odd length every field of the next frames is misaligned.
+//run under -fsanitize=alignment this catches any field read in place
+void test_unaligned_frames()
+{
+    test_client_t tester{};
+    if(!tester.open())
+    {
+        CHECK(false);
+        return;
+    }
+
+    const handler_key_t key{.id = handler_id_t::stable_out, .day_of_year = 40, .year = 2026};
+
+    std::vector<uint8_t> set_payload(bytes_of(key).begin(), bytes_of(key).end());
+    for(char16_t code_unit : std::u16string_view{u"\u00C5sa", 4}) //with the terminator
+    {
+        set_payload.insert(set_payload.end(), bytes_of(code_unit).begin(), bytes_of(code_unit).end());
+    }
+
+    const handler_edit_t edit{.key = key, .base_version = 1, .position = 3, .delete_count = 0};
+    std::vector<uint8_t> edit_payload(bytes_of(edit).begin(), bytes_of(edit).end());
+    const char16_t inserted = u'!';
+    edit_payload.insert(edit_payload.end(), bytes_of(inserted).begin(), bytes_of(inserted).end());
+
+    const handler_range_t range{.id_mask = 1 << handler_id_t::stable_out, .first_day_of_year = 40, .day_count = 2, .reserved = 0, .year = 2026};
+    const uint32_t known_versions[] = {0, 0};
+    std::vector<uint8_t> range_payload(bytes_of(range).begin(), bytes_of(range).end());
+    range_payload.insert(range_payload.end(), bytes_of(known_versions).begin(), bytes_of(known_versions).end());
+
+    std::vector<uint8_t> input = v1_frame(client_message_type_e::login, as_bytes(std::string_view{"washington\0", 11}));
+    for(const std::vector<uint8_t>& frame : {v1_frame(client_message_type_e::set_handler, set_payload), v1_frame(client_message_type_e::edit_handler, edit_payload),
+        v1_frame(client_message_type_e::get_handler_range, range_payload), v1_frame(client_message_type_e::get_handler, bytes_of(key))})
+    {
+        input.insert(input.end(), frame.begin(), frame.end());
+    }
+
+    CHECK(tester.receive(input) == static_cast<int64_t>(input.size()));
+
+    reply_t reply{};
+    reply_t range_reply{};
+    while(tester.next_reply(1, &reply) && reply.type != static_cast<uint32_t>(server_message_type_e::sent_handler_name))
+    {
+        if(reply.type == static_cast<uint32_t>(server_message_type_e::sent_handler_range))
+        {
+            range_reply = reply;
+        }
+    }
+
+    CHECK(range_reply.payload.size() >= sizeof(uint32_t) && read_unaligned<uint32_t>(range_reply.payload.data()) == 1); //only the changed day
+
+    const std::u16string_view expected_name{u"\u00C5sa!", 5};
+    CHECK(reply.type == static_cast<uint32_t>(server_message_type_e::sent_handler_name));
+    CHECK(reply.payload.size() == sizeof(key) + (expected_name.size() * sizeof(char16_t)));
+    CHECK(reply.payload.size() >= sizeof(key) && std::memcmp(reply.payload.data() + sizeof(key), expected_name.data(), std::min<uint64_t>(reply.payload.size() - sizeof(key), expected_name.size() * sizeof(char16_t))) == 0);
+
+    tester.close();
+}
+
+int main()
+{
+    logger.level = log_level_e::error; //nothing drains the log rings, the lines would only be dropped
+    io_backend = io_backend_e::epoll;
+    handler_readers.init(1);
+    reactors.resize(1); //gets read handlers as the reactor the client belongs to
+    current_reactor = &reactors[0];
+
+    test_framing();
+    test_receive_buffer();
+    test_varints();
+    test_v2_decoding();
+    test_negotiation();
+    test_rebase();
+    test_subscriptions();
+    test_unaligned_frames();
+
+    if(failed_checks != 0)
+    {
+        fmt::print(stderr, "{} checks failed\n", failed_checks);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+//a minimal io_uring ring without liburing. only the thread that owns the ring may touch it
+struct uring_t
+{
+    int ring_fd = -1;
+
+    uint32_t* sq_head = nullptr;
+    uint32_t* sq_tail = nullptr;
+    uint32_t* sq_array = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t sq_entries = 0;
+    io_uring_sqe* sqes = nullptr;
+    uint32_t sq_pending = 0; //sqes written since the last io_uring_enter
+
+    uint32_t* cq_head = nullptr;
+    uint32_t* cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* sq_ring_memory = nullptr;
+    uint64_t sq_ring_size = 0;
+    void* cq_ring_memory = nullptr;
+    uint64_t cq_ring_size = 0;
+    uint64_t sqes_size = 0;
+
+    //returns -errno on failure
+    int init(uint32_t entries)
+    {
+        io_uring_params params{};
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if(ring_fd == -1)
+        {
+            return -errno;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        if(params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+
+        sq_ring_memory = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if(sq_ring_memory == MAP_FAILED)
+        {
+            return fail();
+        }
+
+        if(params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            cq_ring_memory = sq_ring_memory;
+        }
+        else
+        {
+            cq_ring_memory = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if(cq_ring_memory == MAP_FAILED)
+            {
+                cq_ring_memory = nullptr;
+                return fail();
+            }
+        }
+
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        if(sqes == MAP_FAILED)
+        {
+            sqes = nullptr;
+            return fail();
+        }
+
+        auto sq_bytes = static_cast<uint8_t*>(sq_ring_memory);
+        sq_head = reinterpret_cast<uint32_t*>(sq_bytes + params.sq_off.head);
+        sq_tail = reinterpret_cast<uint32_t*>(sq_bytes + params.sq_off.tail);
+        sq_array = reinterpret_cast<uint32_t*>(sq_bytes + params.sq_off.array);
+        sq_mask = *reinterpret_cast<uint32_t*>(sq_bytes + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+
+        auto cq_bytes = static_cast<uint8_t*>(cq_ring_memory);
+        cq_head = reinterpret_cast<uint32_t*>(cq_bytes + params.cq_off.head);
+        cq_tail = reinterpret_cast<uint32_t*>(cq_bytes + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<uint32_t*>(cq_bytes + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq_bytes + params.cq_off.cqes);
+
+        for(uint32_t index = 0; index < sq_entries; ++index) //sqes are always used in ring order
+        {
+            sq_array[index] = index;
+        }
+
+        return 0;
+    }
+
+    int fail()
+    {
+        const int error = errno;
+        destroy();
+        return -error;
+    }
+
+    void destroy()
+    {
+        if(sqes != nullptr)
+        {
+            munmap(sqes, sqes_size);
+        }
+
+        if(cq_ring_memory != nullptr && cq_ring_memory != sq_ring_memory)
+        {
+            munmap(cq_ring_memory, cq_ring_size);
+        }
+
+        if(sq_ring_memory != nullptr && sq_ring_memory != MAP_FAILED)
+        {
+            munmap(sq_ring_memory, sq_ring_size);
+        }
+
+        if(ring_fd != -1)
+        {
+            close(ring_fd);
+        }
+
+        *this = uring_t{};
+    }
+
+    int register_resource(uint32_t opcode, void* argument, uint32_t argument_count)
+    {
+        if(syscall(__NR_io_uring_register, ring_fd, opcode, argument, argument_count) == -1)
+        {
+            return -errno;
+        }
+
+        return 0;
+    }
+
+    //the returned sqe is zeroed. submits what is already queued if the submission queue is full
+    io_uring_sqe* get_sqe()
+    {
+        while(true)
+        {
+            const uint32_t head = std::atomic_ref<uint32_t>{*sq_head}.load(std::memory_order_acquire);
+            const uint32_t tail = *sq_tail + sq_pending;
+
+            if(tail - head < sq_entries)
+            {
+                io_uring_sqe* sqe = &sqes[tail & sq_mask];
+                std::memset(sqe, 0, sizeof(io_uring_sqe));
+                ++sq_pending;
+                return sqe;
+            }
+
+            (void)submit_and_wait(0);
+        }
+    }
+
+    //one syscall submits every queued sqe and optionally waits for completions
+    int submit_and_wait(uint32_t wait_count)
+    {
+        const uint32_t to_submit = sq_pending;
+        std::atomic_ref<uint32_t>{*sq_tail}.store(*sq_tail + to_submit, std::memory_order_release);
+        sq_pending = 0;
+
+        const uint32_t flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+        long submitted = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_count, flags, nullptr, 0);
+        if(submitted == -1)
+        {
+            return -errno;
+        }
+
+        return static_cast<int>(submitted);
+    }
+
+    //calls on_completion for every available cqe and marks them as seen
+    template<typename F>
+    uint32_t for_each_cqe(F on_completion)
+    {
+        uint32_t head = *cq_head;
+        const uint32_t tail = std::atomic_ref<uint32_t>{*cq_tail}.load(std::memory_order_acquire);
+
+        uint32_t count = 0;
+        for(; head != tail; ++head, ++count)
+        {
+            const io_uring_cqe cqe = cqes[head & cq_mask];
+            std::atomic_ref<uint32_t>{*cq_head}.store(head + 1, std::memory_order_release); //release the slot before handling, handlers may queue more work
+            on_completion(cqe);
+        }
+
+        return count;
+    }
+};
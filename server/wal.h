@@ -0,0 +1,351 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <array>
+#include <vector>
+#include <string_view>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#include "background.h"
+
+inline uint32_t crc32c(uint32_t crc, const uint8_t* data, uint64_t size)
+{
+    crc = ~crc;
+
+#if defined(__SSE4_2__)
+    for(; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+    }
+
+    for(; size > 0; ++data, --size)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+#else
+    static constexpr std::array<uint32_t, 256> table = []{
+        std::array<uint32_t, 256> entries{};
+        for(uint32_t index = 0; index < 256; ++index)
+        {
+            uint32_t entry = index;
+            for(uint32_t bit = 0; bit < 8; ++bit)
+            {
+                entry = (entry >> 1) ^ (0x82F63B78 & -(entry & 1));
+            }
+            entries[index] = entry;
+        }
+        return entries;
+    }();
+
+    for(; size > 0; ++data, --size)
+    {
+        crc = table[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+
+    return ~crc;
+}
+
+//one record per handler change, the checksum covers everything after itself
+struct __attribute__((packed)) wal_record_header_t
+{
+    uint32_t checksum;
+    uint32_t name_size; //in bytes, the name is stored without a null terminator
+    uint64_t key;
+};
+
+//set in name_size when the version of the handler follows the header. records written before versions existed do not have it
+constexpr uint32_t wal_versioned_record = 1u << 31;
+
+//read only mapping of a log file used while loading. names passed to on_record point into the mapping
+struct wal_file_view_t
+{
+    const uint8_t* contents = nullptr;
+    uint64_t size = 0;
+    uint64_t valid_size = 0; //everything after this is a torn or corrupt tail
+    uint64_t records = 0;
+
+    bool map(const char* path)
+    {
+        int file = ::open(path, O_RDONLY | O_CLOEXEC);
+        if(file == -1)
+        {
+            perror("open");
+            return false;
+        }
+
+        struct stat file_stat{};
+        if(fstat(file, &file_stat) == -1)
+        {
+            perror("fstat");
+            ::close(file);
+            return false;
+        }
+
+        size = file_stat.st_size;
+        if(size != 0)
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+            if(mapping == MAP_FAILED)
+            {
+                perror("mmap");
+                ::close(file);
+                return false;
+            }
+            contents = static_cast<const uint8_t*>(mapping);
+        }
+
+        ::close(file);
+        return true;
+    }
+
+    void unmap()
+    {
+        if(contents != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(contents), size);
+        }
+
+        *this = wal_file_view_t{};
+    }
+
+    //calls on_record(key, version, name) for every intact record up to the first torn or corrupt one, version is 0 if the record has none
+    template<typename F>
+    void for_each_record(F on_record)
+    {
+        valid_size = 0;
+        records = 0;
+
+        while(size - valid_size >= sizeof(wal_record_header_t))
+        {
+            wal_record_header_t header;
+            std::memcpy(&header, contents + valid_size, sizeof(header));
+
+            const uint32_t name_size = header.name_size & ~wal_versioned_record;
+            const uint64_t version_size = (header.name_size & wal_versioned_record) != 0 ? sizeof(uint32_t) : 0;
+
+            const uint64_t record_size = sizeof(header) + version_size + name_size;
+            if(size - valid_size < record_size || name_size % 2 != 0)
+            {
+                break;
+            }
+
+            const uint8_t* checked = contents + valid_size + sizeof(header.checksum);
+            if(crc32c(0, checked, record_size - sizeof(header.checksum)) != header.checksum)
+            {
+                break;
+            }
+
+            uint32_t version = 0;
+            std::memcpy(&version, contents + valid_size + sizeof(header), version_size);
+
+            on_record(header.key, version, std::u16string_view{reinterpret_cast<const char16_t*>(contents + valid_size + sizeof(header) + version_size), name_size / 2});
+
+            valid_size += record_size;
+            ++records;
+        }
+    }
+};
+
+//the records appended since the writer last ran. a rotation cuts them at rotate_offset, the ones after it go to rotate_file
+struct wal_batch_t
+{
+    std::vector<uint8_t> records{};
+    int rotate_file = -1;
+    uint64_t rotate_offset = 0;
+
+    bool empty() const
+    {
+        return records.empty() && rotate_file == -1;
+    }
+
+    void clear()
+    {
+        records.clear();
+        rotate_file = -1;
+        rotate_offset = 0;
+    }
+};
+
+//append only log of handler changes. appends are buffered and a background writer makes a whole batch durable with one fdatasync.
+//the log can be rotated to a new file at a point consistent with a snapshot, after which the older files can be deleted
+struct wal_t
+{
+    int file = -1; //only touched by the writer once it runs
+    background_writer_t<wal_t, wal_batch_t> writer{};
+    pthread_cond_t rotated_cond = PTHREAD_COND_INITIALIZER;
+    uint64_t file_size = 0; //only touched by the writer once it runs
+    uint64_t records_since_rotation = 0; //guarded by the writer lock
+    uint64_t unfinished_rotations = 0; //guarded by the writer lock
+
+    //opens the newest log file for appending, cutting off a torn tail found while loading it
+    bool open(const char* path, uint64_t valid_size)
+    {
+        file = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(file == -1)
+        {
+            perror("open");
+            return false;
+        }
+
+        struct stat file_stat{};
+        if(fstat(file, &file_stat) == -1)
+        {
+            perror("fstat");
+            return false;
+        }
+
+        if(static_cast<uint64_t>(file_stat.st_size) != valid_size)
+        {
+            if(ftruncate(file, valid_size) == -1 || fdatasync(file) == -1)
+            {
+                perror("ftruncate");
+                return false;
+            }
+        }
+
+        file_size = valid_size;
+        return writer.start(this);
+    }
+
+    void append(uint64_t key, uint32_t version, std::u16string_view name)
+    {
+        const uint32_t name_size = name.size() * 2;
+        wal_record_header_t header{.checksum = 0, .name_size = name_size | wal_versioned_record, .key = key};
+
+        writer.append([&](wal_batch_t& pending)
+        {
+            const uint64_t record_offset = pending.records.size();
+            pending.records.resize(record_offset + sizeof(header) + sizeof(version) + name_size);
+
+            uint8_t* record = &pending.records[record_offset];
+            std::memcpy(record, &header, sizeof(header));
+            std::memcpy(record + sizeof(header), &version, sizeof(version));
+            std::memcpy(record + sizeof(header) + sizeof(version), name.data(), name_size);
+
+            header.checksum = crc32c(0, record + sizeof(header.checksum), sizeof(header) - sizeof(header.checksum) + sizeof(version) + name_size);
+            std::memcpy(record, &header.checksum, sizeof(header.checksum));
+
+            ++records_since_rotation;
+        });
+    }
+
+    //every record appended after this call goes to new_file. the caller must hold whatever lock orders appends
+    //for the cut to be consistent. returns how many records were appended since the previous rotation
+    uint64_t rotate(int new_file)
+    {
+        uint64_t rotated_records = 0;
+        writer.append([&](wal_batch_t& pending)
+        {
+            pending.rotate_file = new_file;
+            pending.rotate_offset = pending.records.size();
+            ++unfinished_rotations;
+
+            rotated_records = records_since_rotation;
+            records_since_rotation = 0;
+        });
+
+        return rotated_records;
+    }
+
+    uint64_t records_since_last_rotation()
+    {
+        pthread_mutex_lock(&writer.lock);
+        const uint64_t records = records_since_rotation;
+        pthread_mutex_unlock(&writer.lock);
+
+        return records;
+    }
+
+    //blocks until the records before the last rotation are durable in the old file
+    void wait_for_rotation()
+    {
+        pthread_mutex_lock(&writer.lock);
+        while(unfinished_rotations != 0)
+        {
+            pthread_cond_wait(&rotated_cond, &writer.lock);
+        }
+        pthread_mutex_unlock(&writer.lock);
+    }
+
+    //writes out whatever is still pending and stops the writer
+    void close()
+    {
+        if(!writer.running())
+        {
+            return;
+        }
+
+        writer.stop();
+
+        ::close(file);
+        file = -1;
+    }
+
+    //runs on the writer
+    void write_batch(const wal_batch_t& batch)
+    {
+        if(batch.rotate_file == -1)
+        {
+            write_records(batch.records, 0, batch.records.size());
+            return;
+        }
+
+        write_records(batch.records, 0, batch.rotate_offset);
+        ::close(file);
+        file = batch.rotate_file;
+        file_size = 0;
+
+        pthread_mutex_lock(&writer.lock);
+        --unfinished_rotations;
+        pthread_mutex_unlock(&writer.lock);
+        pthread_cond_broadcast(&rotated_cond);
+
+        write_records(batch.records, batch.rotate_offset, batch.records.size());
+    }
+
+    void write_records(const std::vector<uint8_t>& records, uint64_t begin, uint64_t end)
+    {
+        if(begin == end)
+        {
+            return;
+        }
+
+        for(uint64_t offset = begin; offset < end;)
+        {
+            ssize_t nwritten = write(file, records.data() + offset, end - offset);
+            if(nwritten == -1)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                perror("write");
+                (void)ftruncate(file, file_size); //drop the partial batch so later records are not stuck behind a torn one
+                return;
+            }
+            offset += nwritten;
+        }
+
+        if(fdatasync(file) == -1)
+        {
+            perror("fdatasync");
+        }
+
+        file_size += end - begin;
+    }
+};